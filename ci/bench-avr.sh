@@ -0,0 +1,21 @@
+#!/bin/bash
+# Cycle counts of the protocol engine on an ATmega328P (Arduino Uno), in simavr.
+# Builds test/AVR_Benchmark and runs it until the sketch puts the CPU to sleep.
+#
+# Needs arduino-cli with the arduino:avr core and the MIDI library (see
+# build-arduino.sh) and simavr (e.g. apt install simavr).
+set -e
+
+cd "$(dirname "$0")/.."
+
+BUILD=${BUILD:-/tmp/AVR_Benchmark}
+FQBN=${FQBN:-arduino:avr:uno}
+MCU=${MCU:-atmega328p}
+
+arduino-cli compile -b "$FQBN" --library "$PWD" --output-dir "$BUILD" test/AVR_Benchmark
+
+# avr-size comes with the core when it is not on the PATH
+AVR_SIZE=$(command -v avr-size || ls $HOME/.arduino15/packages/arduino/tools/avr-gcc/*/bin/avr-size | tail -n 1)
+"$AVR_SIZE" -C --mcu="$MCU" "$BUILD/AVR_Benchmark.ino.elf"
+
+timeout 60 simavr -m "$MCU" -f 16000000 "$BUILD/AVR_Benchmark.ino.elf"
@@ -0,0 +1,23 @@
+#!/bin/bash
+# Fuzzes the AppleMIDI, RTP-MIDI and UMP parsers with libFuzzer (test/fuzz), for
+# FUZZ_TIME seconds each. A crash, a datagram the session stops reading, or
+# an input that costs more than linear work leaves a crash-* file in $BUILD.
+#
+# Needs clang and the MIDI library (see build-arduino.sh).
+set -e
+
+cd "$(dirname "$0")/.."
+
+BUILD=${BUILD:-/tmp/fuzz}
+FUZZ_TIME=${FUZZ_TIME:-60}
+MIDI_LIBRARY=${MIDI_LIBRARY:-$HOME/Arduino/libraries/MIDI_Library/src}
+
+mkdir -p "$BUILD"
+
+for target in AppleMIDI rtpMIDI UMP; do
+    clang++ -std=c++11 -g -O1 -fsanitize=fuzzer,address,undefined -DFUZZING_ENGINE \
+        -Itest -Isrc -I"$MIDI_LIBRARY" test/fuzz/fuzz_$target.cpp -o "$BUILD/fuzz_$target"
+
+    mkdir -p "$BUILD/corpus_$target"
+    (cd "$BUILD" && ./fuzz_$target -max_total_time="$FUZZ_TIME" -timeout=1 -max_len=4096 corpus_$target)
+done
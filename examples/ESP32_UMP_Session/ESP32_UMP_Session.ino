@@ -0,0 +1,86 @@
+#include <WiFi.h>
+#include <WiFiClient.h>
+#include <WiFiUdp.h>
+#include <ESPmDNS.h>
+
+#define SerialMon Serial
+#include <UMP_Session.h>
+
+char ssid[] = "ssid"; //  your network SSID (name)
+char pass[] = "password";    // your network password (use for WPA, or use as key for WEP)
+
+unsigned long t0 = millis();
+int8_t isConnected = 0;
+
+UMP_CREATE_DEFAULTSESSION_INSTANCE();
+
+// -----------------------------------------------------------------------------
+//
+// -----------------------------------------------------------------------------
+void setup()
+{
+  AM_DBG_SETUP(115200);
+  AM_DBG(F("Booting"));
+
+  WiFi.begin(ssid, pass);
+
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(500);
+    AM_DBG(F("Establishing connection to WiFi.."));
+  }
+  AM_DBG(F("Connected to network"));
+
+  // Network MIDI 2.0 hosts are found through mDNS
+  MDNS.begin(UMP.getName());
+  MDNS.addService("_midi2", "_udp", UMP.getPort());
+  MDNS.addServiceTxt("_midi2", "_udp", "UMPEndpointName", UMP.getName());
+
+  AM_DBG(F("OK, now connect a Network MIDI 2.0 client to"), WiFi.localIP(), "Port", UMP.getPort(), "(Name", UMP.getName(), ")");
+  AM_DBG(F("Then open a MIDI 2.0 listener and monitor incoming notes"));
+
+  UMP.setHandleConnected([](const IPAddress & ip, const char* name) {
+    isConnected++;
+    AM_DBG(F("Connected to session"), ip, name);
+  });
+  UMP.setHandleDisconnected([](const IPAddress & ip) {
+    isConnected--;
+    AM_DBG(F("Disconnected"), ip);
+  });
+
+  UMP.begin();
+
+  AM_DBG(F("Sending MIDI 2.0 NoteOn/Off of note 45, every second"));
+}
+
+// -----------------------------------------------------------------------------
+//
+// -----------------------------------------------------------------------------
+void loop()
+{
+  // Listen to incoming Universal MIDI Packets
+  while (UMP.available())
+  {
+    uint32_t words[4];
+    auto count = UMP.read(words);
+
+    // MIDI 2.0 channel voice message: note on or off, velocity in 16 bits
+    auto status = (words[0] >> 16) & 0xF0;
+    if (count == 2 && (words[0] >> 28) == 0x4 && (status == 0x90 || status == 0x80))
+      AM_DBG(status == 0x90 ? F("NoteOn") : F("NoteOff"), (words[0] >> 8) & 0x7F, words[1] >> 16);
+  }
+
+  // send a note every second
+  // (dont cáll delay(1000) as it will stall the pipeline)
+  if ((isConnected > 0) && (millis() - t0) > 1000)
+  {
+    t0 = millis();
+
+    uint8_t group = 0;
+    uint8_t channel = 0;
+    uint8_t note = 45;
+    uint16_t velocity = 0xC000;
+
+    UMP.sendNoteOn(group, channel, note, velocity);
+    UMP.sendNoteOff(group, channel, note, velocity);
+  }
+}
@@ -12,11 +12,17 @@ using namespace MIDI_NAMESPACE;
 #include "AppleMIDI_PlatformBegin.h"
 #include "AppleMIDI_Defs.h"
 #include "AppleMIDI_Settings.h"
+#include "AppleMIDI_Trace.h"
+#ifdef USE_PCAP_CAPTURE
+#include "AppleMIDI_Capture.h"
+#endif
 
 #include "rtp_Defs.h"
 #include "rtpMIDI_Defs.h"
 #include "rtpMIDI_Clock.h"
 
+#include "AppleMIDI_Transport.h"
+
 #include "AppleMIDI_Participant.h"
 
 #include "AppleMIDI_Parser.h"
@@ -35,19 +41,37 @@ struct AppleMIDISettings : public MIDI_NAMESPACE::DefaultSettings
     static const bool Use1ByteParsing = false;
 };
 
-template <class UdpClass, class _Settings = DefaultSettings, class _Platform = DefaultPlatform>
-class AppleMIDISession
+// The protocol engine: parsers, participants, buffers and all session logic.
+// It does not depend on the UdpClass, it reaches the sockets through
+// UdpTransport, so all sessions with the same Settings, Platform and Tracer
+// share one copy of this code. Use it through AppleMIDISession (below).
+template <class _Settings, class _Platform, class _Tracer>
+class AppleMIDICore
 {
     typedef _Settings Settings;
     typedef _Platform Platform;
+    typedef _Tracer Tracer;
+
+    static_assert(Settings::SysExPacketMaxSize > 2 && Settings::SysExPacketMaxSize <= RTP_MIDI_CS_MASK_LONGLEN,
+                  "SysExPacketMaxSize must fit the 12-bit LEN field of the MIDI command section");
+    static_assert(MaxOutMidiBufferSizeOf<Settings>::value <= RTP_MIDI_CS_MASK_LONGLEN,
+                  "MaxOutMidiBufferSize must fit the 12-bit LEN field of the MIDI command section");
+    static_assert(MaxControlBufferSizeOf<Settings>::value >= 16 && MaxDataBufferSizeOf<Settings>::value >= 36,
+                  "The control buffer must hold an invitation (16 bytes), the data buffer a synchronization (36 bytes)");
+    static_assert(Settings::OutgoingFlush != FlushAtThreshold || Settings::FlushThreshold < MaxOutMidiBufferSizeOf<Settings>::value,
+                  "FlushThreshold must be smaller than MaxOutMidiBufferSize");
 
     // Allow these internal classes access to our private members
     // to avoid access by the .ino to internal messages
-    friend class AppleMIDIParser<UdpClass, Settings, Platform>;
-    friend class rtpMIDIParser<UdpClass, Settings, Platform>;
+    friend class AppleMIDIParser<Settings, Platform, Tracer>;
+    friend class rtpMIDIParser<Settings, Platform, Tracer>;
+    // for its Footprint
+    template <class, class, class, class>
+    friend class AppleMIDISession;
 
-public:
-    AppleMIDISession(const char *sessionName, const uint16_t port = DEFAULT_CONTROL_PORT)
+protected:
+    AppleMIDICore(UdpTransport &controlPort, UdpTransport &dataPort, const char *sessionName, const uint16_t port)
+        : controlPort(controlPort), dataPort(dataPort)
     {
         this->port = port;
 #ifdef KEEP_SESSION_NAME
@@ -60,62 +84,74 @@ public:
 #endif
     };
 
-    virtual ~AppleMIDISession(){};
+public:
+    virtual ~AppleMIDICore(){};
 
-    AppleMIDISession &setHandleConnected(void (*fptr)(const ssrc_t &, const char *))
+    AppleMIDICore &setHandleConnected(void (*fptr)(const ssrc_t &, const char *))
     {
         _connectedCallback = fptr;
         return *this;
     }
-    AppleMIDISession &setHandleDisconnected(void (*fptr)(const ssrc_t &))
+    AppleMIDICore &setHandleDisconnected(void (*fptr)(const ssrc_t &))
     {
         _disconnectedCallback = fptr;
         return *this;
     }
 #ifdef USE_EXT_CALLBACKS
-    AppleMIDISession &setHandleException(void (*fptr)(const ssrc_t &, const Exception &, const int32_t value))
+    AppleMIDICore &setHandleException(void (*fptr)(const ssrc_t &, const Exception &, const int32_t value))
     {
         _exceptionCallback = fptr;
         return *this;
     }
-    AppleMIDISession &setHandleReceivedRtp(void (*fptr)(const ssrc_t &, const Rtp_t &, const int32_t &))
+    AppleMIDICore &setHandleReceivedRtp(void (*fptr)(const ssrc_t &, const Rtp_t &, const int32_t &))
     {
         _receivedRtpCallback = fptr;
         return *this;
     }
-    AppleMIDISession &setHandleStartReceivedMidi(void (*fptr)(const ssrc_t &))
+    AppleMIDICore &setHandleStartReceivedMidi(void (*fptr)(const ssrc_t &))
     {
         _startReceivedMidiByteCallback = fptr;
         return *this;
     }
-    AppleMIDISession &setHandleReceivedMidi(void (*fptr)(const ssrc_t &, byte))
+    AppleMIDICore &setHandleReceivedMidi(void (*fptr)(const ssrc_t &, byte))
     {
         _receivedMidiByteCallback = fptr;
         return *this;
     }
-    AppleMIDISession &setHandleEndReceivedMidi(void (*fptr)(const ssrc_t &))
+    AppleMIDICore &setHandleEndReceivedMidi(void (*fptr)(const ssrc_t &))
     {
         _endReceivedMidiByteCallback = fptr;
         return *this;
     }
-    AppleMIDISession &setHandleSentRtp(void (*fptr)(const Rtp_t &))
+    AppleMIDICore &setHandleSentRtp(void (*fptr)(const Rtp_t &))
     {
         _sentRtpCallback = fptr;
         return *this;
     }
-    AppleMIDISession &setHandleSentRtpMidi(void (*fptr)(const RtpMIDI_t &))
+    AppleMIDICore &setHandleSentRtpMidi(void (*fptr)(const RtpMIDI_t &))
     {
         _sentRtpMidiCallback = fptr;
         return *this;
     }
 #endif
 
+#ifdef USE_SYSEX_STREAMING
+    // SysEx messages are not passed on through read(), but handed over in
+    // chunks as they arrive: the data octets only (without F0 and F7), and
+    // SysExChunkFlags telling the first and last chunk of a message.
+    AppleMIDICore &setHandleSysExChunk(void (*fptr)(const ssrc_t &, const byte *, uint16_t, uint8_t))
+    {
+        _sysExChunkCallback = fptr;
+        return *this;
+    }
+#endif
+
 #ifdef KEEP_SESSION_NAME
     const char *getName() const
     {
         return this->localName;
     };
-    AppleMIDISession &setName(const char *sessionName)
+    AppleMIDICore &setName(const char *sessionName)
     {
         strncpy(this->localName, sessionName, Settings::MaxSessionNameLen);
         this->localName[Settings::MaxSessionNameLen] = '\0';
@@ -126,7 +162,7 @@ public:
     {
         return nullptr;
     };
-    AppleMIDISession &setName(const char *sessionName) { return *this; };
+    AppleMIDICore &setName(const char *sessionName) { return *this; };
 #endif
 
     const uint16_t getPort() const
@@ -135,7 +171,7 @@ public:
     };
 
     // call this method *before* calling begin()
-    AppleMIDISession & setPort(const uint16_t port)
+    AppleMIDICore & setPort(const uint16_t port)
     {
         this->port = port;
         return *this;
@@ -143,11 +179,51 @@ public:
 
     const ssrc_t getSynchronizationSource() const { return this->ssrc; };
 
+#ifdef USE_LATENCY_HISTOGRAM
+    // Latency and jitter statistics of the given participant, in rtp clock
+    // units (100us). Latency is recorded from the first clock synchronization (CK)
+    // on. Returns nullptr when the participant is unknown.
+    const Histogram *getLatencyHistogram(const ssrc_t &);
+    const Histogram *getJitterHistogram(const ssrc_t &);
+    // RFC 3550 interarrival jitter estimate
+    uint32_t getJitter(const ssrc_t &);
+#endif
+
+#ifdef USE_PCAP_CAPTURE
+    // Record all control and data datagrams, in and out, into the capture.
+    // nullptr stops capturing.
+    AppleMIDICore &setCapture(PcapCapture *capture)
+    {
+        _capture = capture;
+        _captureInbound = nullptr;
+        return *this;
+    }
+#endif
+
 #ifdef APPLEMIDI_INITIATOR
     bool sendInvite(IPAddress ip, uint16_t port = DEFAULT_CONTROL_PORT);
 #endif
     void sendEndSession();
 
+    // Queue up MIDI messages without going through the MIDI library: each message
+    // is written into the next packet as a whole. Channel 1 - 16, as in the MIDI library.
+    // Return false when there is nobody to send to, or (USE_PACING) the queue is
+    // full while a participant is out of tokens.
+    bool sendNoteOn(byte note, byte velocity, byte channel);
+    bool sendNoteOff(byte note, byte velocity, byte channel);
+    bool sendControlChange(byte number, byte value, byte channel);
+    bool sendProgramChange(byte number, byte channel);
+    // Returns the number of events queued up; SysEx is not supported here, see sendSysEx()
+    size_t sendBatch(const MidiEvent *events, size_t count);
+
+    // Send a SysEx message of any size, in as few packets as SysExPacketMaxSize
+    // allows, straight from the given buffer. Anything queued is sent first.
+    // Returns the number of bytes of data sent. With USE_PACING that is less
+    // than size when a participant runs out of tokens: call again later with
+    // the rest, the message continues where it stopped. Until then, send
+    // nothing but real-time messages. No data (size 0) sends nothing.
+    size_t sendSysEx(const byte *data, size_t size, bool containsBoundaries = false);
+
 public:
     // Override default thruActivated. Must be false for all packet based messages
     static const bool thruActivated = false;
@@ -173,6 +249,7 @@ public:
         //
         // NOTE: Arduino random only goes to INT32_MAX (not UINT32_MAX)
         this->ssrc = random(1, INT32_MAX / 2) * 2;
+        buildRtpHeader();
 
         controlPort.begin(port);
         dataPort.begin(port + 1);
@@ -189,7 +266,7 @@ public:
         dataPort.stop();
     }
 
-    bool beginTransmission(MIDI_NAMESPACE::MidiType)
+    bool beginTransmission(MIDI_NAMESPACE::MidiType type)
     {
         // All MIDI commands queued up in the same cycle (during 1 loop execution)
         // are send in a single MIDI packet
@@ -205,28 +282,40 @@ public:
         // single packet, at the expense of increasing the sender queuing
         // latency.
         //
-        if (!outMidiBuffer.empty())
+        // Real-time messages can skip the queue, see Settings::RealTimeMessages
+        _realTimePending = (Settings::RealTimeMessages != RealTimeBatched && type >= MIDI_NAMESPACE::MidiType::Clock);
+
+        if (outMidiBuffer.empty())
+        {
+            if (Settings::OutgoingFlush == FlushAfterWindow || Settings::OutgoingFlush == FlushAtThreshold)
+                _outMidiBufferTime = millis();
+        }
+        else if (!_realTimePending)
         {
             // Check if there is still room for more - like for 3 bytes or so)
-            if ((outMidiBuffer.size() + 1 + 3) > outMidiBuffer.max_size())
-                writeRtpMidiToAllParticipants();
-            else
+            if (outMidiBuffer.free() >= 1 + 3)
                 outMidiBuffer.push_back(0x00); // zero timestamp
+            else if (!makeRoom(1 + 3))
+                return false; // held back by pacing, the MIDI library drops the message
         }
 
         // We can't start the writing process here, as we do not know the length
         // of what we are to send (The RtpMidi protocol start with writing the
         // length of the buffer). So we'll copy to a buffer in the 'write' method,
         // and actually serialize for real in the endTransmission method
-#ifndef ONE_PARTICIPANT
-        return (dataPort.remoteIP() != (IPAddress)INADDR_NONE && participants.size() > 0);
-#else
-        return (dataPort.remoteIP() != (IPAddress)INADDR_NONE && participant.ssrc != 0);
-#endif
+        return canTransmit();
     };
 
     void write(byte byte)
     {
+        if (_realTimePending)
+        {
+            // real-time messages are a single byte
+            _realTimePending = false;
+            writeRealTime(byte);
+            return;
+        }
+
         // do we still have place in the buffer for 1 more character?
         if ((outMidiBuffer.size()) + 2 > outMidiBuffer.max_size())
         {
@@ -256,7 +345,11 @@ public:
         outMidiBuffer.push_back(byte);
     };
 
-    void endTransmission(){};
+    void endTransmission()
+    {
+        if (Settings::OutgoingFlush != FlushEveryLoop)
+            manageOutMidiBuffer(false);
+    };
 
     // first things MIDI.read() calls in this method
     // MIDI-read() must be called at the start of loop()
@@ -269,10 +362,8 @@ public:
 #endif
 
         // All MIDI commands queued up in the same cycle (during 1 loop execution)
-        // are send in a single MIDI packet
-        if (outMidiBuffer.size() > 0)
-            writeRtpMidiToAllParticipants();
-        // assert(outMidiBuffer.size() == 0); // must be empty
+        // are send in a single MIDI packet (see Settings::OutgoingFlush)
+        manageOutMidiBuffer(true);
 
         if (inMidiBuffer.size() > 0)
             return inMidiBuffer.size();
@@ -298,17 +389,17 @@ public:
     };
 
 protected:
-    UdpClass controlPort;
-    UdpClass dataPort;
+    UdpTransport &controlPort;
+    UdpTransport &dataPort;
 
 private:
-    RtpBuffer_t controlBuffer;
+    ControlBuffer_t controlBuffer;
     RtpBuffer_t dataBuffer;
+    // bytes left of each datagram in dataBuffer, the last one may not be read completely
+    Deque<uint16_t, Settings::MaxDataFrames> dataFrames;
 
-    byte packetBuffer[Settings::UdpTxPacketMaxSize];
-
-    AppleMIDIParser<UdpClass, Settings, Platform> _appleMIDIParser;
-    rtpMIDIParser<UdpClass, Settings, Platform> _rtpMIDIParser;
+    AppleMIDIParser<Settings, Platform, Tracer> _appleMIDIParser;
+    rtpMIDIParser<Settings, Platform, Tracer> _rtpMIDIParser;
 
     connectedCallback _connectedCallback = nullptr;
     disconnectedCallback _disconnectedCallback = nullptr;
@@ -320,14 +411,28 @@ private:
     sentRtpCallback _sentRtpCallback = nullptr;
     sentRtpMidiCallback _sentRtpMidiCallback = nullptr;
     exceptionCallback _exceptionCallback = nullptr;
+#endif
+#ifdef USE_PCAP_CAPTURE
+    PcapCapture *_capture = nullptr;
+    // the port of the inbound datagram whose record is open, while it is read in parts
+    UdpTransport *_captureInbound = nullptr;
+#endif
+#ifdef USE_SYSEX_STREAMING
+    sysExChunkCallback _sysExChunkCallback = nullptr;
 #endif
     // buffer for incoming and outgoing MIDI messages
-    MidiBuffer_t inMidiBuffer;
-    MidiBuffer_t outMidiBuffer;
+    InMidiBuffer_t inMidiBuffer;
+    OutMidiBuffer_t outMidiBuffer;
+    bool _realTimePending = false;
+#ifdef USE_PACING
+    bool _sysExOutContinues = false; // sendSysEx stopped in the middle of a message
+#endif
+    unsigned long _outMidiBufferTime = 0; // when the first queued up message was written
 
     rtpMidi_Clock rtpMidiClock;
 
     ssrc_t ssrc = 0;
+    uint8_t _rtpHeader[sizeof(Rtp_t)] = {}; // invariant fields, prepared in begin()
     uint16_t port = DEFAULT_CONTROL_PORT;
 #ifdef ONE_PARTICIPANT
     Participant<Settings> participant;
@@ -345,6 +450,8 @@ private:
 
     void parseControlPackets();
     void parseDataPackets();
+    size_t consumeDataFrames(size_t);
+    void dropDataFrame();
 
     void ReceivedInvitation(AppleMIDI_Invitation_t &, const amPortType &);
     void ReceivedControlInvitation(AppleMIDI_Invitation_t &);
@@ -360,21 +467,42 @@ private:
     void ReceivedInvitationRejected(AppleMIDI_InvitationRejected_t &);
 
     // rtpMIDI callback from parser
-    void ReceivedRtp(const Rtp_t &);
+    bool ReceivedRtp(const Rtp_t &);
     void StartReceivedMidi();
     void ReceivedMidi(byte data);
     void EndReceivedMidi();
+#ifdef USE_SYSEX_STREAMING
+    void ReceivedSysExChunk(const byte *, uint16_t, uint8_t);
+#endif
 
     // Helpers
-    void writeInvitation(UdpClass &, const IPAddress &, const uint16_t &, AppleMIDI_Invitation_t &, const byte *command);
+    bool sendPacket(UdpTransport &, const IPAddress &, const uint16_t &, const UdpSegment *, uint8_t);
+
+    void writeInvitation(UdpTransport &, const IPAddress &, const uint16_t &, AppleMIDI_Invitation_t &, const byte *header);
     void writeReceiverFeedback(const IPAddress &, const uint16_t &, AppleMIDI_ReceiverFeedback_t &);
     void writeSynchronization(const IPAddress &, const uint16_t &, AppleMIDI_Synchronization_t &);
     void writeEndSession(const IPAddress &, const uint16_t &, AppleMIDI_EndSession_t &);
 
     void sendEndSession(Participant<Settings> *);
 
+    bool canTransmit();
+    bool queueMidi(const byte *, uint8_t);
+    bool makeRoom(size_t);
+    void manageOutMidiBuffer(bool);
     void writeRtpMidiToAllParticipants();
     void writeRtpMidiBuffer(Participant<Settings> *);
+    void buildRtpHeader();
+    void writeRtpHeader(uint8_t *, Participant<Settings> *);
+    void writeRtpMidiSysEx(Participant<Settings> *, const byte *, size_t, byte, byte);
+    void writeRealTime(byte);
+    void writeRtpMidiRealTime(Participant<Settings> *, byte);
+
+#ifdef USE_PACING
+    uint32_t sendByteRate(const Participant<Settings> *) const;
+    void refillTokens(Participant<Settings> *);
+    void spendTokens(Participant<Settings> *, size_t);
+    bool pacingAllowsSend();
+#endif
 
     void manageReceiverFeedback();
 
@@ -395,6 +523,96 @@ private:
 #endif
 };
 
+// The sockets of a session. A base class of AppleMIDISession ahead of
+// AppleMIDICore, so they exist before the core is given references to them.
+template <class UdpClass>
+struct AppleMIDIPorts
+{
+    UdpAdapter<UdpClass> controlAdapter;
+    UdpAdapter<UdpClass> dataAdapter;
+};
+
+// A session on a UdpClass: the sockets, and the AppleMIDICore working on them.
+template <class UdpClass, class _Settings = DefaultSettings, class _Platform = DefaultPlatform, class _Tracer = NoTrace>
+class AppleMIDISession : private AppleMIDIPorts<UdpClass>, public AppleMIDICore<_Settings, _Platform, _Tracer>
+{
+    typedef AppleMIDICore<_Settings, _Platform, _Tracer> Core;
+
+public:
+    // RAM used by the parts of this session, in bytes (see below the class)
+    struct Footprint;
+
+    AppleMIDISession(const char *sessionName, const uint16_t port = DEFAULT_CONTROL_PORT)
+        : Core(this->controlAdapter, this->dataAdapter, sessionName, port)
+    {
+        static_assert(_Settings::MaxSessionFootprint == 0 || sizeof(AppleMIDISession) <= _Settings::MaxSessionFootprint,
+                      "The session is larger than Settings::MaxSessionFootprint, see AppleMIDISession::Footprint");
+    }
+
+    // The setters of the core, returning the session, so that a chain of them
+    // still ends on an AppleMIDISession
+    AppleMIDISession &setHandleConnected(void (*fptr)(const ssrc_t &, const char *)) { Core::setHandleConnected(fptr); return *this; }
+    AppleMIDISession &setHandleDisconnected(void (*fptr)(const ssrc_t &)) { Core::setHandleDisconnected(fptr); return *this; }
+#ifdef USE_EXT_CALLBACKS
+    AppleMIDISession &setHandleException(void (*fptr)(const ssrc_t &, const Exception &, const int32_t value)) { Core::setHandleException(fptr); return *this; }
+    AppleMIDISession &setHandleReceivedRtp(void (*fptr)(const ssrc_t &, const Rtp_t &, const int32_t &)) { Core::setHandleReceivedRtp(fptr); return *this; }
+    AppleMIDISession &setHandleStartReceivedMidi(void (*fptr)(const ssrc_t &)) { Core::setHandleStartReceivedMidi(fptr); return *this; }
+    AppleMIDISession &setHandleReceivedMidi(void (*fptr)(const ssrc_t &, byte)) { Core::setHandleReceivedMidi(fptr); return *this; }
+    AppleMIDISession &setHandleEndReceivedMidi(void (*fptr)(const ssrc_t &)) { Core::setHandleEndReceivedMidi(fptr); return *this; }
+    AppleMIDISession &setHandleSentRtp(void (*fptr)(const Rtp_t &)) { Core::setHandleSentRtp(fptr); return *this; }
+    AppleMIDISession &setHandleSentRtpMidi(void (*fptr)(const RtpMIDI_t &)) { Core::setHandleSentRtpMidi(fptr); return *this; }
+#endif
+#ifdef USE_SYSEX_STREAMING
+    AppleMIDISession &setHandleSysExChunk(void (*fptr)(const ssrc_t &, const byte *, uint16_t, uint8_t)) { Core::setHandleSysExChunk(fptr); return *this; }
+#endif
+    AppleMIDISession &setName(const char *sessionName) { Core::setName(sessionName); return *this; }
+    AppleMIDISession &setPort(const uint16_t port) { Core::setPort(port); return *this; }
+#ifdef USE_PCAP_CAPTURE
+    AppleMIDISession &setCapture(PcapCapture *capture) { Core::setCapture(capture); return *this; }
+#endif
+};
+
+// Compile-time breakdown of the RAM used by a session, for the given Settings
+// and feature macros. e.g. Serial.println(decltype(AppleMIDI)::Footprint::Session);
+template <class UdpClass, class Settings, class Platform, class Tracer>
+struct AppleMIDISession<UdpClass, Settings, Platform, Tracer>::Footprint
+{
+    typedef AppleMIDICore<Settings, Platform, Tracer> Session_t;
+
+    static constexpr size_t ControlBuffer = sizeof(Session_t::controlBuffer);
+    static constexpr size_t DataBuffer = sizeof(Session_t::dataBuffer) + sizeof(Session_t::dataFrames);
+    static constexpr size_t InMidiBuffer = sizeof(Session_t::inMidiBuffer);
+    static constexpr size_t OutMidiBuffer = sizeof(Session_t::outMidiBuffer);
+    static constexpr size_t Buffers = ControlBuffer + DataBuffer + InMidiBuffer + OutMidiBuffer;
+
+    static constexpr size_t Parsers = sizeof(Session_t::_appleMIDIParser) + sizeof(Session_t::_rtpMIDIParser);
+    // the adapters (UdpClass and vtable pointer) and the core's references to them
+    static constexpr size_t Ports = sizeof(AppleMIDIPorts<UdpClass>) + 2 * sizeof(UdpTransport *);
+
+    // includes their session names (KEEP_SESSION_NAME)
+#ifdef ONE_PARTICIPANT
+    static constexpr size_t Participants = sizeof(Session_t::participant);
+#else
+    static constexpr size_t Participants = sizeof(Session_t::participants);
+#endif
+
+#ifdef USE_DIRECTORY
+    static constexpr size_t Directory = sizeof(Session_t::directory);
+#else
+    static constexpr size_t Directory = 0;
+#endif
+
+#ifdef KEEP_SESSION_NAME
+    static constexpr size_t SessionName = sizeof(Session_t::localName);
+#else
+    static constexpr size_t SessionName = 0;
+#endif
+
+    // the whole session, the remainder is clock, callbacks, state and padding
+    static constexpr size_t Session = sizeof(AppleMIDISession<UdpClass, Settings, Platform, Tracer>);
+    static constexpr size_t Other = Session - Buffers - Parsers - Ports - Participants - Directory - SessionName;
+};
+
 END_APPLEMIDI_NAMESPACE
 
 #include "AppleMIDI.hpp"
@@ -6,32 +6,67 @@
 BEGIN_APPLEMIDI_NAMESPACE
 
 // Read pending control UDP packets into the control buffer.
-template <class UdpClass, class Settings, class Platform>
-size_t AppleMIDISession<UdpClass, Settings, Platform>::readControlPackets()
+template <class Settings, class Platform, class Tracer>
+size_t AppleMIDICore<Settings, Platform, Tracer>::readControlPackets()
 {
+    // the rest of a datagram that did not fit in the buffer, or the next one
     size_t packetSize = controlPort.available();
     if (packetSize == 0)
-       packetSize = controlPort.parsePacket();
+    {
+        packetSize = controlPort.parsePacket();
+        if (packetSize > 0)
+        {
+            Tracer::trace(TracePacketReceived, amPortType::Control, packetSize);
+#ifdef USE_PCAP_CAPTURE
+            if (nullptr != _capture)
+            {
+                _capture->begin(Inbound, controlPort.remoteIP(), controlPort.remotePort(), this->port, rtpMidiClock.Now(), packetSize);
+                _captureInbound = &controlPort;
+            }
+#endif
+        }
+    }
 
+    // read straight into the free space of the buffer, in 2 parts when it wraps around
     while (packetSize > 0 && !controlBuffer.full())
     {
-        auto bytesToRead = min( min(packetSize, controlBuffer.free()), sizeof(packetBuffer));
-        auto bytesRead = controlPort.read(packetBuffer, bytesToRead);
+        byte *region;
+        auto bytesToRead = min(packetSize, controlBuffer.free_contiguous(region));
+        auto bytesRead = controlPort.read(region, bytesToRead);
+        if (bytesRead <= 0)
+            break;
         packetSize -= bytesRead;
 
-        controlBuffer.push_back(packetBuffer, bytesRead);
+        controlBuffer.commit_back(bytesRead);
+#ifdef USE_PCAP_CAPTURE
+        if (nullptr != _capture && _captureInbound == &controlPort)
+            _capture->append(region, bytesRead);
+#endif
     }
 
+#ifdef USE_PCAP_CAPTURE
+    // the record stays open until the datagram is read completely
+    if (nullptr != _capture && _captureInbound == &controlPort && packetSize == 0)
+    {
+        _capture->end();
+        _captureInbound = nullptr;
+    }
+#endif
+
     return controlBuffer.size();
 }
 
 // Parse buffered control packets and handle errors.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::parseControlPackets()
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::parseControlPackets()
 {
     while (controlBuffer.size() > 0)
     {
-        auto retVal = _appleMIDIParser.parse(controlBuffer, amPortType::Control);
+        Tracer::trace(TraceParseBegin, amPortType::Control, controlBuffer.size());
+        // the control port keeps no datagram boundaries: the message can run up to
+        // the end of what is in the buffer and in the socket
+        auto retVal = _appleMIDIParser.parse(controlBuffer, amPortType::Control, controlBuffer.size() + controlPort.available());
+        Tracer::trace(TraceParseEnd, amPortType::Control, retVal);
         if (retVal == parserReturn::Processed 
         ||  retVal == parserReturn::NotEnoughData
         ||  retVal == parserReturn::NotSureGiveMeMoreData)
@@ -55,62 +90,164 @@ void AppleMIDISession<UdpClass, Settings, Platform>::parseControlPackets()
 }
 
 // Read pending data UDP packets into the data buffer.
-template <class UdpClass, class Settings, class Platform>
-size_t AppleMIDISession<UdpClass, Settings, Platform>::readDataPackets()
+template <class Settings, class Platform, class Tracer>
+size_t AppleMIDICore<Settings, Platform, Tracer>::readDataPackets()
 {
+    // the rest of a datagram that did not fit in the buffer, or the next one
     size_t packetSize = dataPort.available();
-    if (packetSize == 0)
-       packetSize = dataPort.parsePacket();
-    
+    if (packetSize == 0 && !dataFrames.full())
+    {
+        packetSize = dataPort.parsePacket();
+        if (packetSize > 0)
+        {
+            dataFrames.push_back(packetSize);
+
+            Tracer::trace(TracePacketReceived, amPortType::Data, packetSize);
+#ifdef USE_PCAP_CAPTURE
+            if (nullptr != _capture)
+            {
+                _capture->begin(Inbound, dataPort.remoteIP(), dataPort.remotePort(), this->port + 1, rtpMidiClock.Now(), packetSize);
+                _captureInbound = &dataPort;
+            }
+#endif
+        }
+    }
+
+    // read straight into the free space of the buffer, in 2 parts when it wraps around
     while (packetSize > 0 && !dataBuffer.full())
     {
-        auto bytesToRead = min( min(packetSize, dataBuffer.free()), sizeof(packetBuffer));
-        auto bytesRead = dataPort.read(packetBuffer, bytesToRead);
+        byte *region;
+        auto bytesToRead = min(packetSize, dataBuffer.free_contiguous(region));
+        auto bytesRead = dataPort.read(region, bytesToRead);
+        if (bytesRead <= 0)
+            break;
         packetSize -= bytesRead;
 
-        dataBuffer.push_back(packetBuffer, bytesRead);
+        dataBuffer.commit_back(bytesRead);
+#ifdef USE_PCAP_CAPTURE
+        if (nullptr != _capture && _captureInbound == &dataPort)
+            _capture->append(region, bytesRead);
+#endif
+    }
+
+#ifdef USE_PCAP_CAPTURE
+    // the record stays open until the datagram is read completely
+    if (nullptr != _capture && _captureInbound == &dataPort && packetSize == 0)
+    {
+        _capture->end();
+        _captureInbound = nullptr;
     }
+#endif
 
     return dataBuffer.size();
 }
 
 // Parse buffered data packets using RTP-MIDI and AppleMIDI parsers.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::parseDataPackets()
+// dataFrames holds the datagram boundaries: a packet the parsers can not make
+// sense of is dropped as a whole, and so are the bytes a parser leaves behind.
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::parseDataPackets()
 {
-    while (dataBuffer.size() > 0)
+    while (dataBuffer.size() > 0 && !dataFrames.empty())
     {
-        auto retVal1 = _rtpMIDIParser.parse(dataBuffer);
-        if (retVal1 == parserReturn::Processed
-        ||  retVal1 == parserReturn::NotEnoughData)
-            break;
-        
-        auto retVal2 = _appleMIDIParser.parse(dataBuffer, amPortType::Data);
-        if (retVal2 == parserReturn::Processed
-        ||  retVal2 == parserReturn::NotEnoughData)
-            break;
+        const auto frameLen = dataFrames.front();
+        const auto sizeBefore = dataBuffer.size();
+
+        // The first byte of a datagram tells the protocol: AppleMIDI starts
+        // with its signature (0xFF 0xFF), RTP with version 2 (0x80 - 0xBF).
+        const byte first = dataBuffer.front();
+
+        Tracer::trace(TraceParseBegin, amPortType::Data, dataBuffer.size());
+        parserReturn retVal;
+        if (_rtpMIDIParser.inPacket() || RTP_VERSION(first) == RTP_VERSION_2)
+            retVal = _rtpMIDIParser.parse(dataBuffer);
+        else if (first == amSignature[0])
+            retVal = _appleMIDIParser.parse(dataBuffer, amPortType::Data, frameLen);
+        else
+            retVal = parserReturn::UnexpectedData;
+        Tracer::trace(TraceParseEnd, amPortType::Data, retVal);
+
+        const auto consumed = sizeBefore - dataBuffer.size();
+        const auto framesDone = consumeDataFrames(consumed);
 
-        //  // both don't have data to determine protocol
-        if (retVal1 == parserReturn::NotSureGiveMeMoreData
-        &&  retVal2 == parserReturn::NotSureGiveMeMoreData)
+        // a session name too long for the buffer is cut short, the rest is still in the socket
+        if (retVal == parserReturn::Processed || retVal == parserReturn::SessionNameVeryLong)
+        {
+            // left over at the end of the datagram (padding, journal not decoded, long name)
+            if (framesDone == 0)
+                dropDataFrame();
             break;
+        }
 
-        // one or the other don't have enough data to determine the protocol
-        if (retVal1 == parserReturn::NotSureGiveMeMoreData
-        ||  retVal2 == parserReturn::NotSureGiveMeMoreData)
-            break; // one or the other buffer does not have enough data
-        
+        if (retVal == parserReturn::UnexpectedData)
+        {
 #ifdef USE_EXT_CALLBACKS
-        if (nullptr != _exceptionCallback)
-            _exceptionCallback(ssrc, UnexpectedParseException, 0);
+            if (nullptr != _exceptionCallback)
+                _exceptionCallback(ssrc, UnexpectedParseException, 0);
 #endif
-         dataBuffer.pop_front();
+            _rtpMIDIParser.reset();
+            // the datagram in which the parser gave up, unless it ran out exactly at its end
+            if (framesDone == 0 || consumed > frameLen)
+                dropDataFrame();
+            continue;
+        }
+
+        // Not (sure) enough data: wait for the rest of the datagram. But when it is all
+        // in the buffer already, or the parser went past its end, the packet is malformed.
+        // So is it when the buffer is full: the parser wants more than it can ever hold,
+        // and waiting would stop the reading from the socket for good.
+        if (framesDone > 0 || dataFrames.front() <= dataBuffer.size() || dataBuffer.full())
+        {
+#ifdef USE_EXT_CALLBACKS
+            if (nullptr != _exceptionCallback)
+                _exceptionCallback(ssrc, UnexpectedParseException, 1);
+#endif
+            _rtpMIDIParser.reset();
+            if (framesDone == 0 || consumed > frameLen)
+                dropDataFrame();
+            continue;
+        }
+        break;
+    }
+}
+
+// Count the bytes taken by the parsers against the datagrams they came from,
+// returns the number of datagrams that are done.
+template <class Settings, class Platform, class Tracer>
+size_t AppleMIDICore<Settings, Platform, Tracer>::consumeDataFrames(size_t consumed)
+{
+    size_t done = 0;
+    while (!dataFrames.empty() && consumed >= dataFrames.front())
+    {
+        consumed -= dataFrames.front();
+        dataFrames.pop_front();
+        done++;
     }
+    if (!dataFrames.empty())
+        dataFrames.front() -= consumed;
+    return done;
+}
+
+// Drop the rest of the first datagram, also the part that is still in the socket.
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::dropDataFrame()
+{
+    if (dataFrames.empty())
+        return;
+
+    size_t len = dataFrames.front();
+    dataFrames.pop_front();
+
+    auto buffered = min(len, dataBuffer.size());
+    dataBuffer.pop_front(buffered);
+
+    // only the last datagram can be incomplete
+    for (len -= buffered; len > 0 && dataPort.read() >= 0; len--) {}
 }
 
 // Route an invitation based on the incoming port type.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedInvitation(AppleMIDI_Invitation_t &invitation, const amPortType &portType)
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::ReceivedInvitation(AppleMIDI_Invitation_t &invitation, const amPortType &portType)
 {
    if (portType == amPortType::Control)
         ReceivedControlInvitation(invitation);
@@ -119,8 +256,8 @@ void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedInvitation(AppleMID
 }
 
 // Handle an incoming control invitation from a remote participant.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedControlInvitation(AppleMIDI_Invitation_t &invitation)
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::ReceivedControlInvitation(AppleMIDI_Invitation_t &invitation)
 {
     // ignore invitation of a participant already in the participant list
 #ifndef ONE_PARTICIPANT
@@ -136,7 +273,7 @@ void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedControlInvitation(A
     if (participant.ssrc != 0)
 #endif
     {
-        writeInvitation(controlPort, controlPort.remoteIP(), controlPort.remotePort(), invitation, amInvitationRejected);     
+        writeInvitation(controlPort, controlPort.remoteIP(), controlPort.remotePort(), invitation, amInvitationRejectedHeader);     
 #ifdef USE_EXT_CALLBACKS
         if (nullptr != _exceptionCallback)
             _exceptionCallback(ssrc, TooManyParticipantsException, 0);
@@ -150,6 +287,7 @@ void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedControlInvitation(A
     participant.kind = Listener;
     participant.ssrc = invitation.ssrc;
     participant.sendSequenceNr = random(1, UINT16_MAX); // http://www.rfc-editor.org/rfc/rfc6295.txt , 2.1.  RTP Header
+    participant.receivedSequenceNrs = 0;
     participant.remoteIP   = controlPort.remoteIP();
     participant.remotePort = controlPort.remotePort();
     participant.lastSyncExchangeTime = now;
@@ -167,7 +305,7 @@ void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedControlInvitation(A
 #ifdef USE_DIRECTORY
     switch (whoCanConnectToMe) {
     case None:
-        writeInvitation(controlPort, controlPort.remoteIP(), controlPort.remotePort(), invitation, amInvitationRejected);
+        writeInvitation(controlPort, controlPort.remoteIP(), controlPort.remotePort(), invitation, amInvitationRejectedHeader);
 #ifdef USE_EXT_CALLBACKS
         if (nullptr != _exceptionCallback)
             _exceptionCallback(ssrc, NotAcceptingAnyone, 0);
@@ -175,7 +313,7 @@ void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedControlInvitation(A
         return;
     case OnlyComputersInMyDirectory:
         if (!IsComputerInDirectory(controlPort.remoteIP())) {
-            writeInvitation(controlPort, controlPort.remoteIP(), controlPort.remotePort(), invitation, amInvitationRejected);
+            writeInvitation(controlPort, controlPort.remoteIP(), controlPort.remotePort(), invitation, amInvitationRejectedHeader);
 #ifdef USE_EXT_CALLBACKS
             if (nullptr != _exceptionCallback)
                 _exceptionCallback(ssrc, ComputerNotInDirectory, 0);
@@ -191,12 +329,12 @@ void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedControlInvitation(A
     participants.push_back(participant);
 #endif
 
-    writeInvitation(controlPort, participant.remoteIP, participant.remotePort, invitation, amInvitationAccepted);
+    writeInvitation(controlPort, participant.remoteIP, participant.remotePort, invitation, amInvitationAcceptedHeader);
 }
 
 // Handle an incoming data invitation for an existing participant.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedDataInvitation(AppleMIDI_Invitation &invitation)
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::ReceivedDataInvitation(AppleMIDI_Invitation &invitation)
 {
 #ifndef ONE_PARTICIPANT
     auto pParticipant = getParticipantBySSRC(invitation.ssrc);
@@ -205,7 +343,7 @@ void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedDataInvitation(Appl
 #endif
     if (nullptr == pParticipant)
     {
-        writeInvitation(dataPort, dataPort.remoteIP(), dataPort.remotePort(), invitation, amInvitationRejected);
+        writeInvitation(dataPort, dataPort.remoteIP(), dataPort.remotePort(), invitation, amInvitationRejectedHeader);
 
 #ifdef USE_EXT_CALLBACKS
         if (nullptr != _exceptionCallback)
@@ -225,7 +363,7 @@ void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedDataInvitation(Appl
     // of the ssrc here.
     auto ssrc_ = invitation.ssrc;
     
-    writeInvitation(dataPort, pParticipant->remoteIP, pParticipant->remotePort + 1, invitation, amInvitationAccepted);
+    writeInvitation(dataPort, pParticipant->remoteIP, pParticipant->remotePort + 1, invitation, amInvitationAcceptedHeader);
 
     pParticipant->kind = Listener;
     
@@ -240,16 +378,35 @@ void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedDataInvitation(Appl
     }
 }
 
-// Placeholder for bitrate receive limit messages (not used).
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedBitrateReceiveLimit(AppleMIDI_BitrateReceiveLimit &)
+// The participant tells the maximum bitrate it wants to receive (USE_PACING).
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::ReceivedBitrateReceiveLimit(AppleMIDI_BitrateReceiveLimit &bitrateReceiveLimit)
 {
+#ifdef USE_PACING
+#ifndef ONE_PARTICIPANT
+    auto pParticipant = getParticipantBySSRC(bitrateReceiveLimit.ssrc);
+#else
+    auto pParticipant = (participant.ssrc == bitrateReceiveLimit.ssrc) ? &participant : nullptr;
+#endif
+    if (nullptr == pParticipant)
+    {
+#ifdef USE_EXT_CALLBACKS
+        if (nullptr != _exceptionCallback)
+            _exceptionCallback(ssrc, ParticipantNotFoundException, bitrateReceiveLimit.ssrc);
+#endif
+        return;
+    }
+
+    pParticipant->bitrateReceiveLimit = bitrateReceiveLimit.bitratelimit;
+#else
+    (void)bitrateReceiveLimit;
+#endif
 }
 
 #ifdef APPLEMIDI_INITIATOR
 // Route accepted invitations based on the incoming port type.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedInvitationAccepted(AppleMIDI_InvitationAccepted_t &invitationAccepted, const amPortType &portType)
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::ReceivedInvitationAccepted(AppleMIDI_InvitationAccepted_t &invitationAccepted, const amPortType &portType)
 {
     if (portType == amPortType::Control)
         ReceivedControlInvitationAccepted(invitationAccepted);
@@ -258,8 +415,8 @@ void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedInvitationAccepted(
 }
 
 // Update participant state after control invitation acceptance.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedControlInvitationAccepted(AppleMIDI_InvitationAccepted_t &invitationAccepted)
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::ReceivedControlInvitationAccepted(AppleMIDI_InvitationAccepted_t &invitationAccepted)
 {
 #ifndef ONE_PARTICIPANT
     auto pParticipant = this->getParticipantByInitiatorToken(invitationAccepted.initiatorToken);
@@ -282,8 +439,8 @@ void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedControlInvitationAc
 }
 
 // Update participant state after data invitation acceptance.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedDataInvitationAccepted(AppleMIDI_InvitationAccepted_t &invitationAccepted)
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::ReceivedDataInvitationAccepted(AppleMIDI_InvitationAccepted_t &invitationAccepted)
 {
 #ifndef ONE_PARTICIPANT
     auto pParticipant = this->getParticipantByInitiatorToken(invitationAccepted.initiatorToken);
@@ -299,8 +456,8 @@ void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedDataInvitationAccep
 }
 
 // Remove participant on invitation rejection.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedInvitationRejected(AppleMIDI_InvitationRejected_t & invitationRejected)
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::ReceivedInvitationRejected(AppleMIDI_InvitationRejected_t & invitationRejected)
 {
     for (auto i = 0; i < participants.size(); i++)
     {
@@ -345,8 +502,8 @@ state in order to re-establish communication automatically as soon as the distan
 network. Some implementations (especially on personal computers) display also an alert message and offer to the
 user to choose between a new connection attempt or closing the session.
 */
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedSynchronization(AppleMIDI_Synchronization_t &synchronization)
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::ReceivedSynchronization(AppleMIDI_Synchronization_t &synchronization)
 {
 #ifndef ONE_PARTICIPANT
     auto pParticipant = getParticipantBySSRC(synchronization.ssrc);
@@ -407,13 +564,20 @@ void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedSynchronization(App
         synchronization.count = SYNC_CK2;
         writeSynchronization(pParticipant->remoteIP, pParticipant->remotePort + 1, synchronization);
         pParticipant->synchronizing = false;
+#ifdef KEEP_CLOCK_OFFSET
+        // timestamps 1 and 3 are ours, 2 is the listener's
+        pParticipant->offsetEstimate = (uint32_t)(synchronization.timestamps[1] - ((synchronization.timestamps[2] + synchronization.timestamps[0]) / 2));
+        pParticipant->offsetValid = true;
+#endif
 #endif
         break;
     case SYNC_CK2: /* From session APPLEMIDI_INITIATOR */
             
-#ifdef USE_EXT_CALLBACKS
+#ifdef KEEP_CLOCK_OFFSET
         // each party can estimate the offset between the two clocks using the following formula
+        // (timestamps 1 and 3 are the initiator's, 2 is ours)
         pParticipant->offsetEstimate = (uint32_t)(((synchronization.timestamps[2] + synchronization.timestamps[0]) / 2) - synchronization.timestamps[1]);
+        pParticipant->offsetValid = true;
 #endif
         break;
     }
@@ -430,8 +594,8 @@ void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedSynchronization(App
 // the specified packet number.
 //
 // Process receiver feedback about last received sequence numbers.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedReceiverFeedback(AppleMIDI_ReceiverFeedback_t &receiverFeedback)
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::ReceivedReceiverFeedback(AppleMIDI_ReceiverFeedback_t &receiverFeedback)
 {
     // We do not keep any recovery journals, no command history, nothing! 
     // Here is where you would correct if packets are dropped (send them again)
@@ -458,8 +622,8 @@ void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedReceiverFeedback(Ap
 }
 
 // Handle end-session requests and notify callbacks.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedEndSession(AppleMIDI_EndSession_t &endSession)
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::ReceivedEndSession(AppleMIDI_EndSession_t &endSession)
 {
 #ifndef ONE_PARTICIPANT
     for (size_t i = 0; i < participants.size(); i++)
@@ -487,8 +651,8 @@ void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedEndSession(AppleMID
 
 #ifdef USE_DIRECTORY
 // Check whether a remote IP is in the allowed directory list.
-template <class UdpClass, class Settings, class Platform>
-bool AppleMIDISession<UdpClass, Settings, Platform>::IsComputerInDirectory(IPAddress remoteIP) const
+template <class Settings, class Platform, class Tracer>
+bool AppleMIDICore<Settings, Platform, Tracer>::IsComputerInDirectory(IPAddress remoteIP) const
 {
     for (size_t i = 0; i < directory.size(); i++)
         if (remoteIP == directory[i])
@@ -499,8 +663,8 @@ bool AppleMIDISession<UdpClass, Settings, Platform>::IsComputerInDirectory(IPAdd
 
 #ifndef ONE_PARTICIPANT
 // Find a participant by SSRC.
-template <class UdpClass, class Settings, class Platform>
-Participant<Settings>* AppleMIDISession<UdpClass, Settings, Platform>::getParticipantBySSRC(const ssrc_t& ssrc)
+template <class Settings, class Platform, class Tracer>
+Participant<Settings>* AppleMIDICore<Settings, Platform, Tracer>::getParticipantBySSRC(const ssrc_t& ssrc)
 {
     for (size_t i = 0; i < participants.size(); i++)
         if (ssrc == participants[i].ssrc)
@@ -509,8 +673,8 @@ Participant<Settings>* AppleMIDISession<UdpClass, Settings, Platform>::getPartic
 }
 
 // Find a participant by initiator token.
-template <class UdpClass, class Settings, class Platform>
-Participant<Settings>* AppleMIDISession<UdpClass, Settings, Platform>::getParticipantByInitiatorToken(const uint32_t& initiatorToken)
+template <class Settings, class Platform, class Tracer>
+Participant<Settings>* AppleMIDICore<Settings, Platform, Tracer>::getParticipantByInitiatorToken(const uint32_t& initiatorToken)
 {
     for (auto i = 0; i < participants.size(); i++)
         if (initiatorToken == participants[i].initiatorToken)
@@ -519,11 +683,83 @@ Participant<Settings>* AppleMIDISession<UdpClass, Settings, Platform>::getPartic
 }
 #endif
 
-// Serialize and send an invitation packet on the given port.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::writeInvitation(UdpClass &port, const IPAddress& remoteIP, const uint16_t& remotePort, AppleMIDI_Invitation_t & invitation, const byte *command)
+#ifdef USE_LATENCY_HISTOGRAM
+// Latency histogram of a participant (nullptr if not found).
+template <class Settings, class Platform, class Tracer>
+const Histogram* AppleMIDICore<Settings, Platform, Tracer>::getLatencyHistogram(const ssrc_t& ssrc)
+{
+#ifndef ONE_PARTICIPANT
+    auto pParticipant = getParticipantBySSRC(ssrc);
+#else
+    auto pParticipant = (participant.ssrc == ssrc) ? &participant : nullptr;
+#endif
+    return (nullptr != pParticipant) ? &pParticipant->latencyHistogram : nullptr;
+}
+
+// Inter-arrival jitter histogram of a participant (nullptr if not found).
+template <class Settings, class Platform, class Tracer>
+const Histogram* AppleMIDICore<Settings, Platform, Tracer>::getJitterHistogram(const ssrc_t& ssrc)
+{
+#ifndef ONE_PARTICIPANT
+    auto pParticipant = getParticipantBySSRC(ssrc);
+#else
+    auto pParticipant = (participant.ssrc == ssrc) ? &participant : nullptr;
+#endif
+    return (nullptr != pParticipant) ? &pParticipant->jitterHistogram : nullptr;
+}
+
+// Smoothed RFC 3550 jitter estimate of a participant (0 if not found).
+template <class Settings, class Platform, class Tracer>
+uint32_t AppleMIDICore<Settings, Platform, Tracer>::getJitter(const ssrc_t& ssrc)
 {
-    if (!port.beginPacket(remoteIP, remotePort))
+#ifndef ONE_PARTICIPANT
+    auto pParticipant = getParticipantBySSRC(ssrc);
+#else
+    auto pParticipant = (participant.ssrc == ssrc) ? &participant : nullptr;
+#endif
+    return (nullptr != pParticipant) ? (pParticipant->jitter >> 4) : 0;
+}
+#endif
+
+// Send a datagram made up of segments, and its capture record. The payload
+// goes from where it is to the socket, without a staging copy (see UdpAdapter).
+template <class Settings, class Platform, class Tracer>
+bool AppleMIDICore<Settings, Platform, Tracer>::sendPacket(UdpTransport &port, const IPAddress& remoteIP, const uint16_t& remotePort, const UdpSegment *segments, uint8_t count)
+{
+    if (!port.sendPacket(remoteIP, remotePort, segments, count))
+        return false;
+
+#ifdef USE_PCAP_CAPTURE
+    if (nullptr != _capture)
+    {
+        // closes an inbound record still waiting for the rest of its datagram
+        _captureInbound = nullptr;
+        _capture->begin(Outbound, remoteIP, remotePort, (&port == &controlPort) ? this->port : this->port + 1, rtpMidiClock.Now());
+        for (uint8_t i = 0; i < count; i++)
+            _capture->append(segments[i].data, segments[i].size);
+        _capture->end();
+    }
+#endif
+    return true;
+}
+
+// Serialize and send an invitation packet on the given port. header is one of the
+// prebuilt IN, OK or NO headers (signature, command and protocol version).
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::writeInvitation(UdpTransport &port, const IPAddress& remoteIP, const uint16_t& remotePort, AppleMIDI_Invitation_t & invitation, const byte *header)
+{
+    uint8_t packet[sizeof(amInvitationHeader) + sizeof(initiatorToken_t) + sizeof(ssrc_t)];
+    memcpy(packet, header, sizeof(amInvitationHeader));
+    store_be32(packet + 8, invitation.initiatorToken);
+    memcpy(packet + 12, _rtpHeader + RTP_SSRC_OFFSET, sizeof(ssrc_t));
+    const UdpSegment segments[] = {
+        { packet, sizeof(packet) },
+#ifdef KEEP_SESSION_NAME
+        // the name, including its terminating zero
+        { reinterpret_cast<const uint8_t *>(invitation.sessionName), invitation.getLength() - sizeof(initiatorToken_t) - sizeof(ssrc_t) },
+#endif
+    };
+    if (!sendPacket(port, remoteIP, remotePort, segments, sizeof(segments) / sizeof(segments[0])))
     {
 #ifdef USE_EXT_CALLBACKS
         if (nullptr != _exceptionCallback)
@@ -532,24 +768,21 @@ void AppleMIDISession<UdpClass, Settings, Platform>::writeInvitation(UdpClass &p
         return;
     }
 
-    port.write((uint8_t *)amSignature, sizeof(amSignature));
-    
-        port.write((uint8_t *)command, sizeof(amInvitation));
-        port.write((uint8_t *)amProtocolVersion, sizeof(amProtocolVersion));
-        invitation.initiatorToken = __htonl(invitation.initiatorToken);
-        invitation.ssrc = ssrc;
-        invitation.ssrc = __htonl(invitation.ssrc);
-        port.write(reinterpret_cast<uint8_t *>(&invitation), invitation.getLength());
-    
-    port.endPacket();
-    port.flush();
+    Tracer::trace(TracePacketSent, (&port == &controlPort) ? amPortType::Control : amPortType::Data,
+                  sizeof(amInvitationHeader) + invitation.getLength());
 }
 
 // Send receiver feedback on the control port.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::writeReceiverFeedback(const IPAddress& remoteIP, const uint16_t & remotePort, AppleMIDI_ReceiverFeedback_t & receiverFeedback)
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::writeReceiverFeedback(const IPAddress& remoteIP, const uint16_t & remotePort, AppleMIDI_ReceiverFeedback_t & receiverFeedback)
 {
-    if (!controlPort.beginPacket(remoteIP, remotePort))
+    uint8_t packet[sizeof(amReceiverFeedbackHeader) + sizeof(AppleMIDI_ReceiverFeedback)];
+    memcpy(packet, amReceiverFeedbackHeader, sizeof(amReceiverFeedbackHeader));
+    memcpy(packet + 4, _rtpHeader + RTP_SSRC_OFFSET, sizeof(ssrc_t));
+    store_be16(packet + 8, receiverFeedback.sequenceNr);
+    store_be16(packet + 10, receiverFeedback.dummy);
+    const UdpSegment segment = { packet, sizeof(packet) };
+    if (!sendPacket(controlPort, remoteIP, remotePort, &segment, 1))
     {
 #ifdef USE_EXT_CALLBACKS
         if (nullptr != _exceptionCallback)
@@ -558,24 +791,23 @@ void AppleMIDISession<UdpClass, Settings, Platform>::writeReceiverFeedback(const
         return;
     }
 
-    controlPort.write((uint8_t *)amSignature, sizeof(amSignature));
-    
-        controlPort.write((uint8_t *)amReceiverFeedback, sizeof(amReceiverFeedback));
-    
-        receiverFeedback.ssrc       = __htonl(receiverFeedback.ssrc);
-        receiverFeedback.sequenceNr = __htons(receiverFeedback.sequenceNr);
-    
-        controlPort.write(reinterpret_cast<uint8_t *>(&receiverFeedback), sizeof(AppleMIDI_ReceiverFeedback));
-    
-    controlPort.endPacket();
-    controlPort.flush();
+    Tracer::trace(TracePacketSent, amPortType::Control, sizeof(packet));
 }
 
 // Send a synchronization packet on the data port.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::writeSynchronization(const IPAddress& remoteIP, const uint16_t & remotePort, AppleMIDI_Synchronization_t &synchronization)
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::writeSynchronization(const IPAddress& remoteIP, const uint16_t & remotePort, AppleMIDI_Synchronization_t &synchronization)
 {
-    if (!dataPort.beginPacket(remoteIP, remotePort))
+    uint8_t packet[sizeof(amSynchronizationHeader) + sizeof(AppleMIDI_Synchronization)];
+    memcpy(packet, amSynchronizationHeader, sizeof(amSynchronizationHeader));
+    memcpy(packet + 4, _rtpHeader + RTP_SSRC_OFFSET, sizeof(ssrc_t));
+    packet[8] = synchronization.count;
+    packet[9] = packet[10] = packet[11] = 0; // padding
+    store_be64(packet + 12, synchronization.timestamps[0]);
+    store_be64(packet + 20, synchronization.timestamps[1]);
+    store_be64(packet + 28, synchronization.timestamps[2]);
+    const UdpSegment segment = { packet, sizeof(packet) };
+    if (!sendPacket(dataPort, remoteIP, remotePort, &segment, 1))
     {
 #ifdef USE_EXT_CALLBACKS
         if (nullptr != _exceptionCallback)
@@ -584,25 +816,19 @@ void AppleMIDISession<UdpClass, Settings, Platform>::writeSynchronization(const
         return;
     }
 
-    dataPort.write((uint8_t *)amSignature, sizeof(amSignature));
-    dataPort.write((uint8_t *)amSynchronization, sizeof(amSynchronization));
-    synchronization.ssrc = ssrc;
-    synchronization.ssrc = __htonl(synchronization.ssrc);
-
-    synchronization.timestamps[0] = __htonll(synchronization.timestamps[0]);
-    synchronization.timestamps[1] = __htonll(synchronization.timestamps[1]);
-    synchronization.timestamps[2] = __htonll(synchronization.timestamps[2]);
-    dataPort.write(reinterpret_cast<uint8_t *>(&synchronization), sizeof(synchronization));
-    
-    dataPort.endPacket();
-    dataPort.flush();
+    Tracer::trace(TracePacketSent, amPortType::Data, sizeof(packet));
 }
 
 // Send an end-session packet on the control port.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::writeEndSession(const IPAddress& remoteIP, const uint16_t & remotePort, AppleMIDI_EndSession_t &endSession)
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::writeEndSession(const IPAddress& remoteIP, const uint16_t & remotePort, AppleMIDI_EndSession_t &endSession)
 {
-    if (!controlPort.beginPacket(remoteIP, remotePort))
+    uint8_t packet[sizeof(amEndSessionHeader) + sizeof(AppleMIDI_EndSession)];
+    memcpy(packet, amEndSessionHeader, sizeof(amEndSessionHeader));
+    store_be32(packet + 8, endSession.initiatorToken);
+    memcpy(packet + 12, _rtpHeader + RTP_SSRC_OFFSET, sizeof(ssrc_t));
+    const UdpSegment segment = { packet, sizeof(packet) };
+    if (!sendPacket(controlPort, remoteIP, remotePort, &segment, 1))
     {
 #ifdef USE_EXT_CALLBACKS
         if (nullptr != _exceptionCallback)
@@ -611,23 +837,52 @@ void AppleMIDISession<UdpClass, Settings, Platform>::writeEndSession(const IPAdd
         return;
     }
 
-    controlPort.write((uint8_t *)amSignature, sizeof(amSignature));
-    controlPort.write((uint8_t *)amEndSession, sizeof(amEndSession));
-    controlPort.write((uint8_t *)amProtocolVersion, sizeof(amProtocolVersion));
+    Tracer::trace(TracePacketSent, amPortType::Control, sizeof(packet));
+}
 
-    endSession.initiatorToken = __htonl(endSession.initiatorToken);
-    endSession.ssrc           = __htonl(endSession.ssrc);
+// Flush the outgoing MIDI buffer when Settings::OutgoingFlush says so. Called
+// at the start of every loop (available) and after every message (endTransmission).
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::manageOutMidiBuffer(bool startOfLoop)
+{
+    if (outMidiBuffer.empty())
+        return;
 
-    controlPort.write(reinterpret_cast<uint8_t *>(&endSession), sizeof(endSession));
-    
-    controlPort.endPacket();
-    controlPort.flush();
+    bool due;
+    switch (Settings::OutgoingFlush)
+    {
+    case FlushEveryMessage:
+        due = true;
+        break;
+    case FlushAtThreshold:
+        due = (outMidiBuffer.size() >= Settings::FlushThreshold || millis() - _outMidiBufferTime >= Settings::FlushWindow);
+        break;
+    case FlushAfterWindow:
+        due = (millis() - _outMidiBufferTime >= Settings::FlushWindow);
+        break;
+    case FlushEveryLoop:
+    default:
+        due = startOfLoop;
+        break;
+    }
+
+#ifdef USE_PACING
+    // unless a participant is out of tokens, then the messages stay queued up
+    // (and coalesce) until its bucket refills
+    if (due && !pacingAllowsSend())
+        due = false;
+#endif
+
+    if (due)
+        writeRtpMidiToAllParticipants();
 }
 
 // Flush the outgoing MIDI buffer to all participants.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::writeRtpMidiToAllParticipants()
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::writeRtpMidiToAllParticipants()
 {
+    Tracer::trace(TraceFlush, amPortType::Data, outMidiBuffer.size());
+
 #ifndef ONE_PARTICIPANT
     for (size_t i = 0; i < participants.size(); i++)
     {
@@ -641,43 +896,36 @@ void AppleMIDISession<UdpClass, Settings, Platform>::writeRtpMidiToAllParticipan
     outMidiBuffer.clear();
 }
 
-// Build and send an RTP-MIDI packet for a participant.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::writeRtpMidiBuffer(Participant<Settings>* participant)
-{ 
-    const auto bufferLen = outMidiBuffer.size();
-
-    Rtp rtp;
-
-    // First octet
-    rtp.vpxcc = ((RTP_VERSION_2) << 6); // RTP version 2
-    rtp.vpxcc &= ~RTP_P_FIELD; // no padding
-    rtp.vpxcc &= ~RTP_X_FIELD; // no extension
-    // No CSRC
+// Prepare the invariant part of the RTP header, once our SSRC is known.
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::buildRtpHeader()
+{
+    // First octet: version 2, no padding, no extension, no CSRC
+    _rtpHeader[0] = (RTP_VERSION_2 << 6);
 
     // second octet
-    rtp.mpayload = PAYLOADTYPE_RTPMIDI; 
-
-/*
-    // The behavior of the 1-bit M field depends on the media type of the
-    // stream.  For native streams, the M bit MUST be set to 1 if the MIDI
-    // command section has a non-zero LEN field and MUST be set to 0
-    // otherwise.  For mpeg4-generic streams, the M bit MUST be set to 1 for
-    // all packets (to conform to [RFC3640]).
-    if (bufferLen != 0)
-        rtp.mpayload |= RTP_M_FIELD;
-    else
-        rtp.mpayload &= ~RTP_M_FIELD;
-*/
+    //
     // Both https://developer.apple.com/library/archive/documentation/Audio/Conceptual/MIDINetworkDriverProtocol/MIDI/MIDI.html
     // and https://tools.ietf.org/html/rfc6295#section-2.1 indicate that the M field needs to be set
     // if the len in the MIDI section is NON-ZERO.
     // However, doing so on, MacOS does not take the given MIDI commands
-    // Clear the M field
-    rtp.mpayload &= ~RTP_M_FIELD;
+    // The M field stays cleared
+    _rtpHeader[1] = PAYLOADTYPE_RTPMIDI & ~RTP_M_FIELD;
+
+    // sequence number and timestamp are filled in per packet
+    store_be16(_rtpHeader + RTP_SEQUENCE_NR_OFFSET, 0);
+    store_be32(_rtpHeader + RTP_TIMESTAMP_OFFSET, 0);
+
+    store_be32(_rtpHeader + RTP_SSRC_OFFSET, ssrc);
+}
+
+// Fill in the RTP header of the next packet to a participant (network byte order):
+// the prepared header, with the sequence number and timestamp patched in.
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::writeRtpHeader(uint8_t *header, Participant<Settings>* participant)
+{
+    memcpy(header, _rtpHeader, sizeof(_rtpHeader));
 
-    rtp.ssrc = ssrc;
-    
     // https://developer.apple.com/library/ios/documentation/CoreMidi/Reference/MIDIServices_Reference/#//apple_ref/doc/uid/TP40010316-CHMIDIServiceshFunctions-SW30
     // The time at which the events occurred, if receiving MIDI, or, if sending MIDI,
     // the time at which the events are to be played. Zero means "now." The time stamp
@@ -692,36 +940,39 @@ void AppleMIDISession<UdpClass, Settings, Platform>::writeRtpMidiBuffer(Particip
     // have an option to not transmit messages with future timestamps, to accommodate hardware not
     // prepared to defer rendering the messages until the proper time.)
     //
-    rtp.timestamp = (Settings::TimestampRtpPackets) ? rtpMidiClock.Now() : 0;
+    const uint32_t timestamp = (Settings::TimestampRtpPackets) ? rtpMidiClock.Now() : 0;
  
     // increment the sequenceNr
     participant->sendSequenceNr++;
 
-    rtp.sequenceNr = participant->sendSequenceNr;
+    store_be16(header + RTP_SEQUENCE_NR_OFFSET, participant->sendSequenceNr);
+    store_be32(header + RTP_TIMESTAMP_OFFSET, timestamp);
 
 #ifdef USE_EXT_CALLBACKS
     if (_sentRtpCallback)
+    {
+        Rtp rtp;
+        rtp.vpxcc      = header[0];
+        rtp.mpayload   = header[1];
+        rtp.sequenceNr = participant->sendSequenceNr;
+        rtp.timestamp  = timestamp;
+        rtp.ssrc       = ssrc;
         _sentRtpCallback(rtp);
+    }
 #endif
+}
 
-    rtp.timestamp  = __htonl(rtp.timestamp);
-    rtp.ssrc       = __htonl(rtp.ssrc);
-    rtp.sequenceNr = __htons(rtp.sequenceNr);
+// Build and send an RTP-MIDI packet for a participant.
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::writeRtpMidiBuffer(Participant<Settings>* participant)
+{ 
+    const auto bufferLen = outMidiBuffer.size();
 
-    if (!dataPort.beginPacket(participant->remoteIP, participant->remotePort + 1))
-    {
-#ifdef USE_EXT_CALLBACKS
-        if (nullptr != _exceptionCallback)
-            _exceptionCallback(ssrc, UdpBeginPacketFailed, 5);
-#endif
-        return;
-    }
+    // The RTP and rtpMIDI headers
+    uint8_t packet[sizeof(Rtp) + 2];
+    writeRtpHeader(packet, participant);
 
-    // Write RTP + rtpMIDI in a single packet to reduce overhead.
-    uint8_t packet[sizeof(Rtp) + 2 + Settings::MaxBufferSize];
-    size_t offset = 0;
-    memcpy(packet + offset, &rtp, sizeof(rtp));
-    offset += sizeof(rtp);
+    size_t offset = sizeof(Rtp);
 
     RtpMIDI_t rtpMidi;
 
@@ -750,14 +1001,258 @@ void AppleMIDISession<UdpClass, Settings, Platform>::writeRtpMidiBuffer(Particip
         packet[offset++] = (uint8_t)(bufferLen);
     }
 
-    // write out the MIDI Section
-    offset += outMidiBuffer.copy_out(packet + offset, bufferLen);
+    // the headers, then the MIDI Section straight from outMidiBuffer, in at most
+    // 2 parts when the ring wraps around
+    UdpSegment segments[3];
+    uint8_t count = 0;
+    segments[count++] = { packet, offset };
+    for (size_t written = 0; written < bufferLen; count++)
+    {
+        segments[count].size = outMidiBuffer.contiguous(written, segments[count].data);
+        written += segments[count].size;
+    }
+    offset += bufferLen;
 
     // *No* journal section (Not supported)
-    dataPort.write(packet, offset);
 
-    dataPort.endPacket();
-    dataPort.flush();
+    if (!sendPacket(dataPort, participant->remoteIP, participant->remotePort + 1, segments, count))
+    {
+#ifdef USE_EXT_CALLBACKS
+        if (nullptr != _exceptionCallback)
+            _exceptionCallback(ssrc, UdpBeginPacketFailed, 5);
+#endif
+        return;
+    }
+
+#ifdef USE_PACING
+    spendTokens(participant, offset);
+#endif
+
+    Tracer::trace(TracePacketSent, amPortType::Data, offset);
+
+#ifdef USE_EXT_CALLBACKS
+    if (_sentRtpMidiCallback)
+        _sentRtpMidiCallback(rtpMidi);
+#endif
+}
+
+// There is somebody to send MIDI to
+template <class Settings, class Platform, class Tracer>
+bool AppleMIDICore<Settings, Platform, Tracer>::canTransmit()
+{
+#ifndef ONE_PARTICIPANT
+    return (dataPort.remoteIP() != (IPAddress)INADDR_NONE && participants.size() > 0);
+#else
+    return (dataPort.remoteIP() != (IPAddress)INADDR_NONE && participant.ssrc != 0);
+#endif
+}
+
+// Queue up a complete MIDI message, with a single check for room in outMidiBuffer
+template <class Settings, class Platform, class Tracer>
+bool AppleMIDICore<Settings, Platform, Tracer>::queueMidi(const byte *message, uint8_t length)
+{
+    if (!canTransmit())
+        return false;
+
+    if (!makeRoom((size_t)length + 1))
+        return false;
+
+    if (outMidiBuffer.empty())
+    {
+        if (Settings::OutgoingFlush == FlushAfterWindow || Settings::OutgoingFlush == FlushAtThreshold)
+            _outMidiBufferTime = millis();
+    }
+    else
+        outMidiBuffer.push_back(0x00); // zero timestamp
+    outMidiBuffer.push_back(message, length);
+
+    if (Settings::OutgoingFlush != FlushEveryLoop)
+        manageOutMidiBuffer(false);
+    return true;
+}
+
+// Make room for size more bytes in outMidiBuffer, by sending what is queued up.
+// With USE_PACING not while a participant is out of tokens: then the queue
+// is kept, and what does not fit is dropped.
+template <class Settings, class Platform, class Tracer>
+bool AppleMIDICore<Settings, Platform, Tracer>::makeRoom(size_t size)
+{
+    if (outMidiBuffer.free() >= size)
+        return true;
+
+#ifdef USE_PACING
+    if (!pacingAllowsSend())
+    {
+#ifdef USE_EXT_CALLBACKS
+        if (nullptr != _exceptionCallback)
+            _exceptionCallback(ssrc, BufferFullException, 1);
+#endif
+        return false;
+    }
+#endif
+
+    writeRtpMidiToAllParticipants();
+    return true;
+}
+
+template <class Settings, class Platform, class Tracer>
+bool AppleMIDICore<Settings, Platform, Tracer>::sendNoteOn(byte note, byte velocity, byte channel)
+{
+    const byte message[] = { (byte)(MIDI_NAMESPACE::MidiType::NoteOn | ((channel - 1) & 0x0F)), (byte)(note & 0x7F), (byte)(velocity & 0x7F) };
+    return queueMidi(message, sizeof(message));
+}
+
+template <class Settings, class Platform, class Tracer>
+bool AppleMIDICore<Settings, Platform, Tracer>::sendNoteOff(byte note, byte velocity, byte channel)
+{
+    const byte message[] = { (byte)(MIDI_NAMESPACE::MidiType::NoteOff | ((channel - 1) & 0x0F)), (byte)(note & 0x7F), (byte)(velocity & 0x7F) };
+    return queueMidi(message, sizeof(message));
+}
+
+template <class Settings, class Platform, class Tracer>
+bool AppleMIDICore<Settings, Platform, Tracer>::sendControlChange(byte number, byte value, byte channel)
+{
+    const byte message[] = { (byte)(MIDI_NAMESPACE::MidiType::ControlChange | ((channel - 1) & 0x0F)), (byte)(number & 0x7F), (byte)(value & 0x7F) };
+    return queueMidi(message, sizeof(message));
+}
+
+template <class Settings, class Platform, class Tracer>
+bool AppleMIDICore<Settings, Platform, Tracer>::sendProgramChange(byte number, byte channel)
+{
+    const byte message[] = { (byte)(MIDI_NAMESPACE::MidiType::ProgramChange | ((channel - 1) & 0x0F)), (byte)(number & 0x7F) };
+    return queueMidi(message, sizeof(message));
+}
+
+// The length of each message comes from its status byte (rtpMidiOctetTable).
+// Real-time messages follow Settings::RealTimeMessages.
+template <class Settings, class Platform, class Tracer>
+size_t AppleMIDICore<Settings, Platform, Tracer>::sendBatch(const MidiEvent *events, size_t count)
+{
+    size_t queued = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const byte message[] = { events[i].status, events[i].data1, events[i].data2 };
+        const auto info = rtpMidiOctetInfo(message[0]);
+        switch (info & RTP_MIDI_OCTET_CLASS_MASK)
+        {
+        case RTP_MIDI_OCTET_CHANNEL:
+        case RTP_MIDI_OCTET_COMMON:
+            if (!queueMidi(message, info & RTP_MIDI_OCTET_LENGTH_MASK))
+                return queued;
+            break;
+        case RTP_MIDI_OCTET_REALTIME:
+            if (Settings::RealTimeMessages != RealTimeBatched && canTransmit())
+                writeRealTime(message[0]);
+            else if (!queueMidi(message, 1))
+                return queued;
+            break;
+        default:
+            continue; // SysEx, undefined or not a status byte
+        }
+        queued++;
+    }
+    return queued;
+}
+
+// Send a SysEx message in segments (https://www.ietf.org/rfc/rfc6295.html#section-3.2):
+// F0..F7 when it fits in one packet, otherwise F0..F0, F7..F0, ..., F7..F7
+template <class Settings, class Platform, class Tracer>
+size_t AppleMIDICore<Settings, Platform, Tracer>::sendSysEx(const byte *data, size_t size, bool containsBoundaries)
+{
+    if (containsBoundaries)
+    {
+        if (size > 0 && data[0] == MIDI_NAMESPACE::MidiType::SystemExclusiveStart)
+        {
+            data++;
+            size--;
+        }
+        if (size > 0 && data[size - 1] == MIDI_NAMESPACE::MidiType::SystemExclusiveEnd)
+            size--;
+    }
+
+    if (size == 0)
+        return 0;
+
+    bool continues = false; // the previous call stopped in the middle of this message
+#ifdef USE_PACING
+    continues = _sysExOutContinues;
+#endif
+
+    // keep the order with the MIDI messages queued before
+    if (outMidiBuffer.size() > 0)
+    {
+#ifdef USE_PACING
+        if (!pacingAllowsSend())
+            return 0;
+#endif
+        writeRtpMidiToAllParticipants();
+    }
+
+    const size_t maxSegmentSize = Settings::SysExPacketMaxSize - 2;
+
+    size_t offset = 0;
+    do
+    {
+#ifdef USE_PACING
+        // the segments that do not go out now are sent by the next call
+        if (!pacingAllowsSend())
+            break;
+#endif
+        auto segmentSize = min(size - offset, maxSegmentSize);
+        byte first = (offset == 0 && !continues) ? MIDI_NAMESPACE::MidiType::SystemExclusiveStart : MIDI_NAMESPACE::MidiType::SystemExclusiveEnd;
+        byte last  = (offset + segmentSize == size) ? MIDI_NAMESPACE::MidiType::SystemExclusiveEnd : MIDI_NAMESPACE::MidiType::SystemExclusiveStart;
+
+#ifndef ONE_PARTICIPANT
+        for (size_t i = 0; i < participants.size(); i++)
+            writeRtpMidiSysEx(&participants[i], data + offset, segmentSize, first, last);
+#else
+        writeRtpMidiSysEx(&participant, data + offset, segmentSize, first, last);
+#endif
+        offset += segmentSize;
+    } while (offset < size);
+
+#ifdef USE_PACING
+    _sysExOutContinues = (continues || offset > 0) && offset < size;
+#endif
+    return offset;
+}
+
+// Send one SysEx segment to a participant, the data is written from the caller's buffer.
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::writeRtpMidiSysEx(Participant<Settings>* participant, const byte *data, size_t size, byte first, byte last)
+{
+    uint8_t header[sizeof(Rtp) + 3];
+    writeRtpHeader(header, participant);
+
+    const auto length = size + 2;
+
+    // long header, no journal, no delta time for the first (and only) command
+    RtpMIDI_t rtpMidi;
+    rtpMidi.flags = RTP_MIDI_CS_FLAG_B | (uint8_t)(length >> 8);
+
+    header[sizeof(Rtp) + 0] = rtpMidi.flags;
+    header[sizeof(Rtp) + 1] = (uint8_t)length;
+    header[sizeof(Rtp) + 2] = first;
+
+    const UdpSegment segments[] = {
+        { header, sizeof(header) },
+        { data, size },
+        { &last, 1 },
+    };
+    if (!sendPacket(dataPort, participant->remoteIP, participant->remotePort + 1, segments, 3))
+    {
+#ifdef USE_EXT_CALLBACKS
+        if (nullptr != _exceptionCallback)
+            _exceptionCallback(ssrc, UdpBeginPacketFailed, 6);
+#endif
+        return;
+    }
+
+#ifdef USE_PACING
+    spendTokens(participant, sizeof(header) + size + 1);
+#endif
+
+    Tracer::trace(TracePacketSent, amPortType::Data, sizeof(header) + size + 1);
 
 #ifdef USE_EXT_CALLBACKS
     if (_sentRtpMidiCallback)
@@ -765,9 +1260,156 @@ void AppleMIDISession<UdpClass, Settings, Platform>::writeRtpMidiBuffer(Particip
 #endif
 }
 
+// Send a real-time message according to Settings::RealTimeMessages
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::writeRealTime(byte data)
+{
+    // In front of the queued messages, unless they start with a (partial) SysEx,
+    // write() needs that one at the front to split it up.
+    if (Settings::RealTimeMessages == RealTimeFrontOfPacket
+        && (outMidiBuffer.empty() || outMidiBuffer.front() != MIDI_NAMESPACE::MidiType::SystemExclusiveStart))
+    {
+        if (outMidiBuffer.empty())
+        {
+            outMidiBuffer.push_back(data);
+            return;
+        }
+
+        if (outMidiBuffer.free() >= 2)
+            outMidiBuffer.push_front(0x00); // zero timestamp of the message that was first
+        else if (!makeRoom(2))
+            return;
+        outMidiBuffer.push_front(data);
+        return;
+    }
+
+#ifdef USE_PACING
+    // a participant is out of tokens: the message waits in the queue, and goes
+    // out with the others when the bucket refills
+    if (!pacingAllowsSend())
+    {
+        queueMidi(&data, 1);
+        return;
+    }
+#endif
+
+#ifndef ONE_PARTICIPANT
+    for (size_t i = 0; i < participants.size(); i++)
+        writeRtpMidiRealTime(&participants[i], data);
+#else
+    writeRtpMidiRealTime(&participant, data);
+#endif
+}
+
+// Send a packet with just one real-time message to a participant.
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::writeRtpMidiRealTime(Participant<Settings>* participant, byte data)
+{
+    uint8_t packet[sizeof(Rtp) + 2];
+    writeRtpHeader(packet, participant);
+
+    // short header, no journal, LEN 1
+    RtpMIDI_t rtpMidi;
+    rtpMidi.flags = 1;
+
+    packet[sizeof(Rtp) + 0] = rtpMidi.flags;
+    packet[sizeof(Rtp) + 1] = data;
+
+    const UdpSegment segment = { packet, sizeof(packet) };
+    if (!sendPacket(dataPort, participant->remoteIP, participant->remotePort + 1, &segment, 1))
+    {
+#ifdef USE_EXT_CALLBACKS
+        if (nullptr != _exceptionCallback)
+            _exceptionCallback(ssrc, UdpBeginPacketFailed, 7);
+#endif
+        return;
+    }
+
+#ifdef USE_PACING
+    spendTokens(participant, sizeof(packet));
+#endif
+
+    Tracer::trace(TracePacketSent, amPortType::Data, sizeof(packet));
+
+#ifdef USE_EXT_CALLBACKS
+    if (_sentRtpMidiCallback)
+        _sentRtpMidiCallback(rtpMidi);
+#endif
+}
+
+#ifdef USE_PACING
+// Bytes per second a participant may receive, the lower of its RL and the local cap.
+// 0: not paced.
+template <class Settings, class Platform, class Tracer>
+uint32_t AppleMIDICore<Settings, Platform, Tracer>::sendByteRate(const Participant<Settings> *participant) const
+{
+    uint32_t bitrate = participant->bitrateReceiveLimit;
+    if (Settings::MaxSendBitrate > 0 && (bitrate == 0 || Settings::MaxSendBitrate < bitrate))
+        bitrate = Settings::MaxSendBitrate;
+    return bitrate / 8;
+}
+
+// Token bucket: add the bytes earned since the last refill, up to PacingBurstSize.
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::refillTokens(Participant<Settings> *participant)
+{
+    const auto rate = sendByteRate(participant);
+    const auto elapsed = now - participant->lastTokenRefillTime;
+    const uint32_t needed = Settings::PacingBurstSize - participant->sendTokens;
+
+    // not paced, or idle for long enough to pay back any debt
+    if (rate == 0 || elapsed / 1000 > needed / rate)
+    {
+        participant->lastTokenRefillTime = now;
+        participant->sendTokens = Settings::PacingBurstSize;
+        return;
+    }
+
+    // split, so that the multiplications do not overflow
+    const uint32_t ms = elapsed % 1000;
+    const uint32_t earned = (elapsed / 1000) * rate + ms * (rate / 1000) + ms * (rate % 1000) / 1000;
+
+    // less than a token: keep the time, so that slow rates still refill
+    if (earned == 0)
+        return;
+
+    participant->lastTokenRefillTime = now;
+    participant->sendTokens += min(earned, needed);
+}
+
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::spendTokens(Participant<Settings> *participant, size_t size)
+{
+    refillTokens(participant);
+    participant->sendTokens -= size;
+}
+
+// The queued MIDI messages can be sent when no participant is in debt.
+// Sending a packet is allowed with a single token left, the debt it makes
+// is paid back before the next one.
+template <class Settings, class Platform, class Tracer>
+bool AppleMIDICore<Settings, Platform, Tracer>::pacingAllowsSend()
+{
+    bool allowed = true;
+#ifndef ONE_PARTICIPANT
+    for (size_t i = 0; i < participants.size(); i++)
+    {
+        auto pParticipant = &participants[i];
+#else
+    {
+        auto pParticipant = &participant;
+#endif
+        refillTokens(pParticipant);
+        if (pParticipant->sendTokens <= 0)
+            allowed = false;
+    }
+    return allowed;
+}
+#endif
+
 // Manage synchronization state for all active participants.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::manageSynchronization()
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::manageSynchronization()
 {
 #ifndef ONE_PARTICIPANT
     for (size_t i = 0; i < participants.size();)
@@ -833,8 +1475,8 @@ void AppleMIDISession<UdpClass, Settings, Platform>::manageSynchronization()
 //
 // The initiator must initiate a new sync exchange at least once every 60 seconds;
 // otherwise the responder may assume that the initiator has died and terminate the session.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::manageSynchronizationInitiatorHeartBeat(Participant<Settings>* pParticipant)
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::manageSynchronizationInitiatorHeartBeat(Participant<Settings>* pParticipant)
 {
     // Note: During startup, the initiator should send synchronization exchanges more frequently;
     // empirical testing has determined that sending a few exchanges improves clock
@@ -870,8 +1512,8 @@ void AppleMIDISession<UdpClass, Settings, Platform>::manageSynchronizationInitia
 }
 
 // Retry sync invitations while establishing synchronization.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::manageSynchronizationInitiatorInvites(size_t i)
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::manageSynchronizationInitiatorInvites(size_t i)
 {
     auto pParticipant = &participants[i];
 
@@ -900,8 +1542,8 @@ void AppleMIDISession<UdpClass, Settings, Platform>::manageSynchronizationInitia
 #endif
 
 // Send a CK0 synchronization message to a participant.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::sendSynchronization(Participant<Settings>* participant)
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::sendSynchronization(Participant<Settings>* participant)
 {
     AppleMIDI_Synchronization_t synchronization;
     synchronization.timestamps[SYNC_CK0] = rtpMidiClock.Now();
@@ -916,8 +1558,8 @@ void AppleMIDISession<UdpClass, Settings, Platform>::sendSynchronization(Partici
 }
 
 // Manage invitation retries for session establishment (initiators only).
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::manageSessionInvites()
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::manageSessionInvites()
 {
 #ifndef ONE_PARTICIPANT
     for (auto i = 0; i < participants.size();)
@@ -994,14 +1636,14 @@ void AppleMIDISession<UdpClass, Settings, Platform>::manageSessionInvites()
             if (pParticipant->invitationStatus == Initiating
             ||  pParticipant->invitationStatus == AwaitingControlInvitationAccepted)
             {
-                writeInvitation(controlPort, pParticipant->remoteIP, pParticipant->remotePort, invitation, amInvitation);
+                writeInvitation(controlPort, pParticipant->remoteIP, pParticipant->remotePort, invitation, amInvitationHeader);
                 pParticipant->invitationStatus = AwaitingControlInvitationAccepted;
             }
             else
             if (pParticipant->invitationStatus == ControlInvitationAccepted
             ||  pParticipant->invitationStatus == AwaitingDataInvitationAccepted)
             {
-                writeInvitation(dataPort, pParticipant->remoteIP, pParticipant->remotePort + 1, invitation, amInvitation);
+                writeInvitation(dataPort, pParticipant->remoteIP, pParticipant->remotePort + 1, invitation, amInvitationHeader);
                 pParticipant->invitationStatus = AwaitingDataInvitationAccepted;
             }
         }
@@ -1019,8 +1661,8 @@ void AppleMIDISession<UdpClass, Settings, Platform>::manageSessionInvites()
 // MIDI stream state occurring after the specified packet number.
 //
 // This message is sent on the control port.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::manageReceiverFeedback()
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::manageReceiverFeedback()
 {
 #ifndef ONE_PARTICIPANT
     for (uint8_t i = 0; i < participants.size(); i++)
@@ -1046,6 +1688,7 @@ void AppleMIDISession<UdpClass, Settings, Platform>::manageReceiverFeedback()
             AppleMIDI_ReceiverFeedback_t rf;
             rf.ssrc       = ssrc;
             rf.sequenceNr = pParticipant->receiveSequenceNr;
+            rf.dummy      = 0;
             writeReceiverFeedback(pParticipant->remoteIP, pParticipant->remotePort, rf);
 
             // reset the clock. It is started when we receive MIDI
@@ -1057,8 +1700,8 @@ void AppleMIDISession<UdpClass, Settings, Platform>::manageReceiverFeedback()
 #ifdef APPLEMIDI_INITIATOR
 
 // Queue a new outgoing invitation for a remote endpoint.
-template <class UdpClass, class Settings, class Platform>
-bool AppleMIDISession<UdpClass, Settings, Platform>::sendInvite(IPAddress ip, uint16_t port)
+template <class Settings, class Platform, class Tracer>
+bool AppleMIDICore<Settings, Platform, Tracer>::sendInvite(IPAddress ip, uint16_t port)
 {
 #ifndef ONE_PARTICIPANT
     if (participants.full())
@@ -1074,6 +1717,7 @@ bool AppleMIDISession<UdpClass, Settings, Platform>::sendInvite(IPAddress ip, ui
 #endif
     participant.kind = Initiator;
     participant.sendSequenceNr = random(1, UINT16_MAX); // http://www.rfc-editor.org/rfc/rfc6295.txt , 2.1.  RTP Header
+    participant.receivedSequenceNrs = 0;
     participant.remoteIP = ip;
     participant.remotePort = port;
     participant.lastInviteSentTime = now - 1000; // forces invite to be send immediately
@@ -1090,8 +1734,8 @@ bool AppleMIDISession<UdpClass, Settings, Platform>::sendInvite(IPAddress ip, ui
 #endif
 
 // Send end-session to all participants and clear them.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::sendEndSession()
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::sendEndSession()
 {
 #ifndef ONE_PARTICIPANT
     while (participants.size() > 0)
@@ -1111,8 +1755,8 @@ void AppleMIDISession<UdpClass, Settings, Platform>::sendEndSession()
 }
 
 // Send end-session to a single participant and notify callbacks.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::sendEndSession(Participant<Settings>* participant)
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::sendEndSession(Participant<Settings>* participant)
 {
     AppleMIDI_EndSession_t endSession;
     endSession.initiatorToken = 0;
@@ -1124,8 +1768,9 @@ void AppleMIDISession<UdpClass, Settings, Platform>::sendEndSession(Participant<
 }
 
 // Handle an incoming RTP header and track latency/sequence.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedRtp(const Rtp_t& rtp)
+// Returns false for a packet received before, it is dropped.
+template <class Settings, class Platform, class Tracer>
+bool AppleMIDICore<Settings, Platform, Tracer>::ReceivedRtp(const Rtp_t& rtp)
 {
 #ifndef ONE_PARTICIPANT
     auto pParticipant = getParticipantBySSRC(rtp.ssrc);
@@ -1135,38 +1780,85 @@ void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedRtp(const Rtp_t& rt
     
     if (nullptr != pParticipant)
     {
+        // The network can deliver a datagram twice. The last 32 sequence numbers
+        // are remembered, relative to the highest one: a packet that arrives
+        // late (reordered) is still played, a duplicate is not.
+        // A sender that starts counting anew under the same SSRC sends packets
+        // that look old, but they are stamped later than the highest one (a late
+        // packet or a copy is not): the window starts again from there. Without
+        // timestamps (all 0), a restart within the window is taken for copies.
+        const auto ahead = (int16_t)(rtp.sequenceNr - pParticipant->receiveSequenceNr);
+        const bool restarted = (ahead <= 0 && (int32_t)(rtp.timestamp - pParticipant->receiveTimestamp) > 0);
+        const bool first = (pParticipant->receivedSequenceNrs == 0) || restarted;
+        if (first || ahead > 0)
+        {
+            pParticipant->receivedSequenceNrs = (first || ahead >= 32) ? 1 : (pParticipant->receivedSequenceNrs << ahead) | 1;
+            pParticipant->receiveSequenceNr = rtp.sequenceNr;
+            pParticipant->receiveTimestamp = rtp.timestamp;
+        }
+        else if (-ahead < 32)
+        {
+            const uint32_t bit = (uint32_t)1 << -ahead;
+            if (pParticipant->receivedSequenceNrs & bit)
+                return false;
+            pParticipant->receivedSequenceNrs |= bit;
+        }
+
         if (pParticipant->doReceiverFeedback == false)
             pParticipant->receiverFeedbackStartTime = now;
         pParticipant->doReceiverFeedback = true;
 
-#ifdef USE_EXT_CALLBACKS
+#ifdef KEEP_CLOCK_OFFSET
+        // the latency is only known once the clocks are synchronized, 0 until then
+        auto arrival = (uint32_t)rtpMidiClock.Now();
         auto offset = (rtp.timestamp - pParticipant->offsetEstimate);
-        auto latency = (int32_t)(rtpMidiClock.Now() - offset);
+        auto latency = pParticipant->offsetValid ? (int32_t)(arrival - offset) : 0;
+#endif
+
+#ifdef USE_LATENCY_HISTOGRAM
+        // a negative latency means the clock offset estimate is off, count it as 0
+        if (pParticipant->offsetValid)
+            pParticipant->latencyHistogram.record(latency < 0 ? 0 : latency);
+
+        // RFC 3550, 6.4.1: the difference in transit time of two consecutive packets
+        // (the constant clock offset between both parties cancels out).
+        auto transit = arrival - rtp.timestamp;
+        if (pParticipant->lastTransitValid)
+        {
+            auto d = (int32_t)(transit - pParticipant->lastTransit);
+            auto absD = (uint32_t)(d < 0 ? -d : d);
+            pParticipant->jitterHistogram.record(absD);
+            // J(i) = J(i-1) + (|D(i-1,i)| - J(i-1))/16, kept scaled by 16
+            pParticipant->jitter += absD - ((pParticipant->jitter + 8) >> 4);
+        }
+        pParticipant->lastTransit = transit;
+        pParticipant->lastTransitValid = true;
+#endif
 
+#ifdef USE_EXT_CALLBACKS
         if (pParticipant->firstMessageReceived == true)
             // avoids first message to generate sequence exception
             // as we do not know the last sequenceNr received.
             pParticipant->firstMessageReceived = false;
-        else if (rtp.sequenceNr - pParticipant->receiveSequenceNr - 1 != 0) {
+        else if (ahead > 1) {
             if (nullptr != _exceptionCallback)
-                _exceptionCallback(ssrc, ReceivedPacketsDropped, rtp.sequenceNr - pParticipant->receiveSequenceNr - 1);
+                _exceptionCallback(ssrc, ReceivedPacketsDropped, ahead - 1);
         }
 
         if (nullptr != _receivedRtpCallback)
             _receivedRtpCallback(pParticipant->ssrc, rtp, latency);
 #endif
-
-        pParticipant->receiveSequenceNr = rtp.sequenceNr;
     }
     else
     {
         // TODO??? re-connect?
     }
+    return true;
 }
 
 // Notify that a MIDI byte stream has started.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::StartReceivedMidi()
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::StartReceivedMidi()
 {
 #ifdef USE_EXT_CALLBACKS
    if (nullptr != _startReceivedMidiByteCallback)
@@ -1175,8 +1867,8 @@ void AppleMIDISession<UdpClass, Settings, Platform>::StartReceivedMidi()
 }
 
 // Handle a received MIDI byte and buffer it.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedMidi(byte value)
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::ReceivedMidi(byte value)
 {
 #ifdef USE_EXT_CALLBACKS
     if (nullptr != _receivedMidiByteCallback)
@@ -1187,13 +1879,27 @@ void AppleMIDISession<UdpClass, Settings, Platform>::ReceivedMidi(byte value)
 }
 
 // Notify that a MIDI byte stream has ended.
-template <class UdpClass, class Settings, class Platform>
-void AppleMIDISession<UdpClass, Settings, Platform>::EndReceivedMidi()
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::EndReceivedMidi()
 {
+    Tracer::trace(TraceMidiDispatched, amPortType::Data, 0);
+
 #ifdef USE_EXT_CALLBACKS
     if (nullptr != _endReceivedMidiByteCallback)
         _endReceivedMidiByteCallback(ssrc);
 #endif
 }
 
+#ifdef USE_SYSEX_STREAMING
+// Hand a chunk of a received SysEx message to the application.
+template <class Settings, class Platform, class Tracer>
+void AppleMIDICore<Settings, Platform, Tracer>::ReceivedSysExChunk(const byte *data, uint16_t size, uint8_t flags)
+{
+    Tracer::trace(TraceMidiDispatched, amPortType::Data, size);
+
+    if (nullptr != _sysExChunkCallback)
+        _sysExChunkCallback(ssrc, data, size, flags);
+}
+#endif
+
 END_APPLEMIDI_NAMESPACE
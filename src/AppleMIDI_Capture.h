@@ -0,0 +1,323 @@
+#pragma once
+
+#include "AppleMIDI_Defs.h"
+#include "AppleMIDI_Namespace.h"
+
+#if defined(__linux__)
+#include <stdio.h>
+#endif
+
+BEGIN_APPLEMIDI_NAMESPACE
+
+// https://www.tcpdump.org/linktypes.html - raw IPv4, no link layer header
+#define PCAP_LINKTYPE_IPV4 228
+
+#define PCAP_GLOBAL_HEADER_LEN 24
+#define PCAP_RECORD_HEADER_LEN 16
+#define PCAP_IPV4_HEADER_LEN 20
+#define PCAP_UDP_HEADER_LEN 8
+
+enum CaptureDirection : uint8_t
+{
+    Inbound,
+    Outbound,
+};
+
+// Records datagrams into a bounded ring, in pcap format (one IPv4/UDP
+// record per datagram, so Wireshark dissects AppleMIDI and RTP-MIDI
+// directly). When the ring is full, the oldest records are dropped.
+// The record timestamp is the session's own rtp clock (100us units), the
+// time base of the RTP timestamps it sends. It is local: the RTP timestamps
+// of a participant differ from it by that participant's clock offset.
+// A datagram read in parts (larger than the session's buffer) is one record;
+// when another record starts before the rest is read, the record is kept
+// truncated (captured length < original length), as with a pcap snaplen.
+//
+// The ring can be written out as a complete pcap file with dump(), to
+// anything that has a write(const uint8_t *, size_t) (Serial, File, WiFiClient).
+// On Linux, records can also be streamed to a file as they complete.
+//
+// Note: the local IP address is not known to the session, set it with
+// setLocalIP(), otherwise 0.0.0.0 is used.
+class PcapCapture
+{
+public:
+    PcapCapture(uint8_t *buffer, size_t size)
+        : _buffer(buffer), _size(size)
+    {
+        clear();
+    }
+
+#if defined(__linux__)
+    ~PcapCapture()
+    {
+        close();
+    }
+
+    bool open(const char *path)
+    {
+        close();
+        _file = fopen(path, "wb");
+        if (nullptr == _file)
+            return false;
+
+        uint8_t header[PCAP_GLOBAL_HEADER_LEN];
+        globalHeader(header);
+        fwrite(header, 1, sizeof(header), _file);
+        fflush(_file);
+        return true;
+    }
+
+    void close()
+    {
+        if (nullptr != _file)
+            fclose(_file);
+        _file = nullptr;
+    }
+#endif
+
+    void clear()
+    {
+        _head = 0;
+        _tail = 0;
+        _used = 0;
+        _recordLen = 0;
+        _recording = false;
+    }
+
+    void setLocalIP(const IPAddress &ip)
+    {
+        for (uint8_t i = 0; i < 4; i++)
+            _localIP[i] = ip[i];
+    }
+
+    // Start a new record. origLen is the size of the datagram if known
+    // (inbound), for outbound datagrams it is taken from the appended data.
+    void begin(CaptureDirection direction, const IPAddress &remoteIP, uint16_t remotePort, uint16_t localPort,
+               uint64_t timestamp, size_t origLen = 0)
+    {
+        const size_t headerLen = PCAP_RECORD_HEADER_LEN + PCAP_IPV4_HEADER_LEN + PCAP_UDP_HEADER_LEN;
+
+        // a record still open is completed with what it has
+        end();
+
+        if (!makeRoom(headerLen))
+            return;
+
+        _recordStart = _head;
+        _recordLen = 0;
+        _origLen = origLen;
+        _recording = true;
+        _truncated = false;
+
+        uint8_t header[headerLen];
+        memset(header, 0, sizeof(header));
+
+        // pcap record header (little-endian). Lengths are patched in end()
+        auto seconds = (uint32_t)(timestamp / 10000);
+        auto fraction = (uint32_t)(timestamp % 10000) * 100;
+        storeLE32(header + 0, seconds);
+        storeLE32(header + 4, fraction);
+
+        // IPv4 header
+        uint8_t *ip = header + PCAP_RECORD_HEADER_LEN;
+        ip[0] = 0x45;       // version 4, 5 x 32-bit words
+        ip[6] = 0x40;       // don't fragment
+        ip[8] = 64;         // TTL
+        ip[9] = 17;         // UDP
+        uint8_t *src = ip + 12;
+        uint8_t *dst = ip + 16;
+        if (direction == Outbound)
+        {
+            src = ip + 16;
+            dst = ip + 12;
+        }
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            src[i] = remoteIP[i];
+            dst[i] = _localIP[i];
+        }
+
+        // UDP header, no checksum
+        uint8_t *udp = ip + PCAP_IPV4_HEADER_LEN;
+        storeBE16(udp + 0, (direction == Outbound) ? localPort : remotePort);
+        storeBE16(udp + 2, (direction == Outbound) ? remotePort : localPort);
+
+        put(header, headerLen);
+    }
+
+    void append(const uint8_t *data, size_t len)
+    {
+        if (!_recording)
+            return;
+
+        // a record can not grow beyond the ring, the remainder is truncated
+        if (!makeRoom(len))
+        {
+            len = _size - _used;
+            _truncated = true;
+        }
+        put(data, len);
+    }
+
+    void end()
+    {
+        if (!_recording)
+            return;
+        _recording = false;
+
+        const size_t headerLen = PCAP_RECORD_HEADER_LEN + PCAP_IPV4_HEADER_LEN + PCAP_UDP_HEADER_LEN;
+
+        auto inclLen = _recordLen - PCAP_RECORD_HEADER_LEN;
+        auto payloadLen = _recordLen - headerLen;
+        if (_origLen < payloadLen)
+            _origLen = payloadLen;
+        auto origLen = _origLen + PCAP_IPV4_HEADER_LEN + PCAP_UDP_HEADER_LEN;
+
+        uint8_t header[headerLen];
+        get(_recordStart, header, headerLen);
+
+        storeLE32(header + 8, inclLen);
+        storeLE32(header + 12, origLen);
+
+        uint8_t *ip = header + PCAP_RECORD_HEADER_LEN;
+        storeBE16(ip + 2, origLen);
+        uint32_t sum = 0;
+        for (uint8_t i = 0; i < PCAP_IPV4_HEADER_LEN; i += 2)
+            sum += ((uint16_t)ip[i] << 8) | ip[i + 1];
+        while (sum >> 16)
+            sum = (sum & 0xffff) + (sum >> 16);
+        storeBE16(ip + 10, ~sum);
+
+        storeBE16(ip + PCAP_IPV4_HEADER_LEN + 4, origLen - PCAP_IPV4_HEADER_LEN);
+
+        set(_recordStart, header, headerLen);
+
+#if defined(__linux__)
+        if (nullptr != _file)
+        {
+            auto first = _recordLen;
+            if (_recordStart + first > _size)
+                first = _size - _recordStart;
+            fwrite(_buffer + _recordStart, 1, first, _file);
+            fwrite(_buffer, 1, _recordLen - first, _file);
+            fflush(_file);
+        }
+#endif
+        _recordLen = 0;
+    }
+
+    // true when the last record did not fit in the ring and was truncated
+    bool truncated() const { return _truncated; }
+
+    // size of the complete pcap file held by the ring
+    size_t size() const
+    {
+        return PCAP_GLOBAL_HEADER_LEN + _used - _recordLen;
+    }
+
+    // Write the ring out as a pcap file.
+    template <class Stream>
+    size_t dump(Stream &stream) const
+    {
+        uint8_t header[PCAP_GLOBAL_HEADER_LEN];
+        globalHeader(header);
+        stream.write(header, sizeof(header));
+
+        auto len = _used - _recordLen;
+        auto first = len;
+        if (_tail + first > _size)
+            first = _size - _tail;
+        if (first > 0)
+            stream.write(_buffer + _tail, first);
+        if (len - first > 0)
+            stream.write(_buffer, len - first);
+
+        return PCAP_GLOBAL_HEADER_LEN + len;
+    }
+
+private:
+    static void storeLE32(uint8_t *p, uint32_t value)
+    {
+        p[0] = value;
+        p[1] = value >> 8;
+        p[2] = value >> 16;
+        p[3] = value >> 24;
+    }
+
+    static void storeBE16(uint8_t *p, uint16_t value)
+    {
+        p[0] = value >> 8;
+        p[1] = value;
+    }
+
+    static void globalHeader(uint8_t *header)
+    {
+        storeLE32(header + 0, 0xa1b2c3d4); // magic, microsecond resolution
+        header[4] = 2; header[5] = 0;      // version 2.4
+        header[6] = 4; header[7] = 0;
+        storeLE32(header + 8, 0);          // thiszone
+        storeLE32(header + 12, 0);         // sigfigs
+        storeLE32(header + 16, 65535);     // snaplen
+        storeLE32(header + 20, PCAP_LINKTYPE_IPV4);
+    }
+
+    // Drop the oldest records until len more bytes fit. The record
+    // being written is never dropped.
+    bool makeRoom(size_t len)
+    {
+        while (_size - _used < len)
+        {
+            if (_used - _recordLen == 0)
+                return false;
+
+            uint8_t lengths[4];
+            get(_tail + 8, lengths, sizeof(lengths));
+            size_t recordLen = PCAP_RECORD_HEADER_LEN + (lengths[0] | (lengths[1] << 8) | ((uint32_t)lengths[2] << 16) | ((uint32_t)lengths[3] << 24));
+
+            _tail = (_tail + recordLen) % _size;
+            _used -= recordLen;
+        }
+        return true;
+    }
+
+    void put(const uint8_t *data, size_t len)
+    {
+        set(_head, data, len);
+        _head = (_head + len) % _size;
+        _used += len;
+        _recordLen += len;
+    }
+
+    void set(size_t index, const uint8_t *data, size_t len)
+    {
+        for (size_t i = 0; i < len; i++)
+            _buffer[(index + i) % _size] = data[i];
+    }
+
+    void get(size_t index, uint8_t *data, size_t len) const
+    {
+        for (size_t i = 0; i < len; i++)
+            data[i] = _buffer[(index + i) % _size];
+    }
+
+    uint8_t *_buffer;
+    size_t   _size;
+    size_t   _head;
+    size_t   _tail;
+    size_t   _used;
+
+    size_t   _recordStart = 0;
+    size_t   _recordLen = 0;
+    size_t   _origLen = 0;
+    bool     _recording = false;
+    bool     _truncated = false;
+
+    uint8_t  _localIP[4] = {0, 0, 0, 0};
+
+#if defined(__linux__)
+    FILE    *_file = nullptr;
+#endif
+};
+
+END_APPLEMIDI_NAMESPACE
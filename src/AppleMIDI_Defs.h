@@ -16,15 +16,6 @@ typedef uint32_t ssrc_t;
 typedef uint32_t initiatorToken_t;
 typedef uint64_t timestamp_t;
 
-union conversionBuffer
-{
-    uint8_t value8;
-    uint16_t value16;
-    uint32_t value32;
-    uint64_t value64;
-    uint8_t buffer[8];
-};
-
 
 enum parserReturn: uint8_t
 {
@@ -39,28 +30,41 @@ enum parserReturn: uint8_t
 
 #if defined(__AVR__)
 #define APPLEMIDI_PROGMEM PROGMEM
+#define APPLEMIDI_READ_BYTE(x) pgm_read_byte(x)
 typedef const __FlashStringHelper* AppleMIDIConstStr;
 #define GFP(x) (reinterpret_cast<AppleMIDIConstStr>(x))
 #define GF(x) F(x)
 #else
 #define APPLEMIDI_PROGMEM
+#define APPLEMIDI_READ_BYTE(x) (*(x))
 typedef const char* AppleMIDIConstStr;
 #define GFP(x) x
 #define GF(x) x
 #endif
 
-#define RtpBuffer_t Deque<byte, Settings::MaxBufferSize>
-#define MidiBuffer_t Deque<byte, Settings::MaxBufferSize>
+#define ControlBuffer_t Deque<byte, MaxControlBufferSizeOf<Settings>::value>
+#define RtpBuffer_t Deque<byte, MaxDataBufferSizeOf<Settings>::value>
+#define InMidiBuffer_t Deque<byte, MaxInMidiBufferSizeOf<Settings>::value>
+#define OutMidiBuffer_t Deque<byte, MaxOutMidiBufferSizeOf<Settings>::value>
 
 // #define USE_EXT_CALLBACKS
 // #define ONE_PARTICIPANT // memory optimization
 // #define USE_DIRECTORY
+// #define USE_LATENCY_HISTOGRAM // per participant latency and jitter histograms
+// #define USE_PCAP_CAPTURE // record control and data traffic in pcap format
+// #define USE_SYSEX_STREAMING // deliver SysEx in chunks, see setHandleSysExChunk
+// #define USE_PACING // token bucket pacing per participant, honors the bitrate receive limit (RL)
 
 // By defining NO_SESSION_NAME in the sketch, you can save 100 bytes
 #ifndef NO_SESSION_NAME
 #define KEEP_SESSION_NAME
 #endif
 
+// The clock offset (from the CK exchange) is needed to report latency
+#if defined(USE_EXT_CALLBACKS) || defined(USE_LATENCY_HISTOGRAM)
+#define KEEP_CLOCK_OFFSET
+#endif
+
 #define MIDI_SAMPLING_RATE_176K4HZ 176400
 #define MIDI_SAMPLING_RATE_192KHZ 192000
 #define MIDI_SAMPLING_RATE_DEFAULT 10000
@@ -145,6 +149,27 @@ using exceptionCallback             = void (*)(const ssrc_t&, const Exception&,
 using sentRtpCallback               = void (*)(const Rtp_t&);
 using sentRtpMidiCallback           = void (*)(const RtpMIDI_t&);
 #endif
+#ifdef USE_SYSEX_STREAMING
+using sysExChunkCallback            = void (*)(const ssrc_t&, const byte *, uint16_t, uint8_t);
+
+// Position of a chunk in a streamed SysEx message. Both first and last
+// are set on a message that fits in one chunk.
+enum SysExChunkFlags : uint8_t
+{
+    SysExFirstChunk = 0x01,
+    SysExLastChunk  = 0x02,
+    SysExCancelled  = 0x04, // the sender cancelled the message (0xF4), with SysExLastChunk
+};
+#endif
+
+// A MIDI message for AppleMIDISession::sendBatch(). data2 is not used by
+// messages with a single data byte (Program Change, Channel Pressure, ...).
+struct MidiEvent
+{
+    byte status;
+    byte data1;
+    byte data2;
+};
 
 /* Signature "Magic Value" for Apple network MIDI session establishment */
 static constexpr uint8_t amSignature[] = {0xff, 0xff};
@@ -152,14 +177,23 @@ static constexpr uint8_t amSignature[] = {0xff, 0xff};
 /* 2 (stored in network byte order (big-endian)) */
 static constexpr uint8_t amProtocolVersion[] = {0x00, 0x00, 0x00, 0x02};
 
-/* Apple network MIDI valid commands */
-static constexpr uint8_t amInvitation[]          = {'I', 'N'};
-static constexpr uint8_t amEndSession[]          = {'B', 'Y'};
-static constexpr uint8_t amSynchronization[]     = {'C', 'K'};
-static constexpr uint8_t amInvitationAccepted[]  = {'O', 'K'};
-static constexpr uint8_t amInvitationRejected[]  = {'N', 'O'};
-static constexpr uint8_t amReceiverFeedback[]    = {'R', 'S'};
-static constexpr uint8_t amBitrateReceiveLimit[] = {'R', 'L'};
+/* Apple network MIDI valid commands, as the 16-bit value on the wire (first character in the high 8 bits) */
+static constexpr uint16_t amInvitationCommand          = ('I' << 8) | 'N';
+static constexpr uint16_t amEndSessionCommand          = ('B' << 8) | 'Y';
+static constexpr uint16_t amSynchronizationCommand     = ('C' << 8) | 'K';
+static constexpr uint16_t amInvitationAcceptedCommand  = ('O' << 8) | 'K';
+static constexpr uint16_t amInvitationRejectedCommand  = ('N' << 8) | 'O';
+static constexpr uint16_t amReceiverFeedbackCommand    = ('R' << 8) | 'S';
+static constexpr uint16_t amBitrateReceiveLimitCommand = ('R' << 8) | 'L';
+
+/* The invariant start of the messages we send: signature, command and, for
+   IN/OK/NO/BY, the protocol version. Copied in front of the variable fields. */
+static constexpr uint8_t amInvitationHeader[]         = {0xff, 0xff, 'I', 'N', 0x00, 0x00, 0x00, 0x02};
+static constexpr uint8_t amInvitationAcceptedHeader[] = {0xff, 0xff, 'O', 'K', 0x00, 0x00, 0x00, 0x02};
+static constexpr uint8_t amInvitationRejectedHeader[] = {0xff, 0xff, 'N', 'O', 0x00, 0x00, 0x00, 0x02};
+static constexpr uint8_t amEndSessionHeader[]         = {0xff, 0xff, 'B', 'Y', 0x00, 0x00, 0x00, 0x02};
+static constexpr uint8_t amSynchronizationHeader[]    = {0xff, 0xff, 'C', 'K'};
+static constexpr uint8_t amReceiverFeedbackHeader[]   = {0xff, 0xff, 'R', 'S'};
 
 const uint8_t SYNC_CK0 = 0;
 const uint8_t SYNC_CK1 = 1;
@@ -8,154 +8,122 @@
 
 BEGIN_APPLEMIDI_NAMESPACE
 
-template <class UdpClass, class Settings, class Platform>
-class AppleMIDISession;
+template <class Settings, class Platform, class Tracer>
+class AppleMIDICore;
 
-template <class UdpClass, class Settings, class Platform>
+template <class Settings, class Platform, class Tracer>
 class AppleMIDIParser
 {
 public:
-	AppleMIDISession<UdpClass, Settings, Platform> *session;
+	AppleMIDICore<Settings, Platform, Tracer> *session;
 
-	parserReturn parse(RtpBuffer_t &buffer, const amPortType &portType)
+	// parses both the control buffer and the data buffer, frameLength is what is
+	// left of the datagram at the front of the buffer (part of it can still be in
+	// the socket). A message never reads past it.
+	template <class Buffer>
+	parserReturn parse(Buffer &buffer, const amPortType &portType, size_t frameLength)
 	{
-		conversionBuffer cb;
-
-		uint8_t signature[2]; // Signature "Magic Value" for Apple network MIDI session establishment
-		uint8_t command[2];   // 16-bit command identifier (two ASCII characters, first in high 8 bits, second in low 8 bits)
-
-		size_t minimumLen = (sizeof(signature) + sizeof(command)); // Signature + Command
+		// Signature "Magic Value" for Apple network MIDI session establishment, followed by the
+		// 16-bit command identifier (two ASCII characters, first in high 8 bits, second in low 8 bits)
+		size_t minimumLen = (sizeof(amSignature) + sizeof(uint16_t));
 		if (buffer.size() < minimumLen)
             return parserReturn::NotSureGiveMeMoreData;
 
-		size_t i = 0;
-
-		signature[0] = buffer[i++];
-		signature[1] = buffer[i++];
-		if (0 != memcmp(signature, amSignature, sizeof(amSignature)))
-		{
+		if (buffer[0] != amSignature[0] || buffer[1] != amSignature[1])
             return parserReturn::UnexpectedData;
-		}
 
-		command[0] = buffer[i++];
-		command[1] = buffer[i++];
+		const uint16_t command = ((uint16_t)buffer[2] << 8) | buffer[3];
 
-		if (0 == memcmp(command, amInvitation, sizeof(amInvitation)))
-		{
-			uint8_t protocolVersion[4];
+		// The fixed-size part of the message (the largest is CK, 36 bytes), copied
+		// out of the ring in one go once its length is known. Each message below
+		// decodes it from here.
+		uint8_t packet[36];
+
+		size_t i = minimumLen;
 
-			minimumLen += (sizeof(protocolVersion) + sizeof(initiatorToken_t) + sizeof(ssrc_t));
+		switch (command)
+		{
+		case amInvitationCommand:
+		{
+			minimumLen += (sizeof(amProtocolVersion) + sizeof(initiatorToken_t) + sizeof(ssrc_t));
 			if (buffer.size() < minimumLen)
-			{
                 return parserReturn::NotEnoughData;
-			}
+			buffer.copy_out(packet, minimumLen);
 
 			// 2 (stored in network byte order (big-endian))
-			protocolVersion[0] = buffer[i++];
-			protocolVersion[1] = buffer[i++];
-			protocolVersion[2] = buffer[i++];
-			protocolVersion[3] = buffer[i++];
-			if (0 != memcmp(protocolVersion, amProtocolVersion, sizeof(amProtocolVersion)))
-			{
+			if (0 != memcmp(packet + i, amProtocolVersion, sizeof(amProtocolVersion)))
                 return parserReturn::UnexpectedData;
-			}
+			i += sizeof(amProtocolVersion);
 
 			AppleMIDI_Invitation invitation;
 
 			// A random number generated by the session's APPLEMIDI_INITIATOR.
-			cb.buffer[0] = buffer[i++];
-			cb.buffer[1] = buffer[i++];
-			cb.buffer[2] = buffer[i++];
-			cb.buffer[3] = buffer[i++];
-			invitation.initiatorToken = __ntohl(cb.value32);
+			invitation.initiatorToken = load_be32(packet + i);
+			i += 4;
 			
 			// The sender's synchronization source identifier.
-			cb.buffer[0] = buffer[i++];
-			cb.buffer[1] = buffer[i++];
-			cb.buffer[2] = buffer[i++];
-			cb.buffer[3] = buffer[i++];
-			invitation.ssrc = __ntohl(cb.value32);
+			invitation.ssrc = load_be32(packet + i);
+			i += 4;
 
+            // the session name runs up to its 0x00 or the end of the datagram
+            const size_t end = min(buffer.size(), frameLength);
 #ifdef KEEP_SESSION_NAME
             uint16_t bi = 0;
-            while (i < buffer.size())
+            while ((i < end) && (buffer[i] != 0x00))
             {
                 if (bi < Settings::MaxSessionNameLen)
-                    invitation.sessionName[bi++] = buffer[i++];
-                else
-                    i++;
+                    invitation.sessionName[bi++] = buffer[i];
+                i++;
             }
             invitation.sessionName[bi++] = '\0';
 #else
-            while (i < buffer.size())
+            while ((i < end) && (buffer[i] != 0x00))
                 i++;
 #endif
             auto retVal = parserReturn::Processed;
 
-            // when given a Session Name and the buffer has been fully processed and the 
-            // last character is not 'endl', then we got a very long sessionName. It will
-            // continue in the next memory chunk of the packet. We don't care, so indicated
-            // flush the remainder of the packet.
-            // First part if the session name is kept, processing continues
-            if (i > minimumLen)
-                if (i == buffer.size() && buffer[buffer.size() - 1] != 0x00)
-                    retVal = parserReturn::SessionNameVeryLong;
+            // when the name has no 0x00 in the buffer and the datagram goes on past it,
+            // then we got a very long sessionName. It continues in the part of the packet
+            // that is still in the socket. We don't care, so indicate to flush the remainder
+            // of the packet. The first part of the session name is kept, processing continues
+            if (i == end && end < frameLength)
+                retVal = parserReturn::SessionNameVeryLong;
 
-            while (i > 0)
-            {
-                buffer.pop_front(); // consume all the bytes that made up this message
-                --i;
-            }
+            buffer.pop_front(end); // the message takes the rest of the datagram
 
 			session->ReceivedInvitation(invitation, portType);
 
             return retVal;
 		}
-		else if (0 == memcmp(command, amEndSession, sizeof(amEndSession)))
+		case amEndSessionCommand:
 		{
-			uint8_t protocolVersion[4];
-
-			minimumLen += (sizeof(protocolVersion) + sizeof(initiatorToken_t) + sizeof(ssrc_t));
+			minimumLen += (sizeof(amProtocolVersion) + sizeof(initiatorToken_t) + sizeof(ssrc_t));
 			if (buffer.size() < minimumLen)
                 return parserReturn::NotEnoughData;
+			buffer.copy_out(packet, minimumLen);
 
 			// 2 (stored in network byte order (big-endian))
-			protocolVersion[0] = buffer[i++];
-			protocolVersion[1] = buffer[i++];
-			protocolVersion[2] = buffer[i++];
-			protocolVersion[3] = buffer[i++];
-			if (0 != memcmp(protocolVersion, amProtocolVersion, sizeof(amProtocolVersion)))
-			{
+			if (0 != memcmp(packet + i, amProtocolVersion, sizeof(amProtocolVersion)))
                 return parserReturn::UnexpectedData;
-			}
+			i += sizeof(amProtocolVersion);
 
 			AppleMIDI_EndSession_t endSession;
 
 			// A random number generated by the session's APPLEMIDI_INITIATOR.
-			cb.buffer[0] = buffer[i++];
-			cb.buffer[1] = buffer[i++];
-			cb.buffer[2] = buffer[i++];
-			cb.buffer[3] = buffer[i++];
-			endSession.initiatorToken = __ntohl(cb.value32);
+			endSession.initiatorToken = load_be32(packet + i);
+			i += 4;
             
 			// The sender's synchronization source identifier.
-			cb.buffer[0] = buffer[i++];
-			cb.buffer[1] = buffer[i++];
-			cb.buffer[2] = buffer[i++];
-			cb.buffer[3] = buffer[i++];
-			endSession.ssrc = __ntohl(cb.value32);
+			endSession.ssrc = load_be32(packet + i);
+			i += 4;
 
-            while (i > 0)
-            {
-                buffer.pop_front(); // consume all the bytes that made up this message
-                --i;
-            }
+            buffer.pop_front(i); // consume all the bytes that made up this message
 
 			session->ReceivedEndSession(endSession);
 
             return parserReturn::Processed;
 		}
-		else if (0 == memcmp(command, amSynchronization, sizeof(amSynchronization)))
+		case amSynchronizationCommand:
 		{
 			AppleMIDI_Synchronization_t synchronization;
 
@@ -163,194 +131,125 @@ public:
 			minimumLen += (4 + 1 + 3 + (3 * 8));
 			if (buffer.size() < minimumLen)
                 return parserReturn::NotEnoughData;
+			buffer.copy_out(packet, minimumLen);
 
 			// The sender's synchronization source identifier.
-			cb.buffer[0] = buffer[i++];
-			cb.buffer[1] = buffer[i++];
-			cb.buffer[2] = buffer[i++];
-			cb.buffer[3] = buffer[i++];
-			synchronization.ssrc = __ntohl(cb.value32);
-
-			synchronization.count = buffer[i++];
-			buffer[i++];
-			buffer[i++];
-			buffer[i++]; // padding, unused
-			cb.buffer[0] = buffer[i++];
-			cb.buffer[1] = buffer[i++];
-			cb.buffer[2] = buffer[i++];
-			cb.buffer[3] = buffer[i++];
-			cb.buffer[4] = buffer[i++];
-			cb.buffer[5] = buffer[i++];
-			cb.buffer[6] = buffer[i++];
-			cb.buffer[7] = buffer[i++];
-			synchronization.timestamps[0] = __ntohll(cb.value64);
-
-			cb.buffer[0] = buffer[i++];
-			cb.buffer[1] = buffer[i++];
-			cb.buffer[2] = buffer[i++];
-			cb.buffer[3] = buffer[i++];
-			cb.buffer[4] = buffer[i++];
-			cb.buffer[5] = buffer[i++];
-			cb.buffer[6] = buffer[i++];
-			cb.buffer[7] = buffer[i++];
-			synchronization.timestamps[1] = __ntohll(cb.value64);
-
-			cb.buffer[0] = buffer[i++];
-			cb.buffer[1] = buffer[i++];
-			cb.buffer[2] = buffer[i++];
-			cb.buffer[3] = buffer[i++];
-			cb.buffer[4] = buffer[i++];
-			cb.buffer[5] = buffer[i++];
-			cb.buffer[6] = buffer[i++];
-			cb.buffer[7] = buffer[i++];
-			synchronization.timestamps[2] = __ntohll(cb.value64);
-
-            while (i > 0)
-            {
-                buffer.pop_front(); // consume all the bytes that made up this message
-                --i;
-            }
+			synchronization.ssrc = load_be32(packet + i);
+			i += 4;
+
+			synchronization.count = packet[i++];
+			i += 3; // padding, unused
+
+			for (uint8_t t = 0; t < 3; t++)
+			{
+				synchronization.timestamps[t] = load_be64(packet + i);
+				i += 8;
+			}
+
+            buffer.pop_front(i); // consume all the bytes that made up this message
 
 			session->ReceivedSynchronization(synchronization);
 
             return parserReturn::Processed;
 		}
-		else if (0 == memcmp(command, amReceiverFeedback, sizeof(amReceiverFeedback)))
+		case amReceiverFeedbackCommand:
 		{
 			AppleMIDI_ReceiverFeedback_t receiverFeedback;
 
 			minimumLen += (sizeof(receiverFeedback.ssrc) + sizeof(receiverFeedback.sequenceNr) + sizeof(receiverFeedback.dummy));
 			if (buffer.size() < minimumLen)
                 return parserReturn::NotEnoughData;
+			buffer.copy_out(packet, minimumLen);
 
-			cb.buffer[0] = buffer[i++];
-			cb.buffer[1] = buffer[i++];
-			cb.buffer[2] = buffer[i++];
-			cb.buffer[3] = buffer[i++];
-			receiverFeedback.ssrc = __ntohl(cb.value32);
+			receiverFeedback.ssrc = load_be32(packet + i);
+			i += 4;
 
-			cb.buffer[0] = buffer[i++];
-			cb.buffer[1] = buffer[i++];
-			receiverFeedback.sequenceNr = __ntohs(cb.value16);
-			cb.buffer[0] = buffer[i++];
-			cb.buffer[1] = buffer[i++];
-			receiverFeedback.dummy = __ntohs(cb.value16);
+			receiverFeedback.sequenceNr = load_be16(packet + i);
+			i += 2;
+			receiverFeedback.dummy = load_be16(packet + i);
+			i += 2;
 
-            while (i--)
-                buffer.pop_front(); // consume all the bytes that made up this message
+            buffer.pop_front(i); // consume all the bytes that made up this message
 
 			session->ReceivedReceiverFeedback(receiverFeedback);
 
             return parserReturn::Processed;
 		}
 #ifdef APPLEMIDI_INITIATOR
-		else if (0 == memcmp(command, amInvitationAccepted, sizeof(amInvitationAccepted)))
+		case amInvitationAcceptedCommand:
 		{
-            uint8_t protocolVersion[4];
-
-            minimumLen += (sizeof(protocolVersion) + sizeof(initiatorToken_t) + sizeof(ssrc_t));
+            minimumLen += (sizeof(amProtocolVersion) + sizeof(initiatorToken_t) + sizeof(ssrc_t));
             if (buffer.size() < minimumLen)
-            {
                 return parserReturn::NotEnoughData;
-            }
+            buffer.copy_out(packet, minimumLen);
 
             // 2 (stored in network byte order (big-endian))
-            protocolVersion[0] = buffer[i++];
-            protocolVersion[1] = buffer[i++];
-            protocolVersion[2] = buffer[i++];
-            protocolVersion[3] = buffer[i++];
-            if (0 != memcmp(protocolVersion, amProtocolVersion, sizeof(amProtocolVersion)))
-            {
+            if (0 != memcmp(packet + i, amProtocolVersion, sizeof(amProtocolVersion)))
                 return parserReturn::UnexpectedData;
-            }
+            i += sizeof(amProtocolVersion);
 
             AppleMIDI_InvitationAccepted_t invitationAccepted;
 
             // A random number generated by the session's APPLEMIDI_INITIATOR.
-            cb.buffer[0] = buffer[i++];
-            cb.buffer[1] = buffer[i++];
-            cb.buffer[2] = buffer[i++];
-            cb.buffer[3] = buffer[i++];
-            invitationAccepted.initiatorToken = __ntohl(cb.value32);
+            invitationAccepted.initiatorToken = load_be32(packet + i);
+            i += 4;
             
             // The sender's synchronization source identifier.
-            cb.buffer[0] = buffer[i++];
-            cb.buffer[1] = buffer[i++];
-            cb.buffer[2] = buffer[i++];
-            cb.buffer[3] = buffer[i++];
-            invitationAccepted.ssrc = __ntohl(cb.value32);
+            invitationAccepted.ssrc = load_be32(packet + i);
+            i += 4;
 
+            // the session name runs up to its 0x00 or the end of the datagram
+            const size_t end = min(buffer.size(), frameLength);
 #ifdef KEEP_SESSION_NAME
             uint16_t bi = 0;
-            while (i < buffer.size())
+            while ((i < end) && (buffer[i] != 0x00))
             {
                 if (bi < Settings::MaxSessionNameLen)
-                    invitationAccepted.sessionName[bi++] = buffer[i++];
-                else
-                    i++;
+                    invitationAccepted.sessionName[bi++] = buffer[i];
+                i++;
             }
             invitationAccepted.sessionName[bi++] = '\0';
 #else
-            while (i < buffer.size())
+            while ((i < end) && (buffer[i] != 0x00))
                 i++;
 #endif
 
             auto retVal = parserReturn::Processed;
 
-            // when given a Session Name and the buffer has been fully processed and the 
-            // last character is not 'endl', then we got a very long sessionName. It will
-            // continue in the next memory chunk of the packet. We don't care, so indicated
-            // flush the remainder of the packet.
-            // First part if the session name is kept, processing continues
-            if (i > minimumLen)
-                if (i == buffer.size() && buffer[buffer.size() - 1] != 0x00)
-                    retVal = parserReturn::SessionNameVeryLong;
+            // when the name has no 0x00 in the buffer and the datagram goes on past it,
+            // then we got a very long sessionName. It continues in the part of the packet
+            // that is still in the socket. We don't care, so indicate to flush the remainder
+            // of the packet. The first part of the session name is kept, processing continues
+            if (i == end && end < frameLength)
+                retVal = parserReturn::SessionNameVeryLong;
 
-            while (i > 0)
-            {
-                buffer.pop_front(); // consume all the bytes that made up this message
-                --i;
-            }
+            buffer.pop_front(end); // the message takes the rest of the datagram
 
             session->ReceivedInvitationAccepted(invitationAccepted, portType);
 
             return retVal;
 		}
-		else if (0 == memcmp(command, amInvitationRejected, sizeof(amInvitationRejected)))
+		case amInvitationRejectedCommand:
 		{
-            uint8_t protocolVersion[4];
-
-            minimumLen += (sizeof(protocolVersion) + sizeof(initiatorToken_t) + sizeof(ssrc_t));
+            minimumLen += (sizeof(amProtocolVersion) + sizeof(initiatorToken_t) + sizeof(ssrc_t));
             if (buffer.size() < minimumLen)
-            {
                 return parserReturn::NotEnoughData;
-            }
+            buffer.copy_out(packet, minimumLen);
 
             // 2 (stored in network byte order (big-endian))
-            protocolVersion[0] = buffer[i++];
-            protocolVersion[1] = buffer[i++];
-            protocolVersion[2] = buffer[i++];
-            protocolVersion[3] = buffer[i++];
-            if (0 != memcmp(protocolVersion, amProtocolVersion, sizeof(amProtocolVersion)))
-            {
+            if (0 != memcmp(packet + i, amProtocolVersion, sizeof(amProtocolVersion)))
                 return parserReturn::UnexpectedData;
-            }
+            i += sizeof(amProtocolVersion);
 
             AppleMIDI_InvitationRejected_t invitationRejected;
 
             // A random number generated by the session's APPLEMIDI_INITIATOR.
-            cb.buffer[0] = buffer[i++];
-            cb.buffer[1] = buffer[i++];
-            cb.buffer[2] = buffer[i++];
-            cb.buffer[3] = buffer[i++];
-            invitationRejected.initiatorToken = __ntohl(cb.value32);
+            invitationRejected.initiatorToken = load_be32(packet + i);
+            i += 4;
             
             // The sender's synchronization source identifier.
-            cb.buffer[0] = buffer[i++];
-            cb.buffer[1] = buffer[i++];
-            cb.buffer[2] = buffer[i++];
-            cb.buffer[3] = buffer[i++];
-            invitationRejected.ssrc = __ntohl(cb.value32);
+            invitationRejected.ssrc = load_be32(packet + i);
+            i += 4;
 
 #ifdef KEEP_SESSION_NAME
             uint16_t bi = 0;
@@ -371,48 +270,37 @@ public:
                 if (i == buffer.size() || buffer[i++] != 0x00)
                     return parserReturn::NotEnoughData;
 
-            while (i > 0)
-            {
-                buffer.pop_front(); // consume all the bytes that made up this message
-                --i;
-            }
+            buffer.pop_front(i); // consume all the bytes that made up this message
 
             session->ReceivedInvitationRejected(invitationRejected);
 
             return parserReturn::Processed;
 		}
-        else if (0 == memcmp(command, amBitrateReceiveLimit, sizeof(amBitrateReceiveLimit)))
+#endif
+		case amBitrateReceiveLimitCommand:
         {
             AppleMIDI_BitrateReceiveLimit bitrateReceiveLimit;
 
             minimumLen += (sizeof(bitrateReceiveLimit.ssrc) + sizeof(bitrateReceiveLimit.bitratelimit));
             if (buffer.size() < minimumLen)
                 return parserReturn::NotEnoughData;
+            buffer.copy_out(packet, minimumLen);
 
-            cb.buffer[0] = buffer[i++];
-            cb.buffer[1] = buffer[i++];
-            cb.buffer[2] = buffer[i++];
-            cb.buffer[3] = buffer[i++];
-            bitrateReceiveLimit.ssrc = __ntohl(cb.value32);
+            bitrateReceiveLimit.ssrc = load_be32(packet + i);
+            i += 4;
 
-            cb.buffer[0] = buffer[i++];
-            cb.buffer[1] = buffer[i++];
-            cb.buffer[2] = buffer[i++];
-            cb.buffer[3] = buffer[i++];
-            bitrateReceiveLimit.bitratelimit = __ntohl(cb.value32);
+            bitrateReceiveLimit.bitratelimit = load_be32(packet + i);
+            i += 4;
 
-            while (i > 0)
-            {
-                buffer.pop_front(); // consume all the bytes that made up this message
-                --i;
-            }
+            buffer.pop_front(i); // consume all the bytes that made up this message
 
             session->ReceivedBitrateReceiveLimit(bitrateReceiveLimit);
 
             return parserReturn::Processed;
         }
-#endif
-        return parserReturn::UnexpectedData;
+		default:
+	        return parserReturn::UnexpectedData;
+		}
 	}
 };
 
@@ -2,6 +2,10 @@
 
 #include "AppleMIDI_Defs.h"
 
+#ifdef USE_LATENCY_HISTOGRAM
+#include "utility/Histogram.h"
+#endif
+
 #include "AppleMIDI_Namespace.h"
 
 BEGIN_APPLEMIDI_NAMESPACE
@@ -18,7 +22,9 @@ struct Participant
     bool            doReceiverFeedback = false;
 
     uint16_t        sendSequenceNr = 0; // seeded when session/participant is created
-    uint16_t        receiveSequenceNr = 0;
+    uint16_t        receiveSequenceNr = 0; // the highest received
+    uint32_t        receivedSequenceNrs = 0; // bit n: receiveSequenceNr - n was received
+    uint32_t        receiveTimestamp = 0; // of the highest received
 
     unsigned long   lastSyncExchangeTime = 0;
 
@@ -35,7 +41,25 @@ struct Participant
     
 #ifdef USE_EXT_CALLBACKS
     bool            firstMessageReceived = true;
-    uint32_t        offsetEstimate = 0;
+#endif
+#ifdef KEEP_CLOCK_OFFSET
+    uint32_t        offsetEstimate = 0; // the participant's rtp clock minus ours
+    bool            offsetValid = false; // after the first CK exchange
+#endif
+
+#ifdef USE_PACING
+    uint32_t        bitrateReceiveLimit = 0; // bits per second, from the participant's RL. 0: no limit
+    int32_t         sendTokens = 0; // bytes that may be sent right away, negative is debt
+    unsigned long   lastTokenRefillTime = 0;
+#endif
+
+#ifdef USE_LATENCY_HISTOGRAM
+    // one-way latency and RFC 3550 inter-arrival jitter, in rtp clock units (100us)
+    Histogram       latencyHistogram;
+    Histogram       jitterHistogram;
+    uint32_t        jitter = 0; // running RFC 3550 estimate, scaled by 16
+    uint32_t        lastTransit = 0;
+    bool            lastTransitValid = false;
 #endif
     
 #ifdef KEEP_SESSION_NAME
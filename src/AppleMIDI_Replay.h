@@ -0,0 +1,525 @@
+#pragma once
+
+#include "AppleMIDI_Capture.h"
+#include "AppleMIDI_Defs.h"
+#include "AppleMIDI_Namespace.h"
+
+#include "utility/endian.h"
+
+#if defined(__linux__)
+#include <stdio.h>
+
+BEGIN_APPLEMIDI_NAMESPACE
+
+// Link types of the captures (https://www.tcpdump.org/linktypes.html)
+#define PCAP_LINKTYPE_NULL 0
+#define PCAP_LINKTYPE_ETHERNET 1
+#define PCAP_LINKTYPE_RAW 101
+#define PCAP_LINKTYPE_LOOP 108
+#define PCAP_LINKTYPE_LINUX_SLL 113
+#define PCAP_LINKTYPE_LINUX_SLL2 276
+// PCAP_LINKTYPE_IPV4 (228), see AppleMIDI_Capture.h
+
+#define PCAPNG_SECTION_HEADER_BLOCK 0x0A0D0D0A
+#define PCAPNG_INTERFACE_DESCRIPTION_BLOCK 1
+#define PCAPNG_SIMPLE_PACKET_BLOCK 3
+#define PCAPNG_ENHANCED_PACKET_BLOCK 6
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1A2B3C4D
+#define PCAPNG_OPTION_TSRESOL 9
+
+// A UDP datagram out of a capture. data points into the buffer of the
+// PcapReader, and is valid until the next call to next().
+struct PcapDatagram
+{
+    uint64_t  timestamp; // us
+    IPAddress srcIP;
+    IPAddress dstIP;
+    uint16_t  srcPort;
+    uint16_t  dstPort;
+    const uint8_t *data;
+    size_t    size;
+};
+
+// Reads the UDP/IPv4 datagrams of a capture file, pcap (as written by
+// PcapCapture, tcpdump or Wireshark, either byte order, us or ns timestamps)
+// or pcapng (Wireshark's default). Link layers: Ethernet (with VLAN tags),
+// raw IP, BSD loopback, Linux cooked (SLL and SLL2).
+//
+// Records that are not UDP over IPv4 are skipped, and so are IP fragments
+// (not reassembled) and records that do not fit in the buffer. skipped()
+// counts them.
+class PcapReader
+{
+public:
+    PcapReader(uint8_t *buffer, size_t size)
+        : _buffer(buffer), _size(size)
+    {
+    }
+
+    ~PcapReader()
+    {
+        close();
+    }
+
+    bool open(const char *path)
+    {
+        close();
+        _file = fopen(path, "rb");
+        if (nullptr == _file)
+            return false;
+
+        _records = 0;
+        _skipped = 0;
+        _interfaces = 0;
+
+        uint8_t header[PCAP_GLOBAL_HEADER_LEN];
+        if (!readFully(header, 4))
+            return fail();
+
+        auto magic = load_be32(header);
+        if (magic == PCAPNG_SECTION_HEADER_BLOCK)
+        {
+            _pcapng = true;
+            return readSectionHeader();
+        }
+
+        _pcapng = false;
+        if (!readFully(header + 4, sizeof(header) - 4))
+            return fail();
+
+        _littleEndian = (magic == 0xd4c3b2a1 || magic == 0x4d3cb2a1);
+        magic = load32(header);
+        if (magic != 0xa1b2c3d4 && magic != 0xa1b23c4d)
+            return fail();
+        addInterface(load32(header + 20), (magic == 0xa1b23c4d) ? 1000000000 : 1000000);
+        return true;
+    }
+
+    void close()
+    {
+        if (nullptr != _file)
+            fclose(_file);
+        _file = nullptr;
+    }
+
+    // The next UDP datagram, false at the end of the file (or when it is not readable)
+    bool next(PcapDatagram &datagram)
+    {
+        while (nullptr != _file)
+        {
+            uint8_t interface = 0;
+            uint64_t ticks = 0;
+            size_t length = 0;
+
+            if (!(_pcapng ? nextBlock(interface, ticks, length) : nextRecord(ticks, length)))
+            {
+                close();
+                return false;
+            }
+            if (0 == length)
+                continue;
+
+            _records++;
+            const auto resolution = _ticksPerSecond[interface];
+            datagram.timestamp = ticks / resolution * 1000000 + ticks % resolution * 1000000 / resolution;
+            if (decode(_linkTypes[interface], _buffer, length, datagram))
+                return true;
+            _skipped++;
+        }
+        return false;
+    }
+
+    // records read, and those of them that were skipped
+    uint32_t records() const { return _records; }
+    uint32_t skipped() const { return _skipped; }
+
+private:
+    static const uint8_t MaxInterfaces = 8;
+
+    bool fail()
+    {
+        close();
+        return false;
+    }
+
+    bool readFully(uint8_t *data, size_t size)
+    {
+        return fread(data, 1, size, _file) == size;
+    }
+
+    // Reads a record of length bytes into the buffer, skips it when it does not fit (length 0)
+    bool readRecord(size_t &length)
+    {
+        if (length > _size)
+        {
+            _records++;
+            _skipped++;
+            auto skip = length;
+            length = 0;
+            return fseek(_file, skip, SEEK_CUR) == 0;
+        }
+        return readFully(_buffer, length);
+    }
+
+    uint16_t load16(const uint8_t *p) const
+    {
+        return _littleEndian ? (uint16_t)(p[0] | (p[1] << 8)) : load_be16(p);
+    }
+
+    uint32_t load32(const uint8_t *p) const
+    {
+        return _littleEndian ? (uint32_t)(p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24)) : load_be32(p);
+    }
+
+    void addInterface(uint32_t linkType, uint64_t ticksPerSecond)
+    {
+        if (_interfaces >= MaxInterfaces)
+            return;
+        _linkTypes[_interfaces] = linkType;
+        _ticksPerSecond[_interfaces] = ticksPerSecond;
+        _interfaces++;
+    }
+
+    bool nextRecord(uint64_t &ticks, size_t &length)
+    {
+        uint8_t header[PCAP_RECORD_HEADER_LEN];
+        if (!readFully(header, sizeof(header)))
+            return false;
+
+        ticks = (uint64_t)load32(header) * _ticksPerSecond[0] + load32(header + 4);
+        length = load32(header + 8);
+        return readRecord(length);
+    }
+
+    // The section header: the byte order, and the start of a new list of interfaces
+    bool readSectionHeader()
+    {
+        uint8_t header[8];
+        if (!readFully(header, sizeof(header)))
+            return fail();
+
+        _littleEndian = (header[4] == 0x4D);
+        if (load32(header + 4) != PCAPNG_BYTE_ORDER_MAGIC)
+            return fail();
+        _interfaces = 0;
+
+        // the rest of the block: versions, section length, options and trailing length
+        auto blockLength = load32(header);
+        return blockLength >= 12 && fseek(_file, blockLength - 12, SEEK_CUR) == 0;
+    }
+
+    bool nextBlock(uint8_t &interface, uint64_t &ticks, size_t &length)
+    {
+        length = 0;
+
+        uint8_t header[8];
+        if (!readFully(header, sizeof(header)))
+            return false;
+
+        if (load_be32(header) == PCAPNG_SECTION_HEADER_BLOCK)
+        {
+            if (fseek(_file, -4, SEEK_CUR) != 0)
+                return false;
+            return readSectionHeader();
+        }
+
+        auto type = load32(header);
+        size_t blockLength = load32(header + 4);
+        if (blockLength < 12 || (blockLength & 3) != 0)
+            return false;
+        size_t bodyLength = blockLength - 12;
+
+        if (type == PCAPNG_ENHANCED_PACKET_BLOCK || type == PCAPNG_SIMPLE_PACKET_BLOCK)
+        {
+            const size_t fieldsLength = (type == PCAPNG_ENHANCED_PACKET_BLOCK) ? 20 : 4;
+            uint8_t fields[20];
+            if (bodyLength < fieldsLength || !readFully(fields, fieldsLength))
+                return false;
+
+            size_t captured;
+            bool known = (_interfaces > 0);
+            if (type == PCAPNG_ENHANCED_PACKET_BLOCK)
+            {
+                auto id = load32(fields);
+                known = (id < _interfaces);
+                interface = known ? id : 0;
+                ticks = ((uint64_t)load32(fields + 4) << 32) | load32(fields + 8);
+                captured = load32(fields + 12);
+            }
+            else
+            {
+                // no timestamp, the original length is captured unless truncated to the block
+                interface = 0;
+                ticks = 0;
+                captured = load32(fields);
+            }
+            if (captured > bodyLength - fieldsLength)
+                captured = bodyLength - fieldsLength;
+            if (!known)
+                captured = 0;
+
+            length = captured;
+            if (!readRecord(length))
+                return false;
+            // padding, options and the trailing length
+            return fseek(_file, bodyLength - fieldsLength - captured + 4, SEEK_CUR) == 0;
+        }
+
+        if (type == PCAPNG_INTERFACE_DESCRIPTION_BLOCK && bodyLength >= 8)
+        {
+            // link type, reserved, snap length, then the options
+            uint8_t fields[8];
+            if (!readFully(fields, sizeof(fields)))
+                return false;
+            bodyLength -= sizeof(fields);
+
+            uint64_t resolution = 1000000;
+            if (bodyLength <= _size)
+            {
+                if (!readFully(_buffer, bodyLength))
+                    return false;
+                resolution = ticksPerSecond(_buffer, bodyLength);
+                bodyLength = 0;
+            }
+            addInterface(load16(fields), resolution);
+        }
+
+        return fseek(_file, bodyLength + 4, SEEK_CUR) == 0;
+    }
+
+    // if_tsresol of the options of an interface, the default is us
+    uint64_t ticksPerSecond(const uint8_t *options, size_t size) const
+    {
+        while (size >= 4)
+        {
+            auto code = load16(options);
+            size_t length = load16(options + 2);
+            if (code == 0 || length + 4 > size)
+                break;
+
+            if (code == PCAPNG_OPTION_TSRESOL && length == 1)
+            {
+                uint8_t exponent = options[4] & 0x7F;
+                uint64_t ticks = 1;
+                for (uint8_t i = 0; i < exponent && ticks < 1000000000000ULL; i++)
+                    ticks *= (options[4] & 0x80) ? 2 : 10;
+                return ticks;
+            }
+
+            length = (length + 3) & ~3;
+            options += 4 + length;
+            size -= (4 + length < size) ? 4 + length : size;
+        }
+        return 1000000;
+    }
+
+    // Finds the UDP datagram in a captured frame
+    static bool decode(uint32_t linkType, const uint8_t *frame, size_t length, PcapDatagram &datagram)
+    {
+        uint16_t etherType = 0x0800;
+        size_t offset = 0;
+
+        switch (linkType)
+        {
+        case PCAP_LINKTYPE_ETHERNET:
+            offset = 14;
+            if (length < offset)
+                return false;
+            etherType = load_be16(frame + 12);
+            // 802.1Q and 802.1ad tags
+            while ((etherType == 0x8100 || etherType == 0x88A8) && length >= offset + 4)
+            {
+                etherType = load_be16(frame + offset + 2);
+                offset += 4;
+            }
+            break;
+        case PCAP_LINKTYPE_NULL:
+        case PCAP_LINKTYPE_LOOP:
+            // address family, 2 is IPv4 on all systems, in host (NULL) or network (LOOP) byte order
+            offset = 4;
+            if (length < offset || (frame[0] != 2 && frame[3] != 2))
+                return false;
+            break;
+        case PCAP_LINKTYPE_LINUX_SLL:
+            offset = 16;
+            if (length < offset)
+                return false;
+            etherType = load_be16(frame + 14);
+            break;
+        case PCAP_LINKTYPE_LINUX_SLL2:
+            offset = 20;
+            if (length < offset)
+                return false;
+            etherType = load_be16(frame);
+            break;
+        case PCAP_LINKTYPE_RAW:
+        case PCAP_LINKTYPE_IPV4:
+            break;
+        default:
+            return false;
+        }
+
+        if (etherType != 0x0800)
+            return false;
+
+        // IPv4, UDP, not a fragment
+        const uint8_t *ip = frame + offset;
+        length -= offset;
+        if (length < PCAP_IPV4_HEADER_LEN || (ip[0] >> 4) != 4 || ip[9] != 17)
+            return false;
+        if ((load_be16(ip + 6) & 0x3FFF) != 0)
+            return false;
+        size_t ipHeaderLength = (ip[0] & 0x0F) * 4;
+        size_t ipLength = load_be16(ip + 2);
+        if (ipHeaderLength < PCAP_IPV4_HEADER_LEN || ipLength < ipHeaderLength + PCAP_UDP_HEADER_LEN)
+            return false;
+        // frames can be padded (Ethernet minimum size), or truncated by the snap length
+        if (length > ipLength)
+            length = ipLength;
+        if (length < ipHeaderLength + PCAP_UDP_HEADER_LEN)
+            return false;
+
+        const uint8_t *udp = ip + ipHeaderLength;
+        size_t udpLength = load_be16(udp + 4);
+        size_t captured = length - ipHeaderLength;
+        if (udpLength < PCAP_UDP_HEADER_LEN || udpLength > captured)
+            return false;
+
+        datagram.srcIP = IPAddress(ip + 12);
+        datagram.dstIP = IPAddress(ip + 16);
+        datagram.srcPort = load_be16(udp);
+        datagram.dstPort = load_be16(udp + 2);
+        datagram.data = udp + PCAP_UDP_HEADER_LEN;
+        datagram.size = udpLength - PCAP_UDP_HEADER_LEN;
+        return true;
+    }
+
+    uint8_t *_buffer;
+    size_t   _size;
+    FILE    *_file = nullptr;
+
+    bool     _pcapng = false;
+    bool     _littleEndian = true;
+
+    uint8_t  _interfaces = 0;
+    uint32_t _linkTypes[MaxInterfaces];
+    uint64_t _ticksPerSecond[MaxInterfaces];
+
+    uint32_t _records = 0;
+    uint32_t _skipped = 0;
+};
+
+// UdpClass of a session that is fed from a capture: deliver() hands a
+// datagram to the socket bound to its destination port, where the next
+// parsePacket() picks it up. The payload is not copied, it must stay valid
+// until the session has read it. What the session sends is only counted.
+class ReplayUDP
+{
+public:
+    static const uint8_t MaxSockets = 2;
+
+    void begin(uint16_t port)
+    {
+        _port = port;
+        for (uint8_t i = 0; i < MaxSockets; i++)
+            if (nullptr == socket(i))
+            {
+                socket(i) = this;
+                return;
+            }
+    }
+
+    void stop()
+    {
+        for (uint8_t i = 0; i < MaxSockets; i++)
+            if (this == socket(i))
+                socket(i) = nullptr;
+    }
+
+    int beginPacket(IPAddress, uint16_t) { return 1; }
+    size_t write(uint8_t) { return 1; }
+    size_t write(const uint8_t *, size_t size) { return size; }
+
+    int endPacket()
+    {
+        sent()++;
+        return 1;
+    }
+
+    void flush() {}
+
+    int parsePacket()
+    {
+        _rx = _pending;
+        _rxPosition = 0;
+        _pending.size = 0;
+        return (int)_rx.size;
+    }
+
+    int available()
+    {
+        return (int)(_rx.size - _rxPosition);
+    }
+
+    int read()
+    {
+        return (available() > 0) ? _rx.data[_rxPosition++] : -1;
+    }
+
+    int read(uint8_t *buffer, size_t size)
+    {
+        size_t n = available();
+        if (n > size)
+            n = size;
+        for (size_t i = 0; i < n; i++)
+            buffer[i] = _rx.data[_rxPosition++];
+        return (int)n;
+    }
+
+    IPAddress remoteIP() { return _rx.srcIP; }
+    uint16_t remotePort() { return _rx.srcPort; }
+
+    // false when no socket is bound to the destination port
+    static bool deliver(const PcapDatagram &datagram)
+    {
+        for (uint8_t i = 0; i < MaxSockets; i++)
+            if (nullptr != socket(i) && socket(i)->_port == datagram.dstPort)
+            {
+                socket(i)->_pending = datagram;
+                return true;
+            }
+        return false;
+    }
+
+    // true when the sessions have read all delivered datagrams
+    static bool idle()
+    {
+        for (uint8_t i = 0; i < MaxSockets; i++)
+            if (nullptr != socket(i) && (socket(i)->_pending.size > 0 || socket(i)->available() > 0))
+                return false;
+        return true;
+    }
+
+    // datagrams sent by the sessions
+    static uint32_t &sent()
+    {
+        static uint32_t count = 0;
+        return count;
+    }
+
+private:
+    static ReplayUDP *&socket(uint8_t index)
+    {
+        static ReplayUDP *sockets[MaxSockets] = {};
+        return sockets[index];
+    }
+
+    uint16_t _port = 0;
+    PcapDatagram _pending = {};
+    PcapDatagram _rx = {};
+    size_t _rxPosition = 0;
+};
+
+END_APPLEMIDI_NAMESPACE
+
+#endif
@@ -4,18 +4,74 @@
 
 BEGIN_APPLEMIDI_NAMESPACE
 
+// How MIDI real-time messages (Clock, Start, Stop, ...) are sent
+enum RealTimePolicy : uint8_t
+{
+    RealTimeBatched,       // queued up with the other messages of this loop
+    RealTimeImmediate,     // right away, in a packet of their own
+    RealTimeFrontOfPacket, // ahead of the messages queued up for the next packet
+};
+
+// When the MIDI messages queued up for sending are flushed into a packet
+enum FlushPolicy : uint8_t
+{
+    FlushEveryLoop,    // at the start of available(), all messages of a loop in one packet
+    FlushEveryMessage, // after every message, lowest latency, most packets
+    FlushAfterWindow,  // FlushWindow ms after the first message was queued up
+    FlushAtThreshold,  // once FlushThreshold bytes are queued up, or after FlushWindow ms
+};
+
 struct DefaultSettings
 {
-    // Small default to fit constrained MCUs; raise if you send larger SysEx.
-    static const size_t UdpTxPacketMaxSize = 24;
-    
-    // MIDI buffer size in bytes; should be >= 3 * max message length.
+    // Size of all buffers below, in bytes. A Settings type can give one buffer
+    // a size of its own by declaring it (see BufferSize, below), e.g.
+    //   struct MySettings : DefaultSettings { static const size_t MaxInMidiBufferSize = 16; };
+    //
+    // MaxControlBufferSize: incoming AppleMIDI messages on the control port. A
+    //   message must fit as a whole: 16 bytes + the session name for an invitation.
+    // MaxDataBufferSize: incoming RTP-MIDI packets, and the synchronization (36
+    //   bytes) on the data port.
+    // MaxInMidiBufferSize: received MIDI, waiting to be read by the MIDI library.
+    // MaxOutMidiBufferSize: MIDI queued up for the next packet; should be >= 3 *
+    //   max message length.
     static const size_t MaxBufferSize = 64;
-    
+
+    // Datagrams the data buffer keeps track of at once (their length, 2 bytes
+    // each), so that a malformed one is dropped as a whole.
+    static const uint8_t MaxDataFrames = 8;
+
     static const size_t MaxSessionNameLen = 24;
 
+    // Largest MIDI command section sendSysEx() puts in one packet. The data is
+    // written from the caller's buffer, so this costs no RAM here, but the UDP
+    // stack must be able to hold the datagram. Max 4095 (12-bit LEN field).
+    static const size_t SysExPacketMaxSize = 1400;
+
+    // Real-time messages bypass the batching of the other MIDI messages
+    // (see RealTimePolicy), to keep the jitter on the MIDI clock low.
+    static const RealTimePolicy RealTimeMessages = RealTimeBatched;
+
+    // Trade-off between latency and packet rate, see FlushPolicy. The queue is
+    // always flushed when it is full.
+    static const FlushPolicy OutgoingFlush = FlushEveryLoop;
+    static const unsigned long FlushWindow = 1; // ms
+    static const size_t FlushThreshold = 48; // bytes, < MaxOutMidiBufferSize (FlushAtThreshold)
+
+    // RAM budget of a session in bytes, checked at compile time. 0: no check.
+    // See AppleMIDISession::Footprint for where the bytes go.
+    static const size_t MaxSessionFootprint = 0;
+
     static const uint8_t MaxNumberOfParticipants = 2;
 
+    // Local cap on the MIDI data rate to each participant, in bits per second
+    // (USE_PACING). A lower limit received from the participant (RL) takes precedence.
+    // 0: no local cap.
+    static const uint32_t MaxSendBitrate = 0;
+
+    // Bytes a paced participant can receive in a burst, before MIDI messages
+    // are held back and coalesced into fewer, larger packets (USE_PACING).
+    static const uint16_t PacingBurstSize = 256;
+
     static const uint8_t MaxNumberOfComputersInDirectory = 5;
     
     // The recovery journal mechanism requires that the receiver periodically
@@ -44,4 +100,32 @@ struct DefaultSettings
     static const unsigned long SynchronizationHeartBeat = 10000;
 };
 
+template <class>
+struct SettingDeclared
+{
+    typedef void type;
+};
+
+// The size of a buffer: Settings::<Name> when the Settings declare it,
+// Settings::MaxBufferSize otherwise. Declared in the Settings, not in
+// DefaultSettings, so that a MaxBufferSize of a derived Settings still applies.
+#define APPLEMIDI_BUFFER_SIZE(Name)                                                       \
+    template <class Settings, class = void>                                               \
+    struct Name##Of                                                                       \
+    {                                                                                     \
+        static const size_t value = Settings::MaxBufferSize;                              \
+    };                                                                                    \
+    template <class Settings>                                                             \
+    struct Name##Of<Settings, typename SettingDeclared<decltype(Settings::Name)>::type>   \
+    {                                                                                     \
+        static const size_t value = Settings::Name;                                       \
+    };
+
+APPLEMIDI_BUFFER_SIZE(MaxControlBufferSize)
+APPLEMIDI_BUFFER_SIZE(MaxDataBufferSize)
+APPLEMIDI_BUFFER_SIZE(MaxInMidiBufferSize)
+APPLEMIDI_BUFFER_SIZE(MaxOutMidiBufferSize)
+
+#undef APPLEMIDI_BUFFER_SIZE
+
 END_APPLEMIDI_NAMESPACE
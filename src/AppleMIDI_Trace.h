@@ -0,0 +1,106 @@
+#pragma once
+
+#include "AppleMIDI_Defs.h"
+#include "AppleMIDI_Namespace.h"
+
+#if defined(__linux__)
+#include <stdio.h>
+#endif
+
+BEGIN_APPLEMIDI_NAMESPACE
+
+// Points on the packet path where the session calls its Tracer.
+enum TraceEvent : uint8_t
+{
+    TracePacketReceived,    // value: size of the datagram
+    TraceParseBegin,        // value: bytes waiting in the buffer
+    TraceParseEnd,          // value: parserReturn
+    TraceMidiDispatched,    // value: 0, or the size of a SysEx chunk
+    TraceFlush,             // value: bytes in the outgoing MIDI buffer
+    TracePacketSent,        // value: size of the datagram
+};
+
+// Tracing policy, given to AppleMIDISession the same way as Platform.
+// The default does nothing and, being an empty inline function, compiles to nothing.
+//
+// A tracer only has to provide:
+//     static void trace(TraceEvent, amPortType, uint16_t value);
+struct NoTrace
+{
+    static inline void trace(TraceEvent, amPortType, uint16_t) {}
+};
+
+// Records the last Size events (8 bytes each) into a static ring buffer,
+// timestamped with micros(). On Linux, the ring can be written out as
+// Chrome trace JSON (load it in chrome://tracing or https://ui.perfetto.dev)
+template <size_t Size = 256>
+struct RingTrace
+{
+    struct Event
+    {
+        uint32_t   timestamp; // micros()
+        TraceEvent event;
+        amPortType port;
+        uint16_t   value;
+    };
+
+    static inline void trace(TraceEvent event, amPortType port, uint16_t value)
+    {
+        auto &e = _events[_head];
+        e.timestamp = micros();
+        e.event = event;
+        e.port = port;
+        e.value = value;
+
+        if (++_head >= Size)
+            _head = 0;
+        if (_count < Size)
+            _count++;
+    }
+
+    static size_t size() { return _count; }
+
+    // 0 is the oldest event in the ring
+    static const Event &at(size_t index)
+    {
+        auto i = (_head + Size - _count + index) % Size;
+        return _events[i];
+    }
+
+    static void clear()
+    {
+        _head = 0;
+        _count = 0;
+    }
+
+#if defined(__linux__)
+    static void dumpChromeTrace(FILE *file)
+    {
+        static const char *names[] = {"receive", "parse", "parse", "dispatch", "flush", "send"};
+        static const char *ports[] = {"control", "data"};
+
+        fprintf(file, "{\"traceEvents\":[\n");
+        for (size_t i = 0; i < _count; i++)
+        {
+            auto &e = at(i);
+            const char *phase = (e.event == TraceParseBegin) ? "B" : (e.event == TraceParseEnd) ? "E" : "i";
+            fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\",\"ts\":%lu,\"pid\":1,\"tid\":%u%s,\"args\":{\"value\":%u}}",
+                    (i == 0) ? "" : ",\n",
+                    names[e.event], ports[e.port], phase, (unsigned long)e.timestamp, (unsigned)e.port + 1,
+                    (*phase == 'i') ? ",\"s\":\"t\"" : "", (unsigned)e.value);
+        }
+        fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    }
+#endif
+
+private:
+    static Event  _events[Size];
+    static size_t _head;
+    static size_t _count;
+};
+
+template <size_t Size> typename RingTrace<Size>::Event RingTrace<Size>::_events[Size];
+template <size_t Size> size_t RingTrace<Size>::_head = 0;
+template <size_t Size> size_t RingTrace<Size>::_count = 0;
+
+END_APPLEMIDI_NAMESPACE
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "AppleMIDI_Namespace.h"
+
+#include "utility/UdpSegment.h"
+
+BEGIN_APPLEMIDI_NAMESPACE
+
+// What the session needs from a UDP socket. AppleMIDICore only talks to this
+// interface, so the protocol engine is instantiated once per Settings, Platform
+// and Tracer, however many UdpClasses a firmware uses (EthernetUDP and WiFiUDP).
+class UdpTransport
+{
+public:
+    virtual void begin(uint16_t port) = 0;
+    virtual void stop() = 0;
+
+    virtual int parsePacket() = 0;
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int read(uint8_t *buffer, size_t size) = 0;
+    virtual IPAddress remoteIP() = 0;
+    virtual uint16_t remotePort() = 0;
+
+    // A complete datagram, made up of segments. false when it could not be sent.
+    virtual bool sendPacket(const IPAddress &ip, uint16_t port, const UdpSegment *segments, uint8_t count) = 0;
+
+protected:
+    ~UdpTransport() {}
+};
+
+// The UdpTransport of a UdpClass (EthernetUDP, WiFiUDP, ...)
+template <class UdpClass>
+class UdpAdapter : public UdpTransport
+{
+public:
+    void begin(uint16_t port) override { udp.begin(port); }
+    void stop() override { udp.stop(); }
+
+    int parsePacket() override { return udp.parsePacket(); }
+    int available() override { return udp.available(); }
+    int read() override { return udp.read(); }
+    int read(uint8_t *buffer, size_t size) override { return udp.read(buffer, size); }
+    IPAddress remoteIP() override { return udp.remoteIP(); }
+    uint16_t remotePort() override { return udp.remotePort(); }
+
+    // In one gathered send when the UdpClass can (HasSendPacket), otherwise the
+    // segments are written one by one between beginPacket and endPacket.
+    bool sendPacket(const IPAddress &ip, uint16_t port, const UdpSegment *segments, uint8_t count) override
+    {
+        return sendSegments(ip, port, segments, count, GatherTag<HasSendPacket<UdpClass>::value>());
+    }
+
+    UdpClass udp;
+
+private:
+    bool sendSegments(const IPAddress &ip, uint16_t port, const UdpSegment *segments, uint8_t count, GatherTag<true>)
+    {
+        return udp.sendPacket(ip, port, segments, count) != 0;
+    }
+
+    bool sendSegments(const IPAddress &ip, uint16_t port, const UdpSegment *segments, uint8_t count, GatherTag<false>)
+    {
+        if (!udp.beginPacket(ip, port))
+            return false;
+
+        for (uint8_t i = 0; i < count; i++)
+            udp.write(segments[i].data, segments[i].size);
+
+        const bool sent = udp.endPacket() != 0;
+        udp.flush();
+        return sent;
+    }
+};
+
+END_APPLEMIDI_NAMESPACE
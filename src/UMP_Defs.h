@@ -0,0 +1,94 @@
+#pragma once
+
+#include "AppleMIDI_Namespace.h"
+
+BEGIN_APPLEMIDI_NAMESPACE
+
+// Network MIDI 2.0 (UDP) transport, MIDI Association M2-124-UM.
+// A datagram is the signature, followed by command packets: a header word
+// (command code, payload length in 32-bit words, 2 bytes of command specific
+// data) and the payload. All words are big endian.
+
+// There is no well-known port, the session is announced with mDNS (_midi2._udp)
+#define DEFAULT_UMP_PORT 5506
+
+#define UMP_SIGNATURE_LEN 4
+#define UMP_COMMAND_HEADER_LEN 4
+#define UMP_WORD_LEN 4
+
+static constexpr uint8_t umpSignature[] = {'M', 'I', 'D', 'I'};
+
+enum UmpCommand : uint8_t
+{
+    UmpInvitation                   = 0x01,
+    UmpInvitationWithAuthentication = 0x02,
+    UmpInvitationWithUserAuthentication = 0x03,
+    UmpInvitationAccepted           = 0x10,
+    UmpInvitationPending            = 0x11,
+    UmpInvitationAuthenticationRequired = 0x12,
+    UmpInvitationUserAuthenticationRequired = 0x13,
+    UmpPing                         = 0x20,
+    UmpPingReply                    = 0x21,
+    UmpRetransmitRequest            = 0x80,
+    UmpRetransmitError              = 0x81,
+    UmpSessionReset                 = 0x82,
+    UmpSessionResetReply            = 0x83,
+    UmpNak                          = 0x8F,
+    UmpBye                          = 0xF0,
+    UmpByeReply                     = 0xF1,
+    UmpData                         = 0xFF,
+};
+
+// Reasons of a Bye (command specific data, first byte)
+enum UmpByeReason : uint8_t
+{
+    UmpByeUndefined           = 0x00,
+    UmpByeUserTerminated      = 0x01,
+    UmpByePowerDown           = 0x02,
+    UmpByeTooManyLostPackets  = 0x03,
+    UmpByeTimeout             = 0x04,
+    UmpByeSessionNotEstablished = 0x05,
+    UmpByeNoPendingSession    = 0x06,
+    UmpByeProtocolError       = 0x07,
+    UmpByeTooManySessions     = 0x40,
+};
+
+// Reasons of a NAK (command specific data, first byte)
+enum UmpNakReason : uint8_t
+{
+    UmpNakOther               = 0x00,
+    UmpNakCommandNotSupported = 0x01,
+    UmpNakCommandNotExpected  = 0x02,
+    UmpNakCommandMalformed    = 0x03,
+};
+
+// Reasons of a Retransmit Error (command specific data, first byte)
+enum UmpRetransmitErrorReason : uint8_t
+{
+    UmpRetransmitUnknown      = 0x00,
+    UmpRetransmitNotAvailable = 0x01,
+};
+
+// Capabilities of an invitation (command specific data, second byte)
+#define UMP_CAPABILITY_AUTHENTICATION 0x01
+#define UMP_CAPABILITY_USER_AUTHENTICATION 0x02
+
+// Size in words of a Universal MIDI Packet, from the message type in the
+// top nibble of its first word.
+static inline uint8_t umpWordCount(uint32_t firstWord)
+{
+    // message types 0x0 - 0xF: 32, 32, 32, 64, 64, 128, 32, 32, 64, 64, 64, 96, 96, 128, 128, 128 bits.
+    // The number of words - 1, 2 bits per message type, type 0x0 in the low bits.
+    static const uint32_t sizes = 0xFE950D40;
+    return ((sizes >> ((firstWord >> 28) * 2)) & 0x03) + 1;
+}
+
+#define UMP_MAX_WORDS 4
+
+using umpConnectedCallback    = void (*)(const IPAddress &, const char *);
+using umpDisconnectedCallback = void (*)(const IPAddress &);
+#ifdef USE_EXT_CALLBACKS
+using umpExceptionCallback    = void (*)(const IPAddress &, const Exception &, const int32_t value);
+#endif
+
+END_APPLEMIDI_NAMESPACE
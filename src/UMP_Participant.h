@@ -0,0 +1,30 @@
+#pragma once
+
+#include "UMP_Defs.h"
+
+#include "AppleMIDI_Namespace.h"
+
+BEGIN_APPLEMIDI_NAMESPACE
+
+// A client in a Network MIDI 2.0 session. Unlike Participant there is no SSRC
+// or clock exchange: the client is known by its address, and the 16-bit
+// sequence numbers of the UMP Data commands.
+template <class Settings>
+struct UmpParticipant
+{
+    IPAddress       remoteIP = INADDR_NONE;
+    uint16_t        remotePort = 0;
+
+    uint16_t        sendSequenceNr = 0;    // of the next UMP Data command sent
+    uint16_t        receiveSequenceNr = 0; // of the next UMP Data command expected
+    bool            dataSent = false;      // since the session (re)started, for the FEC
+
+    unsigned long   lastReceivedTime = 0;
+    unsigned long   lastPingTime = 0;
+
+#ifdef KEEP_SESSION_NAME
+    char            endpointName[Settings::MaxSessionNameLen + 1];
+#endif
+};
+
+END_APPLEMIDI_NAMESPACE
@@ -0,0 +1,267 @@
+#pragma once
+
+// Network MIDI 2.0 (UDP), next to AppleMIDI: Universal MIDI Packets (UMP),
+// in 32-bit words, on a single UDP port.
+// https://midi.org/network-midi-2-0
+
+#include "AppleMIDI.h"
+
+#include "UMP_Defs.h"
+#include "UMP_Settings.h"
+#include "UMP_Participant.h"
+
+#include "AppleMIDI_Namespace.h"
+
+BEGIN_APPLEMIDI_NAMESPACE
+
+// The protocol engine of a Network MIDI 2.0 session, in the host role: it
+// accepts invitations from clients and exchanges UMP with all of them. Like
+// AppleMIDICore it does not depend on the UdpClass. Use it through UMPSession (below).
+template <class _Settings, class _Platform, class _Tracer>
+class UMPCore
+{
+    typedef _Settings Settings;
+    typedef _Platform Platform;
+    typedef _Tracer Tracer;
+
+    static_assert(Settings::MaxUmpDatagramSize >= 64 && Settings::MaxUmpDatagramSize % UMP_WORD_LEN == 0,
+                  "MaxUmpDatagramSize must be a multiple of 4, and hold an invitation (64 bytes)");
+    static_assert(Settings::MaxInUmpWords >= UMP_MAX_WORDS && Settings::MaxOutUmpWords >= UMP_MAX_WORDS,
+                  "The UMP buffers must hold the largest message (4 words)");
+    static_assert(Settings::MaxOutUmpWords <= 0xFF,
+                  "MaxOutUmpWords must fit the payload length of a command (8 bits)");
+
+    template <class, class, class, class>
+    friend class UMPSession;
+
+protected:
+    UMPCore(UdpTransport &port, const char *endpointName, const uint16_t portNr)
+        : port(port)
+    {
+        this->portNr = portNr;
+#ifdef KEEP_SESSION_NAME
+        strncpy(this->localName, endpointName, Settings::MaxSessionNameLen);
+        this->localName[Settings::MaxSessionNameLen] = '\0';
+#else
+        (void)endpointName;
+#endif
+    };
+
+public:
+    virtual ~UMPCore(){};
+
+    UMPCore &setHandleConnected(umpConnectedCallback fptr)
+    {
+        _connectedCallback = fptr;
+        return *this;
+    }
+    UMPCore &setHandleDisconnected(umpDisconnectedCallback fptr)
+    {
+        _disconnectedCallback = fptr;
+        return *this;
+    }
+#ifdef USE_EXT_CALLBACKS
+    UMPCore &setHandleException(umpExceptionCallback fptr)
+    {
+        _exceptionCallback = fptr;
+        return *this;
+    }
+#endif
+
+#ifdef KEEP_SESSION_NAME
+    const char *getName() const
+    {
+        return this->localName;
+    };
+    UMPCore &setName(const char *endpointName)
+    {
+        strncpy(this->localName, endpointName, Settings::MaxSessionNameLen);
+        this->localName[Settings::MaxSessionNameLen] = '\0';
+        return *this;
+    };
+#else
+    const char *getName() const
+    {
+        return nullptr;
+    };
+    UMPCore &setName(const char *endpointName) { return *this; };
+#endif
+
+    // Product Instance Id sent with the invitation reply, e.g. a serial number
+    // (ASCII, at most 42 characters). The string is not copied.
+    UMPCore &setProductInstanceId(const char *productInstanceId)
+    {
+        _productInstanceId = productInstanceId;
+        return *this;
+    }
+
+    const uint16_t getPort() const
+    {
+        return this->portNr;
+    };
+
+    // call this method *before* calling begin()
+    UMPCore &setPort(const uint16_t portNr)
+    {
+        this->portNr = portNr;
+        return *this;
+    }
+
+    size_t getNumberOfParticipants() const { return participants.size(); }
+
+    void begin()
+    {
+        port.begin(portNr);
+    }
+
+    void end()
+    {
+        sendBye(UmpByeUserTerminated);
+        port.stop();
+    }
+
+    // Says goodbye to all participants
+    void sendBye(UmpByeReason reason = UmpByeUserTerminated);
+
+    // Queue up a Universal MIDI Packet (1 to 4 words, as its message type says)
+    // for the next UMP Data command. Returns false when the size does not match
+    // the message type, or there is nobody to send to.
+    bool send(const uint32_t *words, uint8_t count);
+
+    // MIDI 2.0 channel voice messages. Group and channel 0 - 15, as in the UMP.
+    bool sendNoteOn(uint8_t group, uint8_t channel, uint8_t note, uint16_t velocity);
+    bool sendNoteOff(uint8_t group, uint8_t channel, uint8_t note, uint16_t velocity);
+    bool sendControlChange(uint8_t group, uint8_t channel, uint8_t index, uint32_t value);
+
+    // Send the queued up UMP now, instead of at the next available()
+    void flush();
+
+    // Call at the start of loop(). Sends what was queued up in the previous loop,
+    // receives, and keeps the sessions alive. Returns the number of UMP words
+    // waiting to be read.
+    unsigned available()
+    {
+        now = millis();
+
+        flush();
+
+        // the next datagram is read once the last one has been read out, the
+        // pings and timeouts are kept up while it is
+        if (inUmpBuffer.empty() && readPacket())
+            parsePacket();
+
+        manageParticipants();
+
+        return inUmpBuffer.size();
+    };
+
+    // Copies the next Universal MIDI Packet into words (room for 4), and returns
+    // its number of words. 0 when there is none.
+    uint8_t read(uint32_t *words)
+    {
+        if (inUmpBuffer.empty())
+            return 0;
+
+        auto count = umpWordCount(inUmpBuffer.front());
+        for (uint8_t i = 0; i < count; i++)
+        {
+            words[i] = inUmpBuffer.front();
+            inUmpBuffer.pop_front();
+        }
+        return count;
+    };
+
+protected:
+    UdpTransport &port;
+
+private:
+    // the datagram being parsed, word aligned
+    uint32_t packetBuffer[Settings::MaxUmpDatagramSize / UMP_WORD_LEN];
+    size_t packetSize = 0;
+    bool packetTruncated = false; // larger than packetBuffer
+
+    // whole Universal MIDI Packets only
+    Deque<uint32_t, Settings::MaxInUmpWords> inUmpBuffer;
+
+    // The payload of the next UMP Data command, in network byte order, and
+    // the one sent before it, for the forward error correction
+    uint8_t outUmpBuffer[2][Settings::MaxOutUmpWords * UMP_WORD_LEN];
+    size_t outUmpSize[2] = {0, 0};
+    uint8_t outUmpIndex = 0;
+
+    umpConnectedCallback _connectedCallback = nullptr;
+    umpDisconnectedCallback _disconnectedCallback = nullptr;
+#ifdef USE_EXT_CALLBACKS
+    umpExceptionCallback _exceptionCallback = nullptr;
+#endif
+
+    Deque<UmpParticipant<Settings>, Settings::MaxNumberOfParticipants> participants;
+
+    const char *_productInstanceId = "";
+    uint16_t portNr = DEFAULT_UMP_PORT;
+    uint32_t pingId = 0;
+
+#ifdef KEEP_SESSION_NAME
+    char localName[Settings::MaxSessionNameLen + 1];
+#endif
+
+private:
+    size_t readPacket();
+    void parsePacket();
+    void parseCommand(const uint8_t *, const IPAddress &, uint16_t);
+
+    void ReceivedInvitation(const uint8_t *, const IPAddress &, uint16_t);
+    void ReceivedUmpData(UmpParticipant<Settings> *, const uint8_t *);
+    void ReceivedSessionReset(UmpParticipant<Settings> *);
+
+    bool sendPacket(const IPAddress &, uint16_t, const UdpSegment *, uint8_t, uint8_t);
+    void writeCommand(const IPAddress &, uint16_t, uint8_t, uint16_t, const uint8_t *payload = nullptr, uint8_t words = 0);
+    void writeNak(const IPAddress &, uint16_t, UmpNakReason, const uint8_t *);
+    void writeInvitationAccepted(const IPAddress &, uint16_t);
+    void writePing(UmpParticipant<Settings> *);
+    void writeUmpData(UmpParticipant<Settings> *);
+
+    void manageParticipants();
+    void removeParticipant(size_t);
+    void raiseException(const IPAddress &, Exception, int32_t);
+
+    UmpParticipant<Settings> *getParticipant(const IPAddress &, uint16_t);
+};
+
+// The socket of a UMPSession, ahead of the UMPCore (see AppleMIDIPorts)
+template <class UdpClass>
+struct UMPPort
+{
+    UdpAdapter<UdpClass> adapter;
+};
+
+// A Network MIDI 2.0 session on a UdpClass: the socket, and the UMPCore working on it.
+template <class UdpClass, class _Settings = DefaultUmpSettings, class _Platform = DefaultPlatform, class _Tracer = NoTrace>
+class UMPSession : private UMPPort<UdpClass>, public UMPCore<_Settings, _Platform, _Tracer>
+{
+    typedef UMPCore<_Settings, _Platform, _Tracer> Core;
+
+public:
+    UMPSession(const char *endpointName, const uint16_t port = DEFAULT_UMP_PORT)
+        : Core(this->adapter, endpointName, port)
+    {
+    }
+};
+
+END_APPLEMIDI_NAMESPACE
+
+#include "UMP_Session.hpp"
+
+#define UMP_CREATE_INSTANCE(Type, Name, EndpointName, Port) \
+    APPLEMIDI_NAMESPACE::UMPSession<Type> Name(EndpointName, Port);
+
+#if defined(ARDUINO_ARCH_ESP32) || defined(ESP32)
+#define UMP_CREATE_DEFAULTSESSION_INSTANCE() \
+    UMP_CREATE_INSTANCE(WiFiUDP, UMP, "UMP-ESP32", DEFAULT_UMP_PORT);
+#elif defined(ESP8266)
+#define UMP_CREATE_DEFAULTSESSION_INSTANCE() \
+    UMP_CREATE_INSTANCE(WiFiUDP, UMP, "UMP-ESP8266", DEFAULT_UMP_PORT);
+#else
+#define UMP_CREATE_DEFAULTSESSION_INSTANCE() \
+    UMP_CREATE_INSTANCE(EthernetUDP, UMP, "UMP-Arduino", DEFAULT_UMP_PORT);
+#endif
@@ -0,0 +1,522 @@
+#pragma once
+
+#include "AppleMIDI_Namespace.h"
+#include <string.h>
+
+BEGIN_APPLEMIDI_NAMESPACE
+
+// Read the next datagram as a whole. What does not fit in the buffer is dropped.
+template <class Settings, class Platform, class Tracer>
+size_t UMPCore<Settings, Platform, Tracer>::readPacket()
+{
+    packetSize = 0;
+    packetTruncated = false;
+
+    int size = port.parsePacket();
+    if (size <= 0)
+        return 0;
+
+    Tracer::trace(TracePacketReceived, amPortType::Data, size);
+
+    auto bytesRead = port.read(reinterpret_cast<uint8_t *>(packetBuffer), min((size_t)size, sizeof(packetBuffer)));
+    if (bytesRead > 0)
+        packetSize = bytesRead;
+
+    // the remainder, so that the next parsePacket() starts at a datagram
+    while (port.available() > 0)
+    {
+        uint8_t discard[16];
+        if (port.read(discard, sizeof(discard)) <= 0)
+            break;
+        packetTruncated = true;
+    }
+
+    if (packetTruncated)
+        raiseException(port.remoteIP(), BufferFullException, size);
+
+    return packetSize;
+}
+
+// The signature, then command packets: a header word (command code, payload
+// length in words, command specific data) followed by the payload
+template <class Settings, class Platform, class Tracer>
+void UMPCore<Settings, Platform, Tracer>::parsePacket()
+{
+    const uint8_t *packet = reinterpret_cast<const uint8_t *>(packetBuffer);
+    const auto remoteIP = port.remoteIP();
+    const auto remotePort = port.remotePort();
+
+    Tracer::trace(TraceParseBegin, amPortType::Data, packetSize);
+
+    if (packetSize < UMP_SIGNATURE_LEN || memcmp(packet, umpSignature, sizeof(umpSignature)) != 0)
+    {
+        Tracer::trace(TraceParseEnd, amPortType::Data, UnexpectedData);
+        raiseException(remoteIP, ParseException, 0);
+        return;
+    }
+
+    size_t i = UMP_SIGNATURE_LEN;
+    while (i + UMP_COMMAND_HEADER_LEN <= packetSize)
+    {
+        const size_t commandSize = UMP_COMMAND_HEADER_LEN + packet[i + 1] * UMP_WORD_LEN;
+        if (i + commandSize > packetSize)
+        {
+            // a command cut off by our buffer is not the sender's fault
+            if (!packetTruncated)
+            {
+                writeNak(remoteIP, remotePort, UmpNakCommandMalformed, packet + i);
+                raiseException(remoteIP, ParseException, packet[i]);
+            }
+            break;
+        }
+
+        parseCommand(packet + i, remoteIP, remotePort);
+        i += commandSize;
+    }
+
+    Tracer::trace(TraceParseEnd, amPortType::Data, Processed);
+}
+
+template <class Settings, class Platform, class Tracer>
+void UMPCore<Settings, Platform, Tracer>::parseCommand(const uint8_t *command, const IPAddress &remoteIP, uint16_t remotePort)
+{
+    const uint8_t code = command[0];
+    const uint8_t words = command[1];
+    const uint8_t *payload = command + UMP_COMMAND_HEADER_LEN;
+
+    // any command shows the participant is still there
+    auto participant = getParticipant(remoteIP, remotePort);
+    if (nullptr != participant)
+        participant->lastReceivedTime = now;
+
+    switch (code)
+    {
+    case UmpInvitation:
+        ReceivedInvitation(command, remoteIP, remotePort);
+        break;
+    case UmpPing:
+        if (words < 1)
+            writeNak(remoteIP, remotePort, UmpNakCommandMalformed, command);
+        else
+            writeCommand(remoteIP, remotePort, UmpPingReply, 0, payload, 1);
+        break;
+    case UmpPingReply:
+    case UmpRetransmitError:
+    case UmpSessionResetReply:
+    case UmpByeReply:
+        break;
+    case UmpRetransmitRequest:
+        if (nullptr == participant)
+            writeCommand(remoteIP, remotePort, UmpBye, UmpByeSessionNotEstablished << 8);
+        else
+        {
+            // no history is kept, the previous UMP Data command only goes along
+            // with the next one (UmpForwardErrorCorrection)
+            uint8_t error[UMP_WORD_LEN] = {};
+            store_be16(error, load_be16(command + 2));
+            writeCommand(remoteIP, remotePort, UmpRetransmitError, UmpRetransmitNotAvailable << 8, error, 1);
+        }
+        break;
+    case UmpSessionReset:
+        if (nullptr == participant)
+            writeCommand(remoteIP, remotePort, UmpBye, UmpByeSessionNotEstablished << 8);
+        else
+            ReceivedSessionReset(participant);
+        break;
+    case UmpNak:
+        // the participant did not understand something we sent
+        raiseException(remoteIP, ParseException, command[2]);
+        break;
+    case UmpBye:
+        writeCommand(remoteIP, remotePort, UmpByeReply, 0);
+        for (size_t j = 0; j < participants.size(); j++)
+            if (&participants[j] == participant)
+            {
+                removeParticipant(j);
+                break;
+            }
+        break;
+    case UmpData:
+        if (nullptr == participant)
+            writeCommand(remoteIP, remotePort, UmpBye, UmpByeSessionNotEstablished << 8);
+        else
+            ReceivedUmpData(participant, command);
+        break;
+    case UmpInvitationWithAuthentication:
+    case UmpInvitationWithUserAuthentication:
+    case UmpInvitationAccepted:
+    case UmpInvitationPending:
+    case UmpInvitationAuthenticationRequired:
+    case UmpInvitationUserAuthenticationRequired:
+        // we are the host, and do not ask for authentication
+        writeNak(remoteIP, remotePort, UmpNakCommandNotExpected, command);
+        break;
+    default:
+        writeNak(remoteIP, remotePort, UmpNakCommandNotSupported, command);
+        break;
+    }
+}
+
+// Payload: the UMP Endpoint Name (command specific data 1: its length in
+// words), then the Product Instance Id, both zero padded
+template <class Settings, class Platform, class Tracer>
+void UMPCore<Settings, Platform, Tracer>::ReceivedInvitation(const uint8_t *command, const IPAddress &remoteIP, uint16_t remotePort)
+{
+    const uint8_t nameWords = command[2];
+    if (nameWords > command[1])
+    {
+        writeNak(remoteIP, remotePort, UmpNakCommandMalformed, command);
+        raiseException(remoteIP, ParseException, UmpInvitation);
+        return;
+    }
+
+    auto participant = getParticipant(remoteIP, remotePort);
+    const bool isNew = (nullptr == participant);
+    if (isNew)
+    {
+        if (participants.full())
+        {
+            writeCommand(remoteIP, remotePort, UmpBye, UmpByeTooManySessions << 8);
+            raiseException(remoteIP, TooManyParticipantsException, 0);
+            return;
+        }
+
+        UmpParticipant<Settings> newParticipant;
+        newParticipant.remoteIP = remoteIP;
+        newParticipant.remotePort = remotePort;
+        participants.push_back(newParticipant);
+        participant = &participants.back();
+    }
+    else
+    {
+        // invited again: the client has started over
+        participant->sendSequenceNr = 0;
+        participant->receiveSequenceNr = 0;
+        participant->dataSent = false;
+    }
+
+    participant->lastReceivedTime = now;
+    participant->lastPingTime = now;
+
+#ifdef KEEP_SESSION_NAME
+    const size_t nameLen = min((size_t)nameWords * UMP_WORD_LEN, (size_t)Settings::MaxSessionNameLen);
+    memcpy(participant->endpointName, command + UMP_COMMAND_HEADER_LEN, nameLen);
+    participant->endpointName[nameLen] = '\0';
+#endif
+
+    writeInvitationAccepted(remoteIP, remotePort);
+
+    if (isNew && nullptr != _connectedCallback)
+#ifdef KEEP_SESSION_NAME
+        _connectedCallback(remoteIP, participant->endpointName);
+#else
+        _connectedCallback(remoteIP, nullptr);
+#endif
+}
+
+// Command specific data: the sequence number. A datagram may carry earlier
+// UMP Data commands again (forward error correction), these are skipped.
+// A command is taken as a whole or not at all: when it does not fit in the
+// buffer, its copy in the next datagram can still bring it.
+template <class Settings, class Platform, class Tracer>
+void UMPCore<Settings, Platform, Tracer>::ReceivedUmpData(UmpParticipant<Settings> *participant, const uint8_t *command)
+{
+    const uint16_t sequenceNr = load_be16(command + 2);
+    const int16_t gap = (int16_t)(sequenceNr - participant->receiveSequenceNr);
+    if (gap < 0)
+        return;
+
+    const uint8_t words = command[1];
+    if (inUmpBuffer.free() < words)
+    {
+        raiseException(participant->remoteIP, BufferFullException, words);
+        return;
+    }
+
+    if (gap > 0)
+        raiseException(participant->remoteIP, ReceivedPacketsDropped, gap);
+
+    participant->receiveSequenceNr = sequenceNr + 1;
+
+    const uint8_t *payload = command + UMP_COMMAND_HEADER_LEN;
+    for (uint8_t i = 0; i < words;)
+    {
+        const uint32_t first = load_be32(payload + i * UMP_WORD_LEN);
+        const uint8_t count = umpWordCount(first);
+        if (i + count > words)
+        {
+            raiseException(participant->remoteIP, ParseException, UmpData);
+            return;
+        }
+        inUmpBuffer.push_back(first);
+        for (uint8_t j = 1; j < count; j++)
+            inUmpBuffer.push_back(load_be32(payload + (i + j) * UMP_WORD_LEN));
+        i += count;
+
+        Tracer::trace(TraceMidiDispatched, amPortType::Data, 0);
+    }
+}
+
+// Both sides start counting UMP Data commands from 0 again
+template <class Settings, class Platform, class Tracer>
+void UMPCore<Settings, Platform, Tracer>::ReceivedSessionReset(UmpParticipant<Settings> *participant)
+{
+    participant->sendSequenceNr = 0;
+    participant->receiveSequenceNr = 0;
+    participant->dataSent = false;
+
+    writeCommand(participant->remoteIP, participant->remotePort, UmpSessionResetReply, 0);
+}
+
+template <class Settings, class Platform, class Tracer>
+bool UMPCore<Settings, Platform, Tracer>::sendPacket(const IPAddress &remoteIP, uint16_t remotePort, const UdpSegment *segments, uint8_t count, uint8_t code)
+{
+    if (!port.sendPacket(remoteIP, remotePort, segments, count))
+    {
+        raiseException(remoteIP, UdpBeginPacketFailed, code);
+        return false;
+    }
+
+    size_t size = 0;
+    for (uint8_t i = 0; i < count; i++)
+        size += segments[i].size;
+    Tracer::trace(TracePacketSent, amPortType::Data, size);
+    return true;
+}
+
+// A datagram with a single command. payload: words * 4 bytes, in network byte order.
+template <class Settings, class Platform, class Tracer>
+void UMPCore<Settings, Platform, Tracer>::writeCommand(const IPAddress &remoteIP, uint16_t remotePort, uint8_t code, uint16_t data, const uint8_t *payload, uint8_t words)
+{
+    uint8_t header[UMP_SIGNATURE_LEN + UMP_COMMAND_HEADER_LEN];
+    memcpy(header, umpSignature, sizeof(umpSignature));
+    header[4] = code;
+    header[5] = words;
+    store_be16(header + 6, data);
+
+    const UdpSegment segments[] = {
+        { header, sizeof(header) },
+        { payload, (size_t)words * UMP_WORD_LEN },
+    };
+    sendPacket(remoteIP, remotePort, segments, (words > 0) ? 2 : 1, code);
+}
+
+// The payload is the header of the offending command
+template <class Settings, class Platform, class Tracer>
+void UMPCore<Settings, Platform, Tracer>::writeNak(const IPAddress &remoteIP, uint16_t remotePort, UmpNakReason reason, const uint8_t *command)
+{
+    writeCommand(remoteIP, remotePort, UmpNak, reason << 8, command, 1);
+}
+
+template <class Settings, class Platform, class Tracer>
+void UMPCore<Settings, Platform, Tracer>::writeInvitationAccepted(const IPAddress &remoteIP, uint16_t remotePort)
+{
+    static const uint8_t padding[UMP_WORD_LEN] = {};
+
+#ifdef KEEP_SESSION_NAME
+    const char *name = localName;
+#else
+    const char *name = "";
+#endif
+    const size_t nameLen = strlen(name);
+    const size_t productInstanceIdLen = min(strlen(_productInstanceId), (size_t)42);
+    const uint8_t nameWords = (nameLen + UMP_WORD_LEN - 1) / UMP_WORD_LEN;
+    const uint8_t productInstanceIdWords = (productInstanceIdLen + UMP_WORD_LEN - 1) / UMP_WORD_LEN;
+
+    uint8_t header[UMP_SIGNATURE_LEN + UMP_COMMAND_HEADER_LEN];
+    memcpy(header, umpSignature, sizeof(umpSignature));
+    header[4] = UmpInvitationAccepted;
+    header[5] = nameWords + productInstanceIdWords;
+    header[6] = nameWords;
+    header[7] = 0;
+
+    const UdpSegment segments[] = {
+        { header, sizeof(header) },
+        { reinterpret_cast<const uint8_t *>(name), nameLen },
+        { padding, nameWords * UMP_WORD_LEN - nameLen },
+        { reinterpret_cast<const uint8_t *>(_productInstanceId), productInstanceIdLen },
+        { padding, productInstanceIdWords * UMP_WORD_LEN - productInstanceIdLen },
+    };
+    sendPacket(remoteIP, remotePort, segments, sizeof(segments) / sizeof(segments[0]), UmpInvitationAccepted);
+}
+
+template <class Settings, class Platform, class Tracer>
+void UMPCore<Settings, Platform, Tracer>::writePing(UmpParticipant<Settings> *participant)
+{
+    uint8_t payload[UMP_WORD_LEN];
+    store_be32(payload, ++pingId);
+    writeCommand(participant->remoteIP, participant->remotePort, UmpPing, 0, payload, 1);
+
+    participant->lastPingTime = now;
+}
+
+// The queued up UMP in a UMP Data command, behind the previous one when
+// UmpForwardErrorCorrection is set: the UMP is the same for all participants,
+// only the sequence numbers differ.
+template <class Settings, class Platform, class Tracer>
+void UMPCore<Settings, Platform, Tracer>::writeUmpData(UmpParticipant<Settings> *participant)
+{
+    const uint8_t current = outUmpIndex;
+    const uint8_t previous = outUmpIndex ^ 1;
+
+    uint8_t header[UMP_COMMAND_HEADER_LEN] = {UmpData, (uint8_t)(outUmpSize[current] / UMP_WORD_LEN)};
+    store_be16(header + 2, participant->sendSequenceNr);
+
+    uint8_t previousHeader[UMP_COMMAND_HEADER_LEN] = {UmpData, (uint8_t)(outUmpSize[previous] / UMP_WORD_LEN)};
+    store_be16(previousHeader + 2, participant->sendSequenceNr - 1);
+
+    const bool withPrevious = Settings::UmpForwardErrorCorrection && participant->dataSent && outUmpSize[previous] > 0;
+
+    const UdpSegment segments[] = {
+        { umpSignature, sizeof(umpSignature) },
+        { previousHeader, sizeof(previousHeader) },
+        { outUmpBuffer[previous], outUmpSize[previous] },
+        { header, sizeof(header) },
+        { outUmpBuffer[current], outUmpSize[current] },
+    };
+
+    if (withPrevious)
+        sendPacket(participant->remoteIP, participant->remotePort, segments, 5, UmpData);
+    else
+    {
+        const UdpSegment single[] = { segments[0], segments[3], segments[4] };
+        sendPacket(participant->remoteIP, participant->remotePort, single, 3, UmpData);
+    }
+
+    participant->sendSequenceNr++;
+    participant->dataSent = true;
+}
+
+template <class Settings, class Platform, class Tracer>
+void UMPCore<Settings, Platform, Tracer>::flush()
+{
+    if (outUmpSize[outUmpIndex] == 0)
+        return;
+
+    Tracer::trace(TraceFlush, amPortType::Data, outUmpSize[outUmpIndex]);
+
+    for (size_t i = 0; i < participants.size(); i++)
+        writeUmpData(&participants[i]);
+
+    // what was sent becomes the previous command
+    outUmpIndex ^= 1;
+    outUmpSize[outUmpIndex] = 0;
+}
+
+template <class Settings, class Platform, class Tracer>
+bool UMPCore<Settings, Platform, Tracer>::send(const uint32_t *words, uint8_t count)
+{
+    if (count == 0 || count != umpWordCount(words[0]))
+        return false;
+    if (participants.empty())
+        return false;
+
+    if (outUmpSize[outUmpIndex] + count * UMP_WORD_LEN > sizeof(outUmpBuffer[0]))
+        flush();
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        store_be32(outUmpBuffer[outUmpIndex] + outUmpSize[outUmpIndex], words[i]);
+        outUmpSize[outUmpIndex] += UMP_WORD_LEN;
+    }
+    return true;
+}
+
+// MIDI 2.0 channel voice message (message type 0x4): status and channel,
+// note and attribute type (none) in the first word, velocity and attribute in the second
+template <class Settings, class Platform, class Tracer>
+bool UMPCore<Settings, Platform, Tracer>::sendNoteOn(uint8_t group, uint8_t channel, uint8_t note, uint16_t velocity)
+{
+    const uint32_t words[] = {
+        0x40900000 | (uint32_t)(group & 0x0F) << 24 | (uint32_t)(channel & 0x0F) << 16 | (uint32_t)(note & 0x7F) << 8,
+        (uint32_t)velocity << 16,
+    };
+    return send(words, 2);
+}
+
+template <class Settings, class Platform, class Tracer>
+bool UMPCore<Settings, Platform, Tracer>::sendNoteOff(uint8_t group, uint8_t channel, uint8_t note, uint16_t velocity)
+{
+    const uint32_t words[] = {
+        0x40800000 | (uint32_t)(group & 0x0F) << 24 | (uint32_t)(channel & 0x0F) << 16 | (uint32_t)(note & 0x7F) << 8,
+        (uint32_t)velocity << 16,
+    };
+    return send(words, 2);
+}
+
+template <class Settings, class Platform, class Tracer>
+bool UMPCore<Settings, Platform, Tracer>::sendControlChange(uint8_t group, uint8_t channel, uint8_t index, uint32_t value)
+{
+    const uint32_t words[] = {
+        0x40B00000 | (uint32_t)(group & 0x0F) << 24 | (uint32_t)(channel & 0x0F) << 16 | (uint32_t)(index & 0x7F) << 8,
+        value,
+    };
+    return send(words, 2);
+}
+
+template <class Settings, class Platform, class Tracer>
+void UMPCore<Settings, Platform, Tracer>::sendBye(UmpByeReason reason)
+{
+    flush();
+
+    while (!participants.empty())
+    {
+        auto &participant = participants.back();
+        writeCommand(participant.remoteIP, participant.remotePort, UmpBye, reason << 8);
+        removeParticipant(participants.size() - 1);
+    }
+}
+
+// Ping a participant that has been quiet, and say goodbye when it stays quiet
+template <class Settings, class Platform, class Tracer>
+void UMPCore<Settings, Platform, Tracer>::manageParticipants()
+{
+    for (auto i = (int)participants.size() - 1; i >= 0; i--)
+    {
+        auto participant = &participants[i];
+
+        if (now - participant->lastReceivedTime >= Settings::UmpSessionTimeout)
+        {
+            writeCommand(participant->remoteIP, participant->remotePort, UmpBye, UmpByeTimeout << 8);
+            raiseException(participant->remoteIP, ListenerTimeOutException, 0);
+            removeParticipant(i);
+        }
+        else if (now - participant->lastReceivedTime >= Settings::UmpPingInterval &&
+                 now - participant->lastPingTime >= Settings::UmpPingInterval)
+            writePing(participant);
+    }
+}
+
+template <class Settings, class Platform, class Tracer>
+void UMPCore<Settings, Platform, Tracer>::removeParticipant(size_t index)
+{
+    const IPAddress remoteIP = participants[index].remoteIP;
+    participants.erase(index);
+
+    if (nullptr != _disconnectedCallback)
+        _disconnectedCallback(remoteIP);
+}
+
+template <class Settings, class Platform, class Tracer>
+void UMPCore<Settings, Platform, Tracer>::raiseException(const IPAddress &remoteIP, Exception exception, int32_t value)
+{
+#ifdef USE_EXT_CALLBACKS
+    if (nullptr != _exceptionCallback)
+        _exceptionCallback(remoteIP, exception, value);
+#else
+    (void)remoteIP;
+    (void)exception;
+    (void)value;
+#endif
+}
+
+template <class Settings, class Platform, class Tracer>
+UmpParticipant<Settings> *UMPCore<Settings, Platform, Tracer>::getParticipant(const IPAddress &remoteIP, uint16_t remotePort)
+{
+    for (size_t i = 0; i < participants.size(); i++)
+        if (participants[i].remoteIP == remoteIP && participants[i].remotePort == remotePort)
+            return &participants[i];
+    return nullptr;
+}
+
+END_APPLEMIDI_NAMESPACE
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "AppleMIDI_Namespace.h"
+
+BEGIN_APPLEMIDI_NAMESPACE
+
+// The settings of a UMPSession. It has none of the buffers, clock or journal
+// of an AppleMIDI session, so it does not share DefaultSettings.
+struct DefaultUmpSettings
+{
+    static const size_t MaxSessionNameLen = 24;
+
+    static const uint8_t MaxNumberOfParticipants = 2;
+
+    // Largest datagram read as a whole, in bytes. Commands past it are dropped.
+    static const size_t MaxUmpDatagramSize = 256;
+
+    // Received UMP words, waiting to be read.
+    static const size_t MaxInUmpWords = 64;
+
+    // UMP words queued up for the next UMP Data command.
+    static const size_t MaxOutUmpWords = 32;
+
+    // A participant not heard from for this long is pinged, and after
+    // UmpSessionTimeout it is said goodbye.
+    static const unsigned long UmpPingInterval = 5000;
+    static const unsigned long UmpSessionTimeout = 20000;
+
+    // Every UMP Data command is sent again ahead of the next one, so that
+    // a single lost datagram does not lose MIDI (forward error correction).
+    static const bool UmpForwardErrorCorrection = true;
+};
+
+END_APPLEMIDI_NAMESPACE
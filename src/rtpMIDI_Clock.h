@@ -10,12 +10,12 @@ BEGIN_APPLEMIDI_NAMESPACE
 
 typedef struct rtpMidi_Clock
 {
-	uint32_t clockRate_;
+	uint32_t clockRate_ = 0;
 
-	uint64_t startTime_;
-	uint64_t initialTimeStamp_;
-	uint32_t low32_;
-	uint32_t high32_;
+	uint64_t startTime_ = 0;
+	uint64_t initialTimeStamp_ = 0;
+	uint32_t low32_ = 0;
+	uint32_t high32_ = 0;
 
 	void Init(uint64_t initialTimeStamp, uint32_t clockRate)
 	{
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "AppleMIDI_Defs.h"
 #include "AppleMIDI_Namespace.h"
 
 BEGIN_APPLEMIDI_NAMESPACE
@@ -138,4 +139,62 @@ typedef struct PACKED RtpMIDI
 	uint8_t flags;
 } RtpMIDI_t;
 
+// Class of a MIDI octet (high nibble) and the length of its message, status
+// octet included (low nibble). One lookup classifies and sizes any octet.
+#define RTP_MIDI_OCTET_DATA             0x00 // data octet, running status applies
+#define RTP_MIDI_OCTET_CHANNEL          0x10
+#define RTP_MIDI_OCTET_SYSEX            0x20 // F0, F7: length is found by scanning
+#define RTP_MIDI_OCTET_COMMON           0x30
+#define RTP_MIDI_OCTET_REALTIME         0x40
+#define RTP_MIDI_OCTET_UNDEFINED        0x50 // F9, FD: skipped
+#define RTP_MIDI_OCTET_UNDEFINED_COMMON 0x60 // F4, F5: skipped, up to and including F7
+#define RTP_MIDI_OCTET_CLASS_MASK       0xf0
+#define RTP_MIDI_OCTET_LENGTH_MASK      0x0f
+
+#define D__ (RTP_MIDI_OCTET_DATA)
+#define CH2 (RTP_MIDI_OCTET_CHANNEL | 2)
+#define CH3 (RTP_MIDI_OCTET_CHANNEL | 3)
+#define SX_ (RTP_MIDI_OCTET_SYSEX | 1)
+#define SC1 (RTP_MIDI_OCTET_COMMON | 1)
+#define SC2 (RTP_MIDI_OCTET_COMMON | 2)
+#define SC3 (RTP_MIDI_OCTET_COMMON | 3)
+#define RT_ (RTP_MIDI_OCTET_REALTIME | 1)
+#define UR_ (RTP_MIDI_OCTET_UNDEFINED | 1)
+#define UC_ (RTP_MIDI_OCTET_UNDEFINED_COMMON | 1)
+
+static constexpr uint8_t rtpMidiOctetTable[256] APPLEMIDI_PROGMEM = {
+    D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, // 0x00
+    D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, // 0x10
+    D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, // 0x20
+    D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, // 0x30
+    D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, // 0x40
+    D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, // 0x50
+    D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, // 0x60
+    D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, D__, // 0x70
+    CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, // 0x80
+    CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, // 0x90
+    CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, // 0xA0
+    CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, // 0xB0
+    CH2, CH2, CH2, CH2, CH2, CH2, CH2, CH2, CH2, CH2, CH2, CH2, CH2, CH2, CH2, CH2, // 0xC0
+    CH2, CH2, CH2, CH2, CH2, CH2, CH2, CH2, CH2, CH2, CH2, CH2, CH2, CH2, CH2, CH2, // 0xD0
+    CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, CH3, // 0xE0
+    SX_, SC2, SC3, SC2, UC_, UC_, SC1, SX_, RT_, UR_, RT_, RT_, RT_, UR_, RT_, RT_, // 0xF0
+};
+
+#undef D__
+#undef CH2
+#undef CH3
+#undef SX_
+#undef SC1
+#undef SC2
+#undef SC3
+#undef RT_
+#undef UR_
+#undef UC_
+
+inline uint8_t rtpMidiOctetInfo(uint8_t octet)
+{
+    return APPLEMIDI_READ_BYTE(&rtpMidiOctetTable[octet]);
+}
+
 END_APPLEMIDI_NAMESPACE
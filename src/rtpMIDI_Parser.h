@@ -12,10 +12,10 @@
 
 BEGIN_APPLEMIDI_NAMESPACE
 
-template <class UdpClass, class Settings, class Platform>
-class AppleMIDISession;
+template <class Settings, class Platform, class Tracer>
+class AppleMIDICore;
 
-template <class UdpClass, class Settings, class Platform>
+template <class Settings, class Platform, class Tracer>
 class rtpMIDIParser
 {
 private:
@@ -28,6 +28,11 @@ private:
     int cmdCount = 0;
     uint8_t runningstatus = 0;
     size_t _bytesToFlush = 0;
+#ifdef USE_SYSEX_STREAMING
+    bool _sysExInSegment = false;   // the SysEx segment continues in the next bytes
+    bool _sysExInMessage = false;   // a segment ended with F0, more segments follow
+    uint8_t _sysExFlags = 0;        // flags of the next chunk
+#endif
 
 protected:
     void debugPrintBuffer(RtpBuffer_t &buffer)
@@ -50,7 +55,28 @@ protected:
     }
 
 public:
-	AppleMIDISession<UdpClass, Settings, Platform> * session;
+	AppleMIDICore<Settings, Platform, Tracer> * session;
+
+    // true while a packet is being parsed, the buffer continues in its middle
+    bool inPacket() const
+    {
+        return _rtpHeadersComplete;
+    }
+
+    // Forget the packet being parsed, the next byte starts a new packet
+    void reset()
+    {
+        _rtpHeadersComplete = false;
+        _journalSectionComplete = false;
+        _channelJournalSectionComplete = false;
+        _journalTotalChannels = 0;
+#ifdef USE_SYSEX_STREAMING
+        // a SysEx that was cut off does not continue in the next packet
+        _sysExInSegment = false;
+        _sysExInMessage = false;
+        _sysExFlags = 0;
+#endif
+    }
     
 	//  Parse the incoming string
 	// return:
@@ -64,8 +90,6 @@ public:
 	{
         debugPrintBuffer(buffer);
 
-		conversionBuffer cb;
-        
         // [RFC3550] provides a complete description of the RTP header fields.
         // In this section, we clarify the role of a few RTP header fields for
         // MIDI applications. All fields are coded in network byte order (big-
@@ -95,23 +119,19 @@ public:
 
             size_t i = 0; // todo: rename to consumed
 
+            // the fixed header, copied out of the ring in one go
+            uint8_t header[sizeof(Rtp_t)];
+            buffer.copy_out(header, sizeof(header));
+
             Rtp_t rtp;
-            rtp.vpxcc    = buffer[i++];
-            rtp.mpayload = buffer[i++];
-            
-            cb.buffer[0] = buffer[i++];
-            cb.buffer[1] = buffer[i++];
-            rtp.sequenceNr = __ntohs(cb.value16);
-            cb.buffer[0] = buffer[i++];
-            cb.buffer[1] = buffer[i++];
-            cb.buffer[2] = buffer[i++];
-            cb.buffer[3] = buffer[i++];
-            rtp.timestamp = __ntohl(cb.value32);
-            cb.buffer[0] = buffer[i++];
-            cb.buffer[1] = buffer[i++];
-            cb.buffer[2] = buffer[i++];
-            cb.buffer[3] = buffer[i++];
-            rtp.ssrc = __ntohl(cb.value32);
+            rtp.vpxcc      = header[i++];
+            rtp.mpayload   = header[i++];
+            rtp.sequenceNr = load_be16(header + i);
+            i += 2;
+            rtp.timestamp  = load_be32(header + i);
+            i += 4;
+            rtp.ssrc       = load_be32(header + i);
+            i += 4;
 
             uint8_t version = RTP_VERSION(rtp.vpxcc);
     #ifdef DEBUG
@@ -135,8 +155,6 @@ public:
                 return parserReturn::UnexpectedData;
             }
 
-            session->ReceivedRtp(rtp);
-
             // Next byte is the flag
             minimumLen += 1;
             if (buffer.size() < minimumLen)
@@ -166,14 +184,19 @@ public:
                 midiCommandLength = (midiCommandLength << 8) | octet;
             }
 
+            // the header is complete: reported once, not again when it is
+            // parsed anew after NotSureGiveMeMoreData. Nothing of a duplicate
+            // is consumed, so the session drops the datagram as a whole.
+            if (!session->ReceivedRtp(rtp))
+                return parserReturn::Processed;
+
             cmdCount = 0;
             runningstatus = 0;
+#ifdef USE_SYSEX_STREAMING
+            _sysExInSegment = false;
+#endif
 
-            while (i > 0)
-            {
-                buffer.pop_front();
-                --i;
-            }
+            buffer.pop_front(i);
             
             _rtpHeadersComplete = true;
                         
@@ -43,6 +43,18 @@ parserReturn decodeMIDICommandSection(RtpBuffer_t &buffer)
     /* Multiple MIDI-commands might follow - the exact number can only be discovered by really decoding the commands! */
     while (midiCommandLength)
     {
+#ifdef USE_SYSEX_STREAMING
+        /* a SysEx segment cut off by the end of the buffer continues here, without delta-time */
+        if (_sysExInSegment)
+        {
+            cmdCount++;
+
+            auto retVal = decodeMidiSysExStream(buffer);
+            if (retVal != parserReturn::Processed) return retVal;
+            continue;
+        }
+#endif
+
         /* for the first command we only have a delta-time if Z-Flag is set */
         if ((cmdCount) || (rtpMidi_Flags & RTP_MIDI_CS_FLAG_Z))
         {
@@ -50,9 +62,10 @@ parserReturn decodeMIDICommandSection(RtpBuffer_t &buffer)
             auto retVal = decodeTime(buffer, consumed);
             if (retVal != parserReturn::Processed) return retVal;
 
+            if (consumed > midiCommandLength) // malformed, do not read past the command section
+                consumed = midiCommandLength;
             midiCommandLength -= consumed;
-            while (consumed--)
-                buffer.pop_front();
+            buffer.pop_front(consumed);
         }
 
         if (midiCommandLength > 0)
@@ -66,9 +79,10 @@ parserReturn decodeMIDICommandSection(RtpBuffer_t &buffer)
                 return retVal;
             }
 
+            if (consumed > midiCommandLength)
+                consumed = midiCommandLength;
             midiCommandLength -= consumed;
-            while (consumed--)
-                buffer.pop_front();
+            buffer.pop_front(consumed);
         }
     }
     
@@ -106,109 +120,64 @@ parserReturn decodeMidi(RtpBuffer_t &buffer, uint8_t &runningstatus, size_t &con
         return parserReturn::NotEnoughData;
 
     auto octet = buffer.front();
+    auto info = rtpMidiOctetInfo(octet);
 
-    /* MIDI realtime-data -> one octet  -- unlike serial-wired MIDI realtime-commands in RTP-MIDI will
-     * not be intermingled with other MIDI-commands, so we handle this case right here and return */
-    if (octet >= 0xf8)
-    {
-        consumed = 1;
-
-        session->StartReceivedMidi();
-        session->ReceivedMidi(octet);
-        session->EndReceivedMidi();
-        
-        return parserReturn::Processed;
-    }
-
-    /* see if this first octet is a status message */
-    if ((octet & RTP_MIDI_COMMAND_STATUS_FLAG) == 0)
+    switch (info & RTP_MIDI_OCTET_CLASS_MASK)
     {
+    case RTP_MIDI_OCTET_DATA:
         /* if we have no running status yet -> error */
         if (((runningstatus)&RTP_MIDI_COMMAND_STATUS_FLAG) == 0)
-        {
             return parserReturn::Processed;
-        }
         /* our first octet is "virtual" coming from a preceding MIDI-command,
          * so actually we have not really consumed anything yet */
-        octet = runningstatus;
-    }
-    else
-    {
-        /* Let's see how this octet influences our running-status */
-        /* if we have a "normal" MIDI-command then the new status replaces the current running-status */
-        if (octet < 0xf0)
-        {
-            runningstatus = octet;
-        }
-        else
-        {
-            /* system-realtime-commands maintain the current running-status
-             * other system-commands clear the running-status, since we
-             * already handled realtime, we can reset it here */
-            runningstatus = 0;
-        }
-        consumed++;
-    }
-
-    /* non-system MIDI-commands encode the command in the high nibble and the channel
-     * in the low nibble - so we will take care of those cases next */
-    if (octet < 0xf0)
-    {      
-        switch (octet & 0xf0)
-        {
-        case MIDI_NAMESPACE::MidiType::NoteOff:
-            consumed += 2;
-            break;
-        case MIDI_NAMESPACE::MidiType::NoteOn:
-            consumed += 2;
-            break;
-        case MIDI_NAMESPACE::MidiType::AfterTouchPoly:
-            consumed += 2;
-            break;
-        case MIDI_NAMESPACE::MidiType::ControlChange:
-            consumed += 2;
-            break;
-        case MIDI_NAMESPACE::MidiType::ProgramChange:
-            consumed += 1;
-            break;
-        case MIDI_NAMESPACE::MidiType::AfterTouchChannel:
-            consumed += 1;
-            break;
-        case MIDI_NAMESPACE::MidiType::PitchBend:
-            consumed += 2;
-            break;
-        }
-
-        if (buffer.size() < consumed) {
-            return parserReturn::NotEnoughData;
-        }
-
-        session->StartReceivedMidi();
-        for (size_t j = 0; j < consumed; j++)
-            session->ReceivedMidi(buffer[j]);
-        session->EndReceivedMidi();
-        
-        return parserReturn::Processed;
-    }
-
-    /* Here we catch the remaining system-common commands */
-    switch (octet)
-    {
-    case MIDI_NAMESPACE::MidiType::SystemExclusiveStart:
-    case MIDI_NAMESPACE::MidiType::SystemExclusiveEnd:
-        decodeMidiSysEx(buffer, consumed);
+        consumed = (rtpMidiOctetInfo(runningstatus) & RTP_MIDI_OCTET_LENGTH_MASK) - 1;
         break;
-    case MIDI_NAMESPACE::MidiType::TimeCodeQuarterFrame:
-        consumed += 1;
+    case RTP_MIDI_OCTET_CHANNEL:
+        /* a "normal" MIDI-command, the new status replaces the current running-status */
+        runningstatus = octet;
+        consumed = info & RTP_MIDI_OCTET_LENGTH_MASK;
         break;
-    case MIDI_NAMESPACE::MidiType::SongPosition:
-        consumed += 2;
+    case RTP_MIDI_OCTET_REALTIME:
+        /* MIDI realtime-data -> one octet  -- unlike serial-wired MIDI realtime-commands in RTP-MIDI will
+         * not be intermingled with other MIDI-commands. System-realtime-commands maintain the current running-status */
+        consumed = 1;
         break;
-    case MIDI_NAMESPACE::MidiType::SongSelect:
-        consumed += 1;
+    case RTP_MIDI_OCTET_SYSEX:
+        runningstatus = 0;
+#ifdef USE_SYSEX_STREAMING
+        /* consumes from the buffer itself */
+        return decodeMidiSysExStream(buffer);
+#else
+        consumed = 1;
+        /* a split SysEx has been handed over and consumed in part, wait for the rest */
+        if (decodeMidiSysEx(buffer, consumed) == parserReturn::NotEnoughData)
+            return parserReturn::NotEnoughData;
         break;
-    case MIDI_NAMESPACE::MidiType::TuneRequest:
+#endif
+    case RTP_MIDI_OCTET_COMMON:
+        /* other system-commands clear the running-status */
+        runningstatus = 0;
+        consumed = info & RTP_MIDI_OCTET_LENGTH_MASK;
         break;
+    case RTP_MIDI_OCTET_UNDEFINED_COMMON:
+        /* undefined system-common (0xF4, 0xF5) are coded like SysEx in the MIDI list
+         * (https://www.ietf.org/rfc/rfc6295.html#section-3.2), skip up to and including the 0xF7 */
+        runningstatus = 0;
+        consumed = 1;
+        while (consumed < buffer.size() && consumed < midiCommandLength)
+        {
+            auto data = buffer[consumed];
+            if (data == MIDI_NAMESPACE::MidiType::SystemExclusiveEnd)
+                consumed++;
+            if (data & RTP_MIDI_COMMAND_STATUS_FLAG)
+                break;
+            consumed++;
+        }
+        return parserReturn::Processed;
+    default:
+        /* undefined system-realtime (0xF9, 0xFD), skipped */
+        consumed = 1;
+        return parserReturn::Processed;
     }
 
     if (buffer.size() < consumed)
@@ -264,16 +233,89 @@ parserReturn decodeMidiSysEx(RtpBuffer_t &buffer, size_t &consumed)
     session->EndReceivedMidi();
 
     // Remove the bytes that were submitted
-    for (size_t j = 0; j < consumed; j++)
-        buffer.pop_front();
+    buffer.pop_front(consumed);
     // Start a new SysEx train
     buffer.push_front(MIDI_NAMESPACE::MidiType::SystemExclusiveEnd);
 
     midiCommandLength -= consumed;
     midiCommandLength += 1; // for adding the manual SysEx SystemExclusiveEnd in front
 
-    // indicates split SysEx
-    consumed = buffer.max_size() + 1;
+    // nothing more for the caller to consume, the SysEx continues in the next data
+    consumed = 0;
 
-    return parserReturn::Processed;
+    return parserReturn::NotEnoughData;
+}
+
+#ifdef USE_SYSEX_STREAMING
+// Hand the SysEx segment at the front of the buffer to the session in chunks,
+// straight out of the buffer. Segments are coded (https://www.ietf.org/rfc/rfc6295.html#section-3.2)
+// F0..F7 (complete), F0..F0 (first), F7..F0 (middle), F7..F7 (last) and F0/F7..F4 (cancelled).
+// A segment cut off by the end of the buffer is consumed, and continued on the next call.
+parserReturn decodeMidiSysExStream(RtpBuffer_t &buffer)
+{
+    debugPrintBuffer(buffer);
+
+    size_t start = 0;
+    if (!_sysExInSegment)
+    {
+        // F0 starts a new message, F7 continues the message in progress
+        if (buffer.front() == MIDI_NAMESPACE::MidiType::SystemExclusiveStart || !_sysExInMessage)
+            _sysExFlags = SysExFirstChunk;
+        _sysExInMessage = true;
+        start = 1;
+    }
+
+    size_t end = start;
+    while (end < buffer.size() && end < midiCommandLength && (buffer[end] & RTP_MIDI_COMMAND_STATUS_FLAG) == 0)
+        end++;
+
+    auto flags = _sysExFlags;
+    auto consumed = end;
+    auto cutOff = (end == buffer.size() && end < midiCommandLength);
+    if (!cutOff)
+    {
+        auto octet = (end < midiCommandLength) ? buffer[end] : 0;
+        if (octet == MIDI_NAMESPACE::MidiType::SystemExclusiveStart)
+        {
+            consumed++; // more segments follow
+        }
+        else
+        {
+            if (octet == MIDI_NAMESPACE::MidiType::SystemExclusiveEnd)
+                consumed++;
+            else if (octet == 0xF4)
+            {
+                consumed++;
+                flags |= SysExCancelled;
+            }
+            // any other status octet (or the end of the command section) ends the message as well
+            flags |= SysExLastChunk;
+            _sysExInMessage = false;
+        }
+    }
+
+    // one chunk, or two when the data wraps around in the buffer
+    auto index = start;
+    while (index < end || (flags & SysExLastChunk))
+    {
+        const byte *data = nullptr;
+        auto length = buffer.contiguous(index, data);
+        if (length > end - index)
+            length = end - index;
+        index += length;
+
+        session->ReceivedSysExChunk(data, length, (index == end) ? flags : (flags & SysExFirstChunk));
+        if (index == end)
+            break;
+        flags &= ~SysExFirstChunk;
+    }
+    if (end > start)
+        _sysExFlags = 0;
+
+    buffer.pop_front(consumed);
+    midiCommandLength -= consumed;
+
+    _sysExInSegment = cutOff;
+    return cutOff ? parserReturn::NotEnoughData : parserReturn::Processed;
 }
+#endif
@@ -21,8 +21,6 @@ parserReturn decodeJournalSection(RtpBuffer_t &buffer)
 {
     size_t minimumLen = 0;
 
-    conversionBuffer cb;
-
     if (false == _journalSectionComplete)
     {
         size_t i = 0;
@@ -46,9 +44,8 @@ parserReturn decodeJournalSection(RtpBuffer_t &buffer)
         // event if the Checkpoint Packet Seqnum field is less than or equal to
         // one plus the highest RTP sequence number previously received on the
         // stream (modulo 2^16).
-        cb.buffer[0] = buffer[i++];
-        cb.buffer[1] = buffer[i++];
-        //    uint16_t checkPoint = __ntohs(cb.value16); ; // unused
+        //    uint16_t checkPoint = ((uint16_t)buffer[i] << 8) | buffer[i + 1]; // unused
+        i += 2;
 
         // (RFC 4695, 5 Recovery Journal Format)
         // If A and Y are both zero, the recovery journal only contains its 3-
@@ -56,8 +53,7 @@ parserReturn decodeJournalSection(RtpBuffer_t &buffer)
         if ((flags & RTP_MIDI_JS_FLAG_Y) == 0 && (flags & RTP_MIDI_JS_FLAG_A) == 0)
         {
             // Big fixed by @hugbug
-            while (minimumLen-- > 0)
-                buffer.pop_front();
+            buffer.pop_front(minimumLen);
 
             _journalSectionComplete = true;
             return parserReturn::Processed;
@@ -91,9 +87,8 @@ parserReturn decodeJournalSection(RtpBuffer_t &buffer)
                 return parserReturn::NotEnoughData;
             }
 
-            cb.buffer[0] = buffer[i++];
-            cb.buffer[1] = buffer[i++];
-            uint16_t systemflags = __ntohs(cb.value16);
+            uint16_t systemflags = ((uint16_t)buffer[i] << 8) | buffer[i + 1];
+            i += 2;
             uint16_t sysjourlen = systemflags & RTP_MIDI_SJ_MASK_LENGTH;
 
             uint16_t remainingBytes = sysjourlen - 2;
@@ -116,8 +111,7 @@ parserReturn decodeJournalSection(RtpBuffer_t &buffer)
             _journalTotalChannels = (flags & RTP_MIDI_JS_MASK_TOTALCHANNELS) + 1;
         }
 
-        while (i-- > 0) // is that the same as while (i--) ??
-            buffer.pop_front();
+        buffer.pop_front(i);
 
         _journalSectionComplete = true;
     }
@@ -131,11 +125,7 @@ parserReturn decodeJournalSection(RtpBuffer_t &buffer)
                 return parserReturn::NotEnoughData;
 
             // 3 bytes for channel journal
-            cb.buffer[0] = 0x00;
-            cb.buffer[1] = buffer[0];
-            cb.buffer[2] = buffer[1];
-            cb.buffer[3] = buffer[2];
-            uint32_t chanflags = __ntohl(cb.value32);
+            uint32_t chanflags = ((uint32_t)buffer[0] << 16) | ((uint32_t)buffer[1] << 8) | buffer[2];
 
             bool S_flag         = (chanflags & RTP_MIDI_CJ_FLAG_S) == 1;
             uint8_t channelNr   = (chanflags & RTP_MIDI_CJ_MASK_CHANNEL) >> RTP_MIDI_CJ_CHANNEL_SHIFT; 
@@ -164,10 +154,9 @@ parserReturn decodeJournalSection(RtpBuffer_t &buffer)
             _channelJournalSectionComplete = true;
         }
 
-        while (buffer.size() > 0 && _bytesToFlush > 0) {
-            _bytesToFlush--;
-            buffer.pop_front();
-        }
+        const size_t flushed = (_bytesToFlush < buffer.size()) ? _bytesToFlush : buffer.size();
+        buffer.pop_front(flushed);
+        _bytesToFlush -= flushed;
 
         if (_bytesToFlush > 0) {
             return parserReturn::NotEnoughData;
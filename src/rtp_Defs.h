@@ -43,6 +43,11 @@ other than 0! */
 /* Payload type is the last 7 bits */
 #define RTP_PAYLOAD_TYPE(octet) ((octet)&RTP_PT_FIELD)
 
+/* Offsets of the fields in the 12-byte header */
+#define RTP_SEQUENCE_NR_OFFSET 2
+#define RTP_TIMESTAMP_OFFSET 4
+#define RTP_SSRC_OFFSET 8
+
 typedef struct PACKED Rtp
 {
 	uint8_t vpxcc;
@@ -30,7 +30,11 @@ public:
     size_t push_back(const T *, size_t);
     size_t copy_out(T *, size_t) const;
     void pop_front();
+    void pop_front(size_t);
     void pop_back();
+    size_t contiguous(size_t, const T *&) const;
+    size_t free_contiguous(T *&);
+    void commit_back(size_t);
     
     T& operator[](size_t);
     const T& operator[](size_t) const;
@@ -196,6 +200,16 @@ void Deque<T, Size>::pop_front() {
         clear();
 }
 
+template<typename T, size_t Size>
+void Deque<T, Size>::pop_front(size_t count) {
+    if (count >= size()) // everything, or more
+    {
+        clear();
+        return;
+    }
+    _tail = (_tail + count) % Size;
+}
+
 template<typename T, size_t Size>
 void Deque<T, Size>::pop_back() {
     if (empty()) // if empty, do nothing.
@@ -206,6 +220,46 @@ void Deque<T, Size>::pop_back() {
         clear();
 }
 
+// Points data at the element at index, returns the number of elements
+// that can be read from there without wrapping around.
+template<typename T, size_t Size>
+size_t Deque<T, Size>::contiguous(size_t index, const T *&data) const
+{
+    if (index >= size())
+        return 0;
+
+    const size_t start = (_tail + index) % Size;
+    data = &_data[start];
+
+    const size_t count = size() - index;
+    return (start + count > Size) ? Size - start : count;
+}
+
+// Points data at the first free element after the back, returns the number
+// of elements that can be written there without wrapping around. Make them
+// part of the deque with commit_back().
+template<typename T, size_t Size>
+size_t Deque<T, Size>::free_contiguous(T *&data)
+{
+    data = &_data[_head];
+
+    if (empty() || _head > _tail)
+        return Size - _head;
+    return _tail - _head; // 0 when full
+}
+
+// Appends the count elements written at the pointer from free_contiguous()
+template<typename T, size_t Size>
+void Deque<T, Size>::commit_back(size_t count)
+{
+    if (count == 0)
+        return;
+
+    if (empty())
+        _tail = _head;
+    _head = (_head + count) % Size;
+}
+
 template<typename T, size_t Size>
 void Deque<T, Size>::erase(size_t position) {
     if (position >= size()) // out-of-range!
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+BEGIN_APPLEMIDI_NAMESPACE
+
+// Fixed-size log-linear histogram (HdrHistogram style, 4 sub-buckets per
+// power of two). Values 0..3 are exact, above that each bucket spans
+// 1/4 of its octave, so a reported percentile is at most 25% too high.
+// Values beyond the last bucket (131071) are clamped into it.
+//
+// 64 buckets of 16-bit counters: 128 bytes. When a counter would overflow,
+// all counters are halved, so the shape of the distribution is kept and
+// older samples slowly age out.
+class Histogram
+{
+public:
+    static const uint8_t NumberOfBuckets = 64;
+
+    Histogram()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        memset(_counts, 0, sizeof(_counts));
+    }
+
+    void record(uint32_t value)
+    {
+        auto bucket = bucketOf(value);
+
+        if (_counts[bucket] == UINT16_MAX)
+            for (uint8_t i = 0; i < NumberOfBuckets; i++)
+                _counts[i] >>= 1;
+
+        _counts[bucket]++;
+    }
+
+    uint32_t count() const
+    {
+        uint32_t total = 0;
+        for (uint8_t i = 0; i < NumberOfBuckets; i++)
+            total += _counts[i];
+        return total;
+    }
+
+    // Returns the upper bound of the bucket holding the given percentile,
+    // expressed in parts per thousand (500 = p50, 990 = p99, 999 = p99.9).
+    // Returns 0 when nothing has been recorded.
+    uint32_t valueAtPermille(uint16_t permille) const
+    {
+        auto total = count();
+        if (total == 0)
+            return 0;
+
+        // rank of the requested sample, rounded up (1-based)
+        auto rank = (total * permille + 999) / 1000;
+        if (rank == 0)
+            rank = 1;
+
+        uint32_t running = 0;
+        for (uint8_t i = 0; i < NumberOfBuckets; i++)
+        {
+            running += _counts[i];
+            if (running >= rank)
+                return upperBoundOf(i);
+        }
+        return upperBoundOf(NumberOfBuckets - 1);
+    }
+
+    uint32_t p50()  const { return valueAtPermille(500); }
+    uint32_t p99()  const { return valueAtPermille(990); }
+    uint32_t p999() const { return valueAtPermille(999); }
+
+    uint16_t bucketCount(uint8_t bucket) const { return _counts[bucket]; }
+
+    static uint8_t bucketOf(uint32_t value)
+    {
+        if (value < 4)
+            return (uint8_t)value;
+
+        uint8_t shift = 0;
+        while (value >= 8)
+        {
+            value >>= 1;
+            shift++;
+        }
+
+        auto bucket = 4 * (shift + 1) + (value - 4);
+        return (bucket < NumberOfBuckets) ? (uint8_t)bucket : NumberOfBuckets - 1;
+    }
+
+    static uint32_t lowerBoundOf(uint8_t bucket)
+    {
+        if (bucket < 4)
+            return bucket;
+        return (uint32_t)(4 + bucket % 4) << (bucket / 4 - 1);
+    }
+
+    static uint32_t upperBoundOf(uint8_t bucket)
+    {
+        if (bucket < 4)
+            return bucket;
+        return lowerBoundOf(bucket) + ((uint32_t)1 << (bucket / 4 - 1)) - 1;
+    }
+
+private:
+    uint16_t _counts[NumberOfBuckets];
+};
+
+END_APPLEMIDI_NAMESPACE
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+BEGIN_APPLEMIDI_NAMESPACE
+
+// One piece of a datagram for a gathered send. Same layout as struct iovec
+// (base pointer, then length), so a POSIX transport can hand an array of
+// them to sendmsg/writev as is.
+struct UdpSegment
+{
+    const uint8_t *data;
+    size_t size;
+};
+
+// Optional transport capability: a UdpClass with
+//
+//     int sendPacket(const IPAddress &, uint16_t port, const UdpSegment *, size_t count);
+//
+// sends a complete datagram from the given segments in one call (return 1 on
+// success, 0 on failure, like endPacket). Without it, the session falls back
+// to beginPacket, one write per segment and endPacket.
+template <class UdpClass>
+class HasSendPacket
+{
+    template <class T>
+    static T &instance();
+
+    template <class T, class = decltype(instance<T>().sendPacket(instance<const IPAddress>(), (uint16_t)0, (const UdpSegment *)nullptr, (size_t)0))>
+    static char test(int);
+
+    template <class T>
+    static long test(...);
+
+public:
+    static constexpr bool value = (sizeof(test<UdpClass>(0)) == sizeof(char));
+};
+
+template <bool>
+struct GatherTag
+{
+};
+
+END_APPLEMIDI_NAMESPACE
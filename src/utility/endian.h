@@ -5,16 +5,14 @@
     #define _BIG_ENDIAN 4321
     #define _LITTLE_ENDIAN 1234
 
-    #define TEST_LITTLE_ENDIAN (((union { unsigned x; unsigned char c; }){1}).c)
-
-    #ifdef TEST_LITTLE_ENDIAN
-    #define _BYTE_ORDER _LITTLE_ENDIAN
-    #else
+    // byte order as seen by the compiler. All Arduino targets are little-endian,
+    // so that is the fallback when the compiler does not tell.
+    #if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
     #define _BYTE_ORDER _BIG_ENDIAN
+    #else
+    #define _BYTE_ORDER _LITTLE_ENDIAN
     #endif
 
-    #undef TEST_LITTLE_ENDIAN
-
     #include <stdint.h>
 
     #ifdef __GNUC__
@@ -76,3 +74,49 @@
 #define __htonll(x) ((uint64_t)(x))
 #endif
 #endif /* __machine_host_to_from_network_defined */
+
+#include <stdint.h>
+#include <string.h>
+
+// Network (big-endian) order loads and stores on a byte pointer, no alignment
+// required. memcpy of a fixed size compiles to a single (unaligned) load or
+// store, followed by a byte swap on little-endian targets.
+
+static inline uint16_t load_be16(const uint8_t *p)
+{
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return __ntohs(value);
+}
+
+static inline uint32_t load_be32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return __ntohl(value);
+}
+
+static inline uint64_t load_be64(const uint8_t *p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return __ntohll(value);
+}
+
+static inline void store_be16(uint8_t *p, uint16_t value)
+{
+    value = __htons(value);
+    memcpy(p, &value, sizeof(value));
+}
+
+static inline void store_be32(uint8_t *p, uint32_t value)
+{
+    value = __htonl(value);
+    memcpy(p, &value, sizeof(value));
+}
+
+static inline void store_be64(uint8_t *p, uint64_t value)
+{
+    value = __htonll(value);
+    memcpy(p, &value, sizeof(value));
+}
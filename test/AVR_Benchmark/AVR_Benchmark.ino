@@ -0,0 +1,229 @@
+// Cycle counts of the protocol engine, for the boards where they matter.
+//
+// The session (with the settings of examples/AVR_MinMemUsage) runs on top of
+// LoopbackUDP: the sketch plays the remote initiator by handing it datagrams,
+// and measures the cycles spent in the session for
+//  - an invitation (IN on the control port and on the data port, both answered with OK)
+//  - a CK exchange (CK0 answered with CK1, then CK2)
+//  - a received note (an RTP-MIDI packet with one NoteOn, read with MIDI.read())
+//  - a sent note (MIDI.sendNoteOn() and the MIDI.read() that flushes it)
+// followed by the static RAM and the peak stack. The results are printed on
+// Serial, after which the CPU goes to sleep with interrupts off, which ends a
+// simavr run (see ci/bench-avr.sh).
+//
+// Cycles come from Timer1 running at the CPU clock, the Timer0 (millis)
+// interrupt is left running and is included, as it would be in a sketch.
+// On other boards, the counter falls back to micros().
+
+#define ONE_PARTICIPANT
+#define NO_SESSION_NAME
+#include <AppleMIDI.h>
+
+#include "LoopbackUDP.h"
+
+#if defined(__AVR__)
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#endif
+
+APPLEMIDI_CREATE_INSTANCE(LoopbackUDP, MIDI, "Benchmark", DEFAULT_CONTROL_PORT);
+
+static const uint16_t controlPort = DEFAULT_CONTROL_PORT;
+static const uint16_t dataPort = DEFAULT_CONTROL_PORT + 1;
+
+static const uint8_t Repeat = 16;
+
+// The remote initiator: SSRC 0x11223344, initiator token 0x55667788
+static const uint8_t invitation[] = {
+    0xff, 0xff, 'I', 'N', 0x00, 0x00, 0x00, 0x02,
+    0x55, 0x66, 0x77, 0x88, 0x11, 0x22, 0x33, 0x44,
+};
+
+static uint8_t synchronization[] = {
+    0xff, 0xff, 'C', 'K', 0x11, 0x22, 0x33, 0x44,
+    0x00, 0x00, 0x00, 0x00,                         // count, padding
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, // timestamp 1
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // timestamp 2
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // timestamp 3
+};
+
+static uint8_t noteOn[] = {
+    0x80, 0x61, 0x00, 0x00,                         // RTP version 2, payload type 97, sequence number
+    0x00, 0x00, 0x00, 0x00,                         // timestamp
+    0x11, 0x22, 0x33, 0x44,                         // SSRC
+    0x03, 0x90, 0x3c, 0x64,                         // short header, NoteOn
+};
+
+#if defined(__AVR__)
+static volatile uint16_t timer1Overflows = 0;
+
+ISR(TIMER1_OVF_vect)
+{
+    timer1Overflows++;
+}
+
+static void startCycleCounter()
+{
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10); // no prescaler
+    TCNT1 = 0;
+    TIFR1 = _BV(TOV1);
+    TIMSK1 = _BV(TOIE1);
+}
+
+static uint32_t cycles()
+{
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t low = TCNT1;
+    uint16_t high = timer1Overflows;
+    // an overflow that is not serviced yet
+    if ((TIFR1 & _BV(TOV1)) && low < 0x8000)
+        high++;
+    SREG = sreg;
+    return ((uint32_t)high << 16) | low;
+}
+
+// The stack grows down from RAMEND towards the heap, that is empty (nothing is
+// allocated). Paint it, the lowest address that changed is the peak.
+extern uint8_t __heap_start;
+static const uint8_t StackPaint = 0xc5;
+
+static void paintStack()
+{
+    uint8_t here;
+    for (uint8_t *p = &__heap_start; p < &here - 16; p++)
+        *p = StackPaint;
+}
+
+static size_t peakStack()
+{
+    const uint8_t *p = &__heap_start;
+    while (p <= (const uint8_t *)RAMEND && *p == StackPaint)
+        p++;
+    return (const uint8_t *)RAMEND + 1 - p;
+}
+
+static size_t staticRam()
+{
+    return (size_t)&__heap_start - RAMSTART;
+}
+#else
+static void startCycleCounter() {}
+static uint32_t cycles() { return micros(); }
+static void paintStack() {}
+static size_t peakStack() { return 0; }
+static size_t staticRam() { return 0; }
+#endif
+
+static uint32_t overhead = 0;
+
+static uint32_t elapsedSince(uint32_t start)
+{
+    auto elapsed = cycles() - start;
+    return (elapsed > overhead) ? elapsed - overhead : 0;
+}
+
+// name is an F() string
+template <class Name>
+static void report(Name name, uint32_t total, uint8_t count)
+{
+    Serial.print(name);
+    Serial.print(F(": "));
+    Serial.print((unsigned long)(total / count));
+    Serial.println(F(" cycles"));
+}
+
+static bool readMessage = false;
+
+// Cycles for one available()/parse round of the session, after delivering a datagram
+static uint32_t deliverAndRead(uint16_t port, const uint8_t *data, uint8_t size)
+{
+    LoopbackUDP::deliver(port, data, size);
+    auto start = cycles();
+    readMessage = MIDI.read();
+    return elapsedSince(start);
+}
+
+static bool lastSentIs(char c0, char c1)
+{
+    return LoopbackUDP::lastSent[2] == c0 && LoopbackUDP::lastSent[3] == c1;
+}
+
+void setup()
+{
+    paintStack();
+
+    Serial.begin(115200);
+    startCycleCounter();
+
+    auto start = cycles();
+    overhead = cycles() - start;
+
+    MIDI.begin();
+
+    // invitation, on the control port and on the data port
+    uint32_t total = deliverAndRead(controlPort, invitation, sizeof(invitation));
+    total += deliverAndRead(dataPort, invitation, sizeof(invitation));
+    if (!lastSentIs('O', 'K'))
+        Serial.println(F("invitation not accepted"));
+    report(F("invitation"), total, 1);
+
+    // CK0 from the initiator, answered with CK1, then CK2
+    total = 0;
+    for (uint8_t i = 0; i < Repeat; i++)
+    {
+        synchronization[8] = 0;
+        total += deliverAndRead(dataPort, synchronization, sizeof(synchronization));
+        if (!lastSentIs('C', 'K'))
+            Serial.println(F("CK1 not sent"));
+        synchronization[8] = 2;
+        total += deliverAndRead(dataPort, synchronization, sizeof(synchronization));
+    }
+    report(F("CK exchange"), total, Repeat);
+
+    // received note
+    total = 0;
+    for (uint8_t i = 0; i < Repeat; i++)
+    {
+        noteOn[3] = i + 1; // sequence number
+        total += deliverAndRead(dataPort, noteOn, sizeof(noteOn));
+        if (!readMessage)
+            Serial.println(F("note not received"));
+    }
+    report(F("received note"), total, Repeat);
+
+    // sent note, queued and flushed at the start of the next read
+    total = 0;
+    auto sent = LoopbackUDP::sent;
+    for (uint8_t i = 0; i < Repeat; i++)
+    {
+        start = cycles();
+        MIDI.sendNoteOn(60, 100, 1);
+        MIDI.read();
+        total += elapsedSince(start);
+    }
+    if (LoopbackUDP::sent - sent < Repeat)
+        Serial.println(F("notes not sent"));
+    report(F("sent note"), total, Repeat);
+
+    Serial.print(F("static RAM: "));
+    Serial.print((unsigned long)staticRam());
+    Serial.println(F(" bytes"));
+    Serial.print(F("peak stack: "));
+    Serial.print((unsigned long)peakStack());
+    Serial.println(F(" bytes"));
+    Serial.flush();
+
+#if defined(__AVR__)
+    // simavr stops here
+    cli();
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    sleep_enable();
+    sleep_cpu();
+#endif
+}
+
+void loop()
+{
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <IPAddress.h>
+
+// UdpClass for the benchmark: no network, datagrams are handed to a socket
+// with deliver(), and what the session sends is counted (and the start of the
+// last datagram kept, to check the replies). One receive slot per socket, as
+// the benchmark delivers one datagram at a time.
+class LoopbackUDP
+{
+public:
+    static const uint8_t MaxDatagramSize = 64;
+    static const uint8_t MaxSockets = 2;
+
+    uint8_t begin(uint16_t port)
+    {
+        _port = port;
+        for (uint8_t i = 0; i < MaxSockets; i++)
+            if (nullptr == _sockets[i])
+            {
+                _sockets[i] = this;
+                return 1;
+            }
+        return 0;
+    }
+
+    void stop()
+    {
+        for (uint8_t i = 0; i < MaxSockets; i++)
+            if (this == _sockets[i])
+                _sockets[i] = nullptr;
+    }
+
+    int beginPacket(IPAddress, uint16_t)
+    {
+        _txSize = 0;
+        return 1;
+    }
+
+    size_t write(uint8_t value)
+    {
+        return write(&value, 1);
+    }
+
+    size_t write(const uint8_t *buffer, size_t size)
+    {
+        for (size_t i = 0; i < size; i++, _txSize++)
+            if (_txSize < sizeof(lastSent))
+                lastSent[_txSize] = buffer[i];
+        return size;
+    }
+
+    int endPacket()
+    {
+        sent++;
+        return 1;
+    }
+
+    void flush() {}
+
+    int parsePacket()
+    {
+        _rxPosition = 0;
+        _rxSize = _pending;
+        _pending = 0;
+        return _rxSize;
+    }
+
+    int available()
+    {
+        return _rxSize - _rxPosition;
+    }
+
+    int read()
+    {
+        return (_rxPosition < _rxSize) ? _rx[_rxPosition++] : -1;
+    }
+
+    int read(uint8_t *buffer, size_t size)
+    {
+        size_t n = 0;
+        while (n < size && _rxPosition < _rxSize)
+            buffer[n++] = _rx[_rxPosition++];
+        return (int)n;
+    }
+
+    IPAddress remoteIP() { return IPAddress(10, 0, 0, 2); }
+    uint16_t remotePort() { return _port; } // the peer uses the same port numbers
+
+    // Hand a datagram to the socket bound to port, it is returned by the next parsePacket()
+    static bool deliver(uint16_t port, const uint8_t *data, uint8_t size)
+    {
+        for (uint8_t i = 0; i < MaxSockets; i++)
+        {
+            auto socket = _sockets[i];
+            if (nullptr != socket && socket->_port == port && size <= MaxDatagramSize)
+            {
+                for (uint8_t j = 0; j < size; j++)
+                    socket->_rx[j] = data[j];
+                socket->_pending = size;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static uint16_t sent;
+    static uint8_t lastSent[16];
+
+private:
+    static LoopbackUDP *_sockets[MaxSockets];
+
+    uint16_t _port = 0;
+    uint8_t _rx[MaxDatagramSize];
+    uint8_t _rxSize = 0;
+    uint8_t _rxPosition = 0;
+    uint8_t _pending = 0;
+    uint8_t _txSize = 0;
+};
+
+uint16_t LoopbackUDP::sent = 0;
+uint8_t LoopbackUDP::lastSent[16];
+LoopbackUDP *LoopbackUDP::_sockets[LoopbackUDP::MaxSockets];
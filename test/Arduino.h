@@ -43,6 +43,8 @@ typedef uint8_t byte;
 void begin();
 void loop();
 
+// Define NO_ARDUINO_MAIN when the test provides its own main() (see Simulator.cpp)
+#ifndef NO_ARDUINO_MAIN
 int main()
 {
 	begin();
@@ -52,13 +54,18 @@ int main()
 		loop();
 	}
 }
+#endif
 
 // avoid strncpy security warning
 #pragma warning(disable:4996)
 
+#ifdef _MSC_VER
 #define __attribute__(A) /* do nothing */
+#endif
 
+#include "../src/AppleMIDI_Namespace.h"
 #include "../src/utility/Deque.h"
+USING_NAMESPACE_APPLEMIDI
 
 #include <midi_Defs.h>
 
@@ -67,6 +74,26 @@ float analogRead(int pin)
 	return 0.0f;
 }
 
+#ifdef SIMULATED_CLOCK
+// Virtual time in microseconds, advanced by the test (see NetworkSimulator.h).
+// Runs are reproducible: the random generator is seeded with the virtual time.
+uint64_t simulatedMicros = 0;
+
+void randomSeed(unsigned long seed)
+{
+    srand(static_cast<unsigned int>(seed));
+}
+
+unsigned long millis()
+{
+    return (unsigned long)(simulatedMicros / 1000);
+}
+
+unsigned long micros()
+{
+    return (unsigned long)simulatedMicros;
+}
+#else
 void randomSeed(float)
 {
     srand(static_cast<unsigned int>(time(0)));
@@ -78,9 +105,16 @@ unsigned long millis()
     return (unsigned long)now;
 }
 
+unsigned long micros()
+{
+    auto now = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    return (unsigned long)now;
+}
+#endif
+
 int random(int min, int max)
 {
-	return RAND_MAX % std::rand() % (max-min) + min;
+	return std::rand() % (max - min) + min;
 }
 
 template <class T> const T& min(const T& a, const T& b) {
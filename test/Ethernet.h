@@ -386,7 +386,7 @@ public:
         _buffer.push_back(buffer);
     };
 
-    void write(uint8_t* buffer, size_t size)
+    void write(const uint8_t *buffer, size_t size)
     {
         for (size_t i = 0; i < size; i++)
             _buffer.push_back(buffer[i]);
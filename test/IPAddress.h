@@ -1,17 +1,33 @@
 #pragma once
 
+#include <stdint.h>
+#include <string.h>
+
 class IPAddress
 {
+    uint8_t _address[4];
+
 public:
-    IPAddress(){};
-    IPAddress(const IPAddress& from){};
-    IPAddress(uint8_t first_octet, uint8_t second_octet, uint8_t third_octet, uint8_t fourth_octet){};
-    IPAddress(uint32_t address) { }
-    IPAddress(int address) { }
-    IPAddress(const uint8_t *address) {};
+    IPAddress() { memset(_address, 0, sizeof(_address)); };
+    IPAddress(const IPAddress& from) { memcpy(_address, from._address, sizeof(_address)); };
+    IPAddress(uint8_t first_octet, uint8_t second_octet, uint8_t third_octet, uint8_t fourth_octet)
+    {
+        _address[0] = first_octet;
+        _address[1] = second_octet;
+        _address[2] = third_octet;
+        _address[3] = fourth_octet;
+    };
+    IPAddress(uint32_t address) { memcpy(_address, &address, sizeof(_address)); }
+    IPAddress(int address) : IPAddress((uint32_t)address) { }
+    IPAddress(const uint8_t *address) { memcpy(_address, address, sizeof(_address)); };
+
+    IPAddress& operator=(const IPAddress& from) { memcpy(_address, from._address, sizeof(_address)); return *this; }
+
+    operator uint32_t() const { uint32_t address; memcpy(&address, _address, sizeof(address)); return address; }
+    uint8_t operator[](int index) const { return _address[index]; }
 
-    bool operator==(const IPAddress&) const { return true; }
-    bool operator!=(const IPAddress&) const { return true; }
+    bool operator==(const IPAddress& other) const { return memcmp(_address, other._address, sizeof(_address)) == 0; }
+    bool operator!=(const IPAddress& other) const { return !(*this == other); }
 };
 
-const IPAddress INADDR_NONE(0, 0, 0, 0);
\ No newline at end of file
+const IPAddress INADDR_NONE(0, 0, 0, 0);
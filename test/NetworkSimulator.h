@@ -0,0 +1,357 @@
+#pragma once
+
+// In-process UDP fabric, so that two or more AppleMIDISession instances can
+// talk to each other over simulated links with loss, duplication, reordering,
+// latency and limited bandwidth. Time is virtual (millis() and micros() return
+// simulatedMicros, see Arduino.h), and all randomness comes from a seeded
+// generator, so a run is reproducible and runs as fast as the CPU allows.
+//
+// Usage:
+//     #define SIMULATED_CLOCK
+//     #define NO_ARDUINO_MAIN
+//     #include "NetworkSimulator.h"
+//
+//     SimNetwork network(seed);
+//     AppleMIDISession<SimUDP> a("A"), b("B");
+//     network.attach(IPAddress(10, 0, 0, 1)); a.begin(); // sockets opened in begin()
+//     network.attach(IPAddress(10, 0, 0, 2)); b.begin(); // are bound to the attached host
+//     network.setLink(profile);
+//     while (...) { a.available(); b.available(); network.advance(1000); }
+
+#ifndef SIMULATED_CLOCK
+#error "define SIMULATED_CLOCK before including NetworkSimulator.h"
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <map>
+#include <queue>
+#include <deque>
+#include <vector>
+
+#include "Arduino.h"
+
+// Properties of a one-way link
+struct LinkProfile
+{
+    uint32_t latency = 1000;        // us
+    uint32_t jitter = 0;            // us, uniformly distributed, added to the latency
+    uint16_t loss = 0;              // per mille
+    uint16_t duplicate = 0;         // per mille
+    uint16_t reorder = 0;           // per mille, the datagram is held back for reorderDelay
+    uint32_t reorderDelay = 10000;  // us
+    uint32_t bandwidth = 0;         // bytes per second, 0 is unlimited
+};
+
+struct SimStatistics
+{
+    uint32_t sent = 0;
+    uint32_t delivered = 0;
+    uint32_t lost = 0;
+    uint32_t duplicated = 0;
+    uint32_t reordered = 0;
+    uint32_t unreachable = 0;       // no socket bound on the destination
+    uint64_t bytes = 0;
+};
+
+class SimUDP;
+
+class SimNetwork
+{
+public:
+    struct Datagram
+    {
+        uint32_t srcIP = 0;
+        uint16_t srcPort = 0;
+        uint32_t dstIP = 0;
+        uint16_t dstPort = 0;
+        std::vector<uint8_t> data;
+    };
+
+    explicit SimNetwork(uint32_t seed = 1)
+    {
+        _state = (seed == 0) ? 1 : seed;
+        _current = this;
+        simulatedMicros = 0;
+    }
+
+    ~SimNetwork()
+    {
+        if (_current == this)
+            _current = nullptr;
+    }
+
+    static SimNetwork *current() { return _current; }
+
+    // Sockets opened (SimUDP::begin) after this call belong to the given host
+    void attach(const IPAddress &host) { _host = host; }
+    uint32_t attachedHost() const { return _host; }
+
+    // The default profile, for all links without their own
+    void setLink(const LinkProfile &profile) { _defaultLink = profile; }
+
+    void setLink(const IPAddress &from, const IPAddress &to, const LinkProfile &profile)
+    {
+        _links[linkKey(from, to)].profile = profile;
+        _links[linkKey(from, to)].hasProfile = true;
+    }
+
+    uint64_t now() const { return simulatedMicros; }
+
+    // Advance the virtual clock, delivering the datagrams that arrive in that time
+    void advance(uint32_t micros)
+    {
+        auto until = simulatedMicros + micros;
+        while (!_inFlight.empty() && _inFlight.top().deliverAt <= until)
+        {
+            auto scheduled = _inFlight.top();
+            _inFlight.pop();
+            simulatedMicros = scheduled.deliverAt;
+            deliver(_datagrams[scheduled.index]);
+            _datagrams.erase(scheduled.index);
+        }
+        simulatedMicros = until;
+    }
+
+    const SimStatistics &statistics() const { return _statistics; }
+
+    // Called by SimUDP
+    void bind(SimUDP *socket, uint32_t ip, uint16_t port) { _sockets[socketKey(ip, port)] = socket; }
+    void unbind(uint32_t ip, uint16_t port) { _sockets.erase(socketKey(ip, port)); }
+    inline void send(Datagram &&datagram);
+
+private:
+    struct Link
+    {
+        LinkProfile profile;
+        bool hasProfile = false;
+        uint64_t busyUntil = 0;     // end of transmission of the last datagram
+    };
+
+    struct Scheduled
+    {
+        uint64_t deliverAt;
+        uint64_t index;             // also orders datagrams arriving at the same time
+
+        bool operator>(const Scheduled &other) const
+        {
+            return (deliverAt != other.deliverAt) ? deliverAt > other.deliverAt : index > other.index;
+        }
+    };
+
+    static uint64_t linkKey(uint32_t from, uint32_t to) { return ((uint64_t)from << 32) | to; }
+    static uint64_t socketKey(uint32_t ip, uint16_t port) { return ((uint64_t)ip << 16) | port; }
+
+    // xorshift32
+    uint32_t next()
+    {
+        _state ^= _state << 13;
+        _state ^= _state >> 17;
+        _state ^= _state << 5;
+        return _state;
+    }
+
+    bool chance(uint16_t perMille) { return perMille > 0 && (next() % 1000) < perMille; }
+
+    void schedule(const Datagram &datagram, uint64_t deliverAt)
+    {
+        _datagrams[_index] = datagram;
+        _inFlight.push({deliverAt, _index});
+        _index++;
+    }
+
+    inline void deliver(Datagram &datagram);
+
+    static SimNetwork *_current;
+
+    uint32_t _state;
+    uint32_t _host = 0;
+    uint64_t _index = 0;
+
+    LinkProfile _defaultLink;
+    std::map<uint64_t, Link> _links;
+    std::map<uint64_t, SimUDP *> _sockets;
+    std::map<uint64_t, Datagram> _datagrams;
+    std::priority_queue<Scheduled, std::vector<Scheduled>, std::greater<Scheduled>> _inFlight;
+
+    SimStatistics _statistics;
+};
+
+SimNetwork *SimNetwork::_current = nullptr;
+
+// UdpClass for AppleMIDISession, on top of the SimNetwork
+class SimUDP
+{
+    SimNetwork *_network = nullptr;
+    uint32_t _ip = 0;
+    uint16_t _port = 0;
+
+    std::deque<SimNetwork::Datagram> _received;
+    SimNetwork::Datagram _rx;     // the datagram being read
+    size_t _rxPosition = 0;
+    SimNetwork::Datagram _tx;     // the datagram being written
+
+public:
+    ~SimUDP() { stop(); }
+
+    uint8_t begin(uint16_t port)
+    {
+        _network = SimNetwork::current();
+        if (nullptr == _network)
+            return 0;
+
+        _ip = _network->attachedHost();
+        _port = port;
+        _network->bind(this, _ip, _port);
+        return 1;
+    }
+
+    void stop()
+    {
+        if (nullptr != _network)
+            _network->unbind(_ip, _port);
+        _network = nullptr;
+        _received.clear();
+    }
+
+    int beginPacket(IPAddress ip, uint16_t port)
+    {
+        if (nullptr == _network)
+            return 0;
+
+        _tx.srcIP = _ip;
+        _tx.srcPort = _port;
+        _tx.dstIP = ip;
+        _tx.dstPort = port;
+        _tx.data.clear();
+        return 1;
+    }
+
+    size_t write(uint8_t value)
+    {
+        _tx.data.push_back(value);
+        return 1;
+    }
+
+    size_t write(const uint8_t *buffer, size_t size)
+    {
+        _tx.data.insert(_tx.data.end(), buffer, buffer + size);
+        return size;
+    }
+
+    int endPacket()
+    {
+        if (nullptr == _network)
+            return 0;
+
+        _network->send(std::move(_tx));
+        _tx = SimNetwork::Datagram();
+        return 1;
+    }
+
+    void flush() {}
+
+    // Gathered send (see utility/UdpSegment.h), a complete datagram in one call.
+    // A template, as this header is included before the library.
+    template <class Segment>
+    int sendPacket(const IPAddress &ip, uint16_t port, const Segment *segments, size_t count)
+    {
+        if (!beginPacket(ip, port))
+            return 0;
+        for (size_t i = 0; i < count; i++)
+            write(segments[i].data, segments[i].size);
+        return endPacket();
+    }
+
+    int parsePacket()
+    {
+        if (_received.empty())
+            return 0;
+
+        _rx = std::move(_received.front());
+        _received.pop_front();
+        _rxPosition = 0;
+        return (int)_rx.data.size();
+    }
+
+    int available()
+    {
+        return (int)(_rx.data.size() - _rxPosition);
+    }
+
+    int read()
+    {
+        if (_rxPosition >= _rx.data.size())
+            return -1;
+        return _rx.data[_rxPosition++];
+    }
+
+    int read(uint8_t *buffer, size_t size)
+    {
+        size_t n = min(size, _rx.data.size() - _rxPosition);
+        memcpy(buffer, _rx.data.data() + _rxPosition, n);
+        _rxPosition += n;
+        return (int)n;
+    }
+
+    IPAddress remoteIP() { return IPAddress(_rx.srcIP); }
+    uint16_t remotePort() { return _rx.srcPort; }
+
+    // Called by SimNetwork
+    void receive(const SimNetwork::Datagram &datagram) { _received.push_back(datagram); }
+};
+
+inline void SimNetwork::send(Datagram &&datagram)
+{
+    _statistics.sent++;
+    _statistics.bytes += datagram.data.size();
+
+    auto &link = _links[linkKey(datagram.srcIP, datagram.dstIP)];
+    auto &profile = link.hasProfile ? link.profile : _defaultLink;
+
+    // the datagram occupies the link, even when it gets lost on the way
+    uint64_t departure = simulatedMicros;
+    if (profile.bandwidth > 0)
+    {
+        if (link.busyUntil > departure)
+            departure = link.busyUntil;
+        departure += (uint64_t)datagram.data.size() * 1000000 / profile.bandwidth;
+        link.busyUntil = departure;
+    }
+
+    if (chance(profile.loss))
+    {
+        _statistics.lost++;
+        return;
+    }
+
+    auto copies = chance(profile.duplicate) ? 2 : 1;
+    if (copies > 1)
+        _statistics.duplicated++;
+
+    for (auto i = 0; i < copies; i++)
+    {
+        uint64_t deliverAt = departure + profile.latency;
+        if (profile.jitter > 0)
+            deliverAt += next() % (profile.jitter + 1);
+        if (chance(profile.reorder))
+        {
+            deliverAt += profile.reorderDelay;
+            _statistics.reordered++;
+        }
+        schedule(datagram, deliverAt);
+    }
+}
+
+inline void SimNetwork::deliver(Datagram &datagram)
+{
+    auto socket = _sockets.find(socketKey(datagram.dstIP, datagram.dstPort));
+    if (socket == _sockets.end())
+    {
+        _statistics.unreachable++;
+        return;
+    }
+
+    _statistics.delivered++;
+    socket->second->receive(datagram);
+}
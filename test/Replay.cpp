@@ -0,0 +1,342 @@
+// Replays the AppleMIDI and RTP-MIDI traffic of a capture (pcap or pcapng,
+// from Wireshark, tcpdump or PcapCapture) into a session, and reports how the
+// engine copes with it: decode throughput, time spent in the session per
+// datagram and the exceptions it raised.
+//
+// The session stands in for one host of the capture (--host, by default the
+// destination of the first AppleMIDI or RTP-MIDI datagram) and is fed the
+// datagrams sent to its control and data port (--port, found the same way).
+// Its replies are counted and dropped. RTP-MIDI from a participant whose
+// invitation is not in the capture (started mid-session) is preceded by a
+// made-up invitation, so that it is handled like that of a participant.
+//
+// Time is virtual and follows the capture timestamps. The datagrams are fed
+// as fast as possible, or at their original timing with --realtime.
+//
+// Single translation unit (Arduino.h defines the Arduino functions):
+//     g++ -std=c++11 -O2 -I. -I../src -I<arduino_midi_library>/src Replay.cpp -o replay
+//     ./replay [--realtime] [--host a.b.c.d] [--port n] capture.pcapng
+
+#define SIMULATED_CLOCK
+#define NO_ARDUINO_MAIN
+#define USE_EXT_CALLBACKS
+#include "Arduino.h"
+
+#include "../src/AppleMIDI.cpp"
+#include "../src/AppleMIDI_Replay.h"
+#include "../src/utility/Histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+
+USING_NAMESPACE_APPLEMIDI
+
+// Room for the participants of a busy session
+struct ReplaySettings : public APPLEMIDI_NAMESPACE::DefaultSettings
+{
+    static const uint8_t MaxNumberOfParticipants = 8;
+};
+
+typedef AppleMIDISession<ReplayUDP, ReplaySettings> ReplaySession_t;
+
+// available() calls for one datagram, before it counts as stalled
+static const uint16_t MaxRounds = 4096;
+
+static const char *exceptionNames[] = {
+    "BufferFull", "Parse", "UnexpectedParse", "TooManyParticipants", "ComputerNotInDirectory",
+    "NotAcceptingAnyone", "UnexpectedInvite", "ParticipantNotFound", "ListenerTimeOut", "MaxAttempts",
+    "NoResponseFromConnectionRequest", "SendPacketsDropped", "ReceivedPacketsDropped", "UdpBeginPacketFailed",
+};
+
+static uint32_t exceptions[UdpBeginPacketFailed + 1];
+
+static void OnException(const ssrc_t &, const Exception &exception, const int32_t)
+{
+    if (exception <= UdpBeginPacketFailed)
+        exceptions[exception]++;
+}
+
+struct Statistics
+{
+    uint32_t control = 0;
+    uint32_t data = 0;
+    uint32_t other = 0;
+    uint32_t joined = 0;
+    uint32_t stalled = 0;
+    uint64_t bytes = 0;
+    uint64_t midiBytes = 0;
+    uint64_t midiMessages = 0;
+    uint64_t engineNs = 0;
+    uint64_t maxNs = 0;
+    uint64_t captureUs = 0;
+    Histogram latency; // ns, clamped at 131 us
+};
+
+static bool isAppleMIDI(const PcapDatagram &datagram)
+{
+    return datagram.size >= 4 && datagram.data[0] == amSignature[0] && datagram.data[1] == amSignature[1];
+}
+
+static bool isRtpMIDI(const PcapDatagram &datagram)
+{
+    return datagram.size >= sizeof(Rtp_t) && RTP_VERSION(datagram.data[0]) == RTP_VERSION_2
+        && RTP_PAYLOAD_TYPE(datagram.data[1]) == PAYLOADTYPE_RTPMIDI;
+}
+
+static bool isCommand(const PcapDatagram &datagram, uint16_t command)
+{
+    return isAppleMIDI(datagram) && load_be16(datagram.data + 2) == command;
+}
+
+// The host and control port of the session, from the first AppleMIDI or RTP-MIDI
+// datagram: RTP-MIDI, CK and RS go to the data port, the others to the control port
+static bool detect(const PcapDatagram &datagram, IPAddress &host, uint16_t &port)
+{
+    if (!isAppleMIDI(datagram) && !isRtpMIDI(datagram))
+        return false;
+
+    host = datagram.dstIP;
+    const bool toDataPort = isRtpMIDI(datagram) || isCommand(datagram, amSynchronizationCommand)
+                         || isCommand(datagram, amReceiverFeedbackCommand);
+    port = toDataPort ? datagram.dstPort - 1 : datagram.dstPort;
+    return true;
+}
+
+// Hands a datagram to the session, and calls available() and read() the way
+// MIDI.read() does until it is read. Returns the time it took, in ns.
+static uint64_t feed(ReplaySession_t &session, const PcapDatagram &datagram, Statistics &statistics)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    ReplayUDP::deliver(datagram);
+    uint16_t rounds = 0;
+    do
+    {
+        while (session.available() > 0)
+        {
+            if (session.read() & 0x80)
+                statistics.midiMessages++;
+            statistics.midiBytes++;
+        }
+    } while (!ReplayUDP::idle() && ++rounds < MaxRounds);
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    if (!ReplayUDP::idle())
+    {
+        statistics.stalled++;
+        session.available(); // reads the rest of the datagram away, or not
+    }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+}
+
+// ssrc of the participants that were invited in the capture, or made up
+static ssrc_t participants[64];
+static uint8_t numberOfParticipants = 0;
+
+static bool isParticipant(ssrc_t ssrc)
+{
+    for (uint8_t i = 0; i < numberOfParticipants; i++)
+        if (participants[i] == ssrc)
+            return true;
+    return false;
+}
+
+static void addParticipant(ssrc_t ssrc)
+{
+    if (!isParticipant(ssrc) && numberOfParticipants < sizeof(participants) / sizeof(participants[0]))
+        participants[numberOfParticipants++] = ssrc;
+}
+
+// An invitation on the control port and on the data port, from the sender of an RTP-MIDI datagram
+static void join(ReplaySession_t &session, const PcapDatagram &datagram, uint16_t port, Statistics &statistics)
+{
+    uint8_t invitation[16];
+    memcpy(invitation, amInvitationHeader, sizeof(amInvitationHeader));
+    store_be32(invitation + 8, 0); // initiator token
+    memcpy(invitation + 12, datagram.data + RTP_SSRC_OFFSET, 4);
+
+    PcapDatagram made = datagram;
+    made.data = invitation;
+    made.size = sizeof(invitation);
+    made.dstPort = port;
+    made.srcPort = datagram.srcPort - 1;
+    feed(session, made, statistics);
+    made.dstPort = port + 1;
+    made.srcPort = datagram.srcPort;
+    feed(session, made, statistics);
+
+    statistics.joined++;
+}
+
+// The bucket upper bound can be above the slowest datagram actually seen
+static unsigned long long percentile(const Statistics &statistics, uint16_t permille)
+{
+    uint64_t value = statistics.latency.valueAtPermille(permille);
+    return value < statistics.maxNs ? value : statistics.maxNs;
+}
+
+static void report(const char *path, const PcapReader &reader, const IPAddress &host, uint16_t port,
+                   bool realtime, const Statistics &statistics, double wallSeconds)
+{
+    auto datagrams = statistics.control + statistics.data;
+    printf("%s: %u records, %u datagrams to %u.%u.%u.%u:%u (%u control, %u data), %u other, %u skipped\n",
+           path, reader.records(), datagrams, host[0], host[1], host[2], host[3], port,
+           statistics.control, statistics.data, statistics.other, reader.skipped());
+    printf("  replayed %s: %.3f s of capture in %.3f s\n",
+           realtime ? "at the original timing" : "as fast as possible", statistics.captureUs / 1e6, wallSeconds);
+    if (datagrams == 0)
+        return;
+
+    auto engineSeconds = statistics.engineNs / 1e9;
+    printf("  engine: %llu bytes in %.3f ms, %.0f datagrams/s, %.2f MB/s\n",
+           (unsigned long long)statistics.bytes, engineSeconds * 1e3,
+           datagrams / engineSeconds, statistics.bytes / engineSeconds / 1e6);
+    printf("  MIDI read: %llu messages, %llu bytes, %.2f MB/s\n",
+           (unsigned long long)statistics.midiMessages, (unsigned long long)statistics.midiBytes,
+           statistics.midiBytes / engineSeconds / 1e6);
+    printf("  in the session per datagram: mean %llu ns, p50 %llu ns, p99 %llu ns, p99.9 %llu ns, max %llu ns\n",
+           (unsigned long long)(statistics.engineNs / datagrams),
+           percentile(statistics, 500), percentile(statistics, 990), percentile(statistics, 999),
+           (unsigned long long)statistics.maxNs);
+    printf("  (the percentiles come from a histogram that ends at %u ns)\n",
+           Histogram::upperBoundOf(Histogram::NumberOfBuckets - 1));
+    printf("  participants joined without invitation: %u, datagrams sent by the session: %u, stalled: %u\n",
+           statistics.joined, ReplayUDP::sent(), statistics.stalled);
+
+    printf("  exceptions:");
+    bool any = false;
+    for (uint8_t i = 0; i <= UdpBeginPacketFailed; i++)
+        if (exceptions[i] > 0)
+        {
+            printf(" %s %u", exceptionNames[i], exceptions[i]);
+            any = true;
+        }
+    printf("%s\n", any ? "" : " none");
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: replay [--realtime] [--host a.b.c.d] [--port n] capture.pcap[ng]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    bool realtime = false;
+    bool hostGiven = false;
+    bool portGiven = false;
+    bool detected = false;
+    IPAddress host;
+    uint16_t port = DEFAULT_CONTROL_PORT;
+    const char *path = nullptr;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--realtime") == 0)
+            realtime = true;
+        else if (strcmp(argv[i], "--host") == 0 && i + 1 < argc)
+        {
+            unsigned a, b, c, d;
+            if (sscanf(argv[++i], "%u.%u.%u.%u", &a, &b, &c, &d) != 4)
+                usage();
+            host = IPAddress(a, b, c, d);
+            hostGiven = true;
+        }
+        else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc)
+        {
+            port = (uint16_t)strtoul(argv[++i], nullptr, 0);
+            portGiven = true;
+        }
+        else if (argv[i][0] != '-' && nullptr == path)
+            path = argv[i];
+        else
+            usage();
+    }
+    if (nullptr == path)
+        usage();
+    detected = hostGiven && portGiven;
+
+    static uint8_t frame[65536 + 256];
+    PcapReader reader(frame, sizeof(frame));
+    if (!reader.open(path))
+    {
+        fprintf(stderr, "%s: not a readable pcap or pcapng file\n", path);
+        return 1;
+    }
+
+    // the session is started with the first datagram, on the port that is known by then
+    ReplaySession_t *session = nullptr;
+
+    Statistics statistics;
+    uint64_t first = 0;
+    auto wallStart = std::chrono::steady_clock::now();
+
+    PcapDatagram datagram;
+    while (reader.next(datagram))
+    {
+        IPAddress detectedHost;
+        uint16_t detectedPort;
+        if (!detected && detect(datagram, detectedHost, detectedPort))
+        {
+            if (!hostGiven)
+                host = detectedHost;
+            if (!portGiven)
+                port = detectedPort;
+            detected = true;
+        }
+        if (!detected || datagram.dstIP != host || (datagram.dstPort != port && datagram.dstPort != port + 1))
+        {
+            statistics.other++;
+            continue;
+        }
+
+        if (nullptr == session)
+        {
+            first = datagram.timestamp;
+            session = new ReplaySession_t("replay", port);
+            session->setHandleException(OnException);
+            session->begin();
+        }
+
+        // virtual time, it does not go back when the capture does
+        auto offset = (datagram.timestamp > first) ? datagram.timestamp - first : 0;
+        if (offset > statistics.captureUs)
+            statistics.captureUs = offset;
+        simulatedMicros = statistics.captureUs;
+
+        if (realtime)
+            std::this_thread::sleep_until(wallStart + std::chrono::microseconds(offset));
+
+        const bool toControl = (datagram.dstPort == port);
+        if (toControl && isCommand(datagram, amInvitationCommand) && datagram.size >= 16)
+            addParticipant(load_be32(datagram.data + 12));
+        else if (!toControl && isRtpMIDI(datagram))
+        {
+            auto ssrc = load_be32(datagram.data + RTP_SSRC_OFFSET);
+            if (!isParticipant(ssrc))
+            {
+                addParticipant(ssrc);
+                join(*session, datagram, port, statistics);
+            }
+        }
+
+        auto ns = feed(*session, datagram, statistics);
+        statistics.engineNs += ns;
+        if (ns > statistics.maxNs)
+            statistics.maxNs = ns;
+        statistics.latency.record(ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns);
+        statistics.bytes += datagram.size;
+        if (toControl)
+            statistics.control++;
+        else
+            statistics.data++;
+    }
+
+    auto wall = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - wallStart).count();
+    report(path, reader, host, port, realtime, statistics, wall / 1e6);
+    return 0;
+}
@@ -0,0 +1,1126 @@
+// Two sessions talking over the simulated network (NetworkSimulator.h), with
+// a number of link profiles, also with SysEx larger than a packet. A session
+// with a scripted RTP-MIDI peer, which also shows what a paced session sends,
+// what each flush policy does, and where real-time messages go.
+// Then a Network MIDI 2.0 host (UMPSession) with a scripted client. Runs in virtual time, so a run is reproducible (same seed,
+// same result) and takes a fraction of real time.
+//
+// Single translation unit (Arduino.h defines the Arduino functions):
+//     g++ -std=c++11 -I. -I../src -I<arduino_midi_library>/src Simulator.cpp -o simulator
+//     ./simulator [seed]
+// Exits with 1 when the invariants of a link profile do not hold.
+
+#define SIMULATED_CLOCK
+#define NO_ARDUINO_MAIN
+#include "NetworkSimulator.h"
+
+#define APPLEMIDI_INITIATOR
+#define USE_PACING
+
+#include "../src/AppleMIDI.cpp"
+#include "../src/UMP_Session.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+USING_NAMESPACE_APPLEMIDI
+
+struct Scenario
+{
+    const char *name;
+    LinkProfile link;
+};
+
+static bool connected = false;
+
+static void OnConnected(const ssrc_t &, const char *)
+{
+    connected = true;
+}
+
+static void OnDisconnected(const ssrc_t &)
+{
+    connected = false;
+}
+
+// The sessions must connect within this time, plus the round trips of the
+// handshake. Lost invitations are sent again, up to 1.5 s later.
+static const uint32_t MaxConnectMs = 100;
+static const uint32_t MaxConnectLossyMs = 5000;
+
+// Time for the datagrams still on the way when sending stops
+static const uint32_t DrainMs = 1000;
+
+static bool check(const Scenario &scenario, bool condition, const char *what)
+{
+    if (!condition)
+        printf("%-12s FAILED: %s\n", scenario.name, what);
+    return condition;
+}
+
+// Connect, then send a NoteOn every millisecond and count what arrives.
+// Returns false when the invariants of the link do not hold.
+static bool run(const Scenario &scenario, uint32_t seed, uint32_t durationMs)
+{
+    SimNetwork network(seed);
+    network.setLink(scenario.link);
+
+    AppleMIDISession<SimUDP> initiator("initiator");
+    AppleMIDISession<SimUDP> listener("listener");
+
+    const IPAddress initiatorIP(10, 0, 0, 1);
+    const IPAddress listenerIP(10, 0, 0, 2);
+
+    // the sessions seed random() with millis(), let them start at different times
+    network.attach(initiatorIP);
+    initiator.begin();
+    network.advance(1000);
+    network.attach(listenerIP);
+    listener.begin();
+
+    connected = false;
+    listener.setHandleConnected(OnConnected);
+    listener.setHandleDisconnected(OnDisconnected);
+
+    initiator.sendInvite(listenerIP);
+
+    uint32_t connectedAt = 0;
+    uint32_t sent = 0;
+    uint32_t received = 0;
+
+    for (uint32_t ms = 0; ms < durationMs + DrainMs; ms++)
+    {
+        initiator.available();
+        while (listener.available() > 0)
+            if ((listener.read() & 0xF0) == 0x90)
+                received++;
+
+        if (connected && ms < durationMs)
+        {
+            if (connectedAt == 0)
+                connectedAt = millis();
+
+            // one NoteOn per millisecond, sent as one RTP packet per loop()
+            if (initiator.beginTransmission(MIDI_NAMESPACE::MidiType::NoteOn))
+            {
+                initiator.write(0x90);
+                initiator.write(sent & 0x7F);
+                initiator.write(0x7F);
+                initiator.endTransmission();
+                sent++;
+            }
+        }
+
+        network.advance(1000);
+    }
+
+    const auto &statistics = network.statistics();
+    printf("%-12s connected at %5u ms  notes %6u/%6u  datagrams sent %6u delivered %6u lost %4u dup %4u reordered %4u  %8llu bytes\n",
+           scenario.name, connectedAt, received, sent,
+           statistics.sent, statistics.delivered, statistics.lost, statistics.duplicated, statistics.reordered,
+           (unsigned long long)statistics.bytes);
+
+    // every NoteOn is played at most once, and all of them when the link loses nothing.
+    // What is lost is bounded by the loss rate of the link (per mille, with some margin).
+    const uint32_t maxConnectMs = ((scenario.link.loss == 0) ? MaxConnectMs : MaxConnectLossyMs) +
+                                  4 * (scenario.link.latency + scenario.link.jitter) / 1000;
+    bool ok = check(scenario, connectedAt > 0 && connectedAt <= maxConnectMs, "connected in time");
+    ok &= check(scenario, received <= sent, "no note received more often than sent");
+    if (scenario.link.loss == 0)
+        ok &= check(scenario, received == sent, "no loss");
+    else
+        ok &= check(scenario, (uint64_t)received * 1000 >= (uint64_t)sent * (1000 - 2 * scenario.link.loss), "loss within the link's loss rate");
+    return ok;
+}
+
+// SysEx messages larger than SysExPacketMaxSize, between two NoteOns, with
+// and without their F0 and F7 (containsBoundaries). The listener reads them in
+// segments (F0..F0, F7..F0, ..., F7..F7): put back together, they must be the
+// messages sent, in order. Then messages without data, that send nothing.
+// Returns false when they do not arrive intact.
+static bool runSysEx(const Scenario &scenario, uint32_t seed)
+{
+    SimNetwork network(seed);
+    network.setLink(scenario.link);
+
+    AppleMIDISession<SimUDP> initiator("initiator");
+    AppleMIDISession<SimUDP> listener("listener");
+
+    network.attach(IPAddress(10, 0, 0, 1));
+    initiator.begin();
+    network.advance(1000);
+    network.attach(IPAddress(10, 0, 0, 2));
+    listener.begin();
+
+    connected = false;
+    listener.setHandleConnected(OnConnected);
+    listener.setHandleDisconnected(OnDisconnected);
+
+    initiator.sendInvite(IPAddress(10, 0, 0, 2));
+
+    // with F0 and F7, with one of them, with none
+    const bool boundaries[][2] = {{true, true}, {true, false}, {false, true}, {false, false}};
+    const size_t variants = sizeof(boundaries) / sizeof(boundaries[0]);
+
+    std::vector<uint8_t> expected;
+    std::vector<uint8_t> received;
+    bool returnedSize = true;
+    bool emptySent = false;
+    bool emptySentNothing = false;
+    size_t variant = 0;
+
+    for (uint32_t ms = 0; ms < 2 * DrainMs; ms++)
+    {
+        initiator.available();
+        while (listener.available() > 0)
+            received.push_back(listener.read());
+
+        // one message every 100 ms, once connected
+        if (connected && ms % 100 == 0 && variant < variants)
+        {
+            const bool start = boundaries[variant][0];
+            const bool end = boundaries[variant][1];
+            const size_t length = 3 * APPLEMIDI_NAMESPACE::DefaultSettings::SysExPacketMaxSize + variant;
+
+            std::vector<uint8_t> message;
+            if (start)
+                message.push_back(0xF0);
+            for (size_t i = 0; i < length; i++)
+                message.push_back((i + variant) & 0x7F);
+            if (end)
+                message.push_back(0xF7);
+
+            initiator.sendNoteOn(2 * variant, 0x7F, 1);
+            returnedSize &= (initiator.sendSysEx(message.data(), message.size(), start || end) == length);
+            initiator.sendNoteOn(2 * variant + 1, 0x7F, 1);
+
+            const uint8_t before[] = {0x90, (uint8_t)(2 * variant), 0x7F};
+            const uint8_t after[] = {0x90, (uint8_t)(2 * variant + 1), 0x7F};
+            expected.insert(expected.end(), before, before + sizeof(before));
+            expected.push_back(0xF0);
+            for (size_t i = 0; i < length; i++)
+                expected.push_back((i + variant) & 0x7F);
+            expected.push_back(0xF7);
+            expected.insert(expected.end(), after, after + sizeof(after));
+
+            variant++;
+        }
+        else if (variant == variants && !emptySent && ms % 100 == 0)
+        {
+            // nothing queued up, so nothing at all may go out
+            const uint8_t empty[] = {0xF0, 0xF7};
+            const auto sentBefore = network.statistics().sent;
+            returnedSize &= (initiator.sendSysEx(empty, 0) == 0);
+            returnedSize &= (initiator.sendSysEx(empty, sizeof(empty), true) == 0);
+            emptySentNothing = (network.statistics().sent == sentBefore);
+            emptySent = true;
+        }
+
+        network.advance(1000);
+    }
+
+    // a segment boundary is an F0 followed by an F7
+    std::vector<uint8_t> joined;
+    for (size_t i = 0; i < received.size(); i++)
+    {
+        if (received[i] == 0xF0 && i + 1 < received.size() && received[i + 1] == 0xF7)
+            i++;
+        else
+            joined.push_back(received[i]);
+    }
+
+    printf("%-12s connected %-3s        SysEx  %6u/%6u bytes\n",
+           scenario.name, connected ? "yes" : "no", (unsigned)joined.size(), (unsigned)expected.size());
+
+    bool ok = check(scenario, connected, "SysEx: connected");
+    ok &= check(scenario, returnedSize, "SysEx: sendSysEx returns the size of the data");
+    ok &= check(scenario, joined == expected, "SysEx: the messages arrive intact and in order");
+    ok &= check(scenario, emptySent && emptySentNothing, "SysEx: no data, no packet");
+    return ok;
+}
+
+// An RTP-MIDI peer, scripted on bare SimUDP sockets, that can start its
+// sequence numbers anew halfway (as a peer does that restarts without a new
+// SSRC). It invites the listener and sends NoteOns, no synchronization. It
+// keeps the RTP-MIDI packets the listener sends it.
+class RtpClient
+{
+public:
+    SimUDP control;
+    SimUDP data;
+    IPAddress listenerIP;
+
+    bool controlAccepted = false;
+    bool dataAccepted = false;
+
+    struct Packet
+    {
+        uint32_t ms;               // of arrival
+        size_t size;               // of the datagram
+        std::vector<uint8_t> midi; // the MIDI list
+    };
+    std::vector<Packet> packets;
+
+    void begin(uint16_t port)
+    {
+        control.begin(port);
+        data.begin(port + 1);
+    }
+
+    void invite()
+    {
+        auto &socket = controlAccepted ? data : control;
+        uint8_t invitation[sizeof(amInvitationHeader) + 4 + 4 + 4] = {};
+        memcpy(invitation, amInvitationHeader, sizeof(amInvitationHeader));
+        store_be32(invitation + 8, 0x1234);
+        store_be32(invitation + 12, ssrc);
+        memcpy(invitation + 16, "rtp", 4);
+        socket.beginPacket(listenerIP, controlAccepted ? DEFAULT_CONTROL_PORT + 1 : DEFAULT_CONTROL_PORT);
+        socket.write(invitation, sizeof(invitation));
+        socket.endPacket();
+    }
+
+    // A NoteOn in an RTP packet of its own, the serial number as key and velocity
+    void sendNote(uint32_t serial)
+    {
+        uint8_t packet[12 + 4] = {0x80, 0x61};
+        store_be16(packet + 2, sequenceNr++);
+        store_be32(packet + 4, micros() / 100); // 10 kHz
+        store_be32(packet + 8, ssrc);
+        packet[12] = 3;
+        packet[13] = 0x90;
+        packet[14] = serial & 0x7F;
+        packet[15] = (serial >> 7) & 0x7F;
+        data.beginPacket(listenerIP, DEFAULT_CONTROL_PORT + 1);
+        data.write(packet, sizeof(packet));
+        data.endPacket();
+    }
+
+    // counts on from a sequence number sent before, inside the receiver's window
+    void restart()
+    {
+        sequenceNr -= 10;
+    }
+
+    void receive()
+    {
+        uint8_t packet[1500];
+        while (control.parsePacket() > 0)
+            controlAccepted |= accepted(packet, control.read(packet, sizeof(packet)));
+
+        while (data.parsePacket() > 0)
+        {
+            const size_t size = data.read(packet, sizeof(packet));
+            dataAccepted |= accepted(packet, size);
+
+            // RTP header, then the command section: B J Z P LEN (4 bits, 12 with B)
+            if (size <= 12 || RTP_VERSION(packet[0]) != RTP_VERSION_2)
+                continue;
+            size_t length = packet[12] & RTP_MIDI_CS_MASK_SHORTLEN;
+            size_t offset = 13;
+            if (packet[12] & RTP_MIDI_CS_FLAG_B)
+                length = (length << 8) | packet[offset++];
+            if (offset + length <= size)
+                packets.push_back({(uint32_t)millis(), size, std::vector<uint8_t>(packet + offset, packet + offset + length)});
+        }
+    }
+
+private:
+    const ssrc_t ssrc = 0x5EED;
+    uint16_t sequenceNr = 0xFFF0; // wraps around on the way
+
+    static bool accepted(const uint8_t *packet, size_t size)
+    {
+        return size >= sizeof(amInvitationAcceptedHeader) && 0 == memcmp(packet, amInvitationAcceptedHeader, sizeof(amInvitationAcceptedHeader));
+    }
+};
+
+// The commands of a MIDI list as a session sends it: each with its status
+// octet, and a delta time ahead of all but the first. A SysEx segment runs up
+// to and including its closing F0, F7 or F4.
+static std::vector<std::vector<uint8_t>> commandsOf(const std::vector<uint8_t> &list)
+{
+    std::vector<std::vector<uint8_t>> commands;
+    size_t i = 0;
+    while (i < list.size())
+    {
+        if (!commands.empty())
+            while (i < list.size() && (list[i++] & RTP_MIDI_DELTA_TIME_EXTENSION)) {}
+        if (i >= list.size())
+            break;
+
+        size_t length = 1;
+        if (list[i] == 0xF0 || list[i] == 0xF7)
+        {
+            while (i + length < list.size() && (list[i + length] & 0x80) == 0)
+                length++;
+            if (i + length < list.size())
+                length++;
+        }
+        else
+            length = rtpMidiOctetInfo(list[i]) & RTP_MIDI_OCTET_LENGTH_MASK;
+
+        length = min(length, list.size() - i);
+        commands.emplace_back(list.begin() + i, list.begin() + i + length);
+        i += length;
+    }
+    return commands;
+}
+
+// The session under test, with the given Settings, on the ideal link. An
+// RtpClient invites it, and keeps what it is sent. From then on, script() is
+// called every millisecond for durationMs. Returns false when it did not connect.
+template <class Settings, class Script>
+static bool record(uint32_t seed, uint32_t durationMs, std::vector<RtpClient::Packet> &packets, Script script)
+{
+    SimNetwork network(seed);
+
+    AppleMIDISession<SimUDP, Settings> session("session");
+    RtpClient client;
+
+    client.listenerIP = IPAddress(10, 0, 0, 2);
+    network.attach(client.listenerIP);
+    session.begin();
+    network.attach(IPAddress(10, 0, 0, 3));
+    client.begin(6000);
+
+    uint32_t connectedAt = 0;
+    for (uint32_t ms = 0; connectedAt == 0 ? ms < DrainMs : ms < connectedAt + durationMs + DrainMs; ms++)
+    {
+        session.available();
+        client.receive();
+
+        if (!client.dataAccepted)
+        {
+            if (ms % 100 == 0)
+                client.invite();
+        }
+        else
+        {
+            if (connectedAt == 0)
+                connectedAt = ms;
+            if (ms < connectedAt + durationMs)
+                script(session);
+        }
+
+        network.advance(1000);
+    }
+
+    packets = client.packets;
+    return connectedAt > 0;
+}
+
+// Quiet before the restart, so that no packet counted before it arrives after it
+static const uint32_t RestartQuietMs = 100;
+
+// An RTP-MIDI peer that starts its sequence numbers anew halfway, under the
+// same SSRC. The listener drops what the link delivers twice, not the notes
+// sent after the restart. Returns false when the invariants of the link do not hold.
+static bool runRestart(const Scenario &scenario, uint32_t seed, uint32_t durationMs)
+{
+    SimNetwork network(seed);
+    network.setLink(scenario.link);
+
+    AppleMIDISession<SimUDP> listener("listener");
+    RtpClient client;
+
+    client.listenerIP = IPAddress(10, 0, 0, 2);
+    network.attach(client.listenerIP);
+    listener.begin();
+    network.attach(IPAddress(10, 0, 0, 3));
+    client.begin(6000);
+
+    connected = false;
+    listener.setHandleConnected(OnConnected);
+    listener.setHandleDisconnected(OnDisconnected);
+
+    std::vector<uint8_t> seen; // times each serial number was received
+    uint32_t received = 0;
+    uint32_t duplicates = 0;
+    uint32_t sentBeforeRestart = 0;
+    uint32_t receivedAfterRestart = 0;
+    uint32_t quietSince = 0;
+
+    for (uint32_t ms = 0; ms < durationMs + DrainMs; ms++)
+    {
+        while (listener.available() >= 3)
+        {
+            if (listener.read() != 0x90)
+                continue;
+            const uint32_t key = listener.read();
+            const uint32_t serial = key | (listener.read() << 7);
+            if (serial < seen.size())
+            {
+                if (seen[serial]++ > 0)
+                    duplicates++;
+                received++;
+                if (sentBeforeRestart > 0 && serial >= sentBeforeRestart)
+                    receivedAfterRestart++;
+            }
+        }
+
+        client.receive();
+
+        if (!client.dataAccepted)
+        {
+            // retried every 100 ms until answered
+            if (ms % 100 == 0)
+                client.invite();
+        }
+        else if (ms < durationMs)
+        {
+            if (sentBeforeRestart == 0 && ms >= durationMs / 2)
+            {
+                sentBeforeRestart = seen.size();
+                quietSince = ms;
+            }
+            else if (quietSince > 0 && ms - quietSince < RestartQuietMs)
+            {
+                if (ms - quietSince == RestartQuietMs - 1)
+                    client.restart();
+            }
+            else
+            {
+                client.sendNote(seen.size());
+                seen.push_back(0);
+            }
+        }
+
+        network.advance(1000);
+    }
+
+    const uint32_t sent = seen.size();
+    printf("%-12s connected %-3s        restart %6u/%6u  duplicates %u  after the restart %u/%u\n",
+           scenario.name, connected ? "yes" : "no", received, sent, duplicates,
+           receivedAfterRestart, sent - sentBeforeRestart);
+
+    bool ok = check(scenario, connected, "restart: connected");
+    ok &= check(scenario, duplicates == 0 && received <= sent, "restart: no note received more often than sent");
+    if (scenario.link.loss == 0)
+        ok &= check(scenario, received == sent, "restart: no loss");
+    else
+        ok &= check(scenario, (uint64_t)receivedAfterRestart * 1000 >= (uint64_t)(sent - sentBeforeRestart) * (1000 - 2 * scenario.link.loss), "restart: loss after the restart within the link's loss rate");
+    return ok;
+}
+
+struct PacedSettings : APPLEMIDI_NAMESPACE::DefaultSettings
+{
+    static const uint32_t MaxSendBitrate = 32000; // 4000 bytes per second
+    static const uint16_t PacingBurstSize = 256;
+    static const size_t SysExPacketMaxSize = 200;
+};
+
+// The bytes of the packets from the given one on never go over the burst,
+// plus the rate since, plus the packet that took the last tokens
+static bool underCeiling(const std::vector<RtpClient::Packet> &packets, size_t first, size_t last, uint32_t since)
+{
+    const uint32_t rate = PacedSettings::MaxSendBitrate / 8;
+    size_t largest = 0;
+    uint64_t bytes = 0;
+    for (size_t i = first; i < last; i++)
+    {
+        if (packets[i].size > largest)
+            largest = packets[i].size;
+        bytes += packets[i].size;
+        if (bytes > PacedSettings::PacingBurstSize + (uint64_t)rate * (packets[i].ms - since) / 1000 + largest)
+            return false;
+    }
+    return true;
+}
+
+// A paced session (USE_PACING, MaxSendBitrate) asked for four times its rate
+// in NoteOns for 2 s: a burst of PacingBurstSize bytes, then the rate, and the
+// notes that were taken all arrive. After a second of rest, a SysEx of 3000
+// bytes is sent again and again with the rest, until all of it is taken.
+// Returns false when the pacing does not hold.
+static bool runPacing(uint32_t seed)
+{
+    const uint32_t notesMs = 2000;
+    const uint32_t restMs = 1000;
+
+    std::vector<uint8_t> sysEx(3000);
+    for (size_t i = 0; i < sysEx.size(); i++)
+        sysEx[i] = i & 0x7F;
+
+    uint32_t elapsed = 0;
+    uint32_t notesSince = 0;
+    uint32_t sysExSince = 0;
+    uint32_t notesTaken = 0;
+    uint32_t sysExCalls = 0;
+    size_t sysExTaken = 0;
+
+    std::vector<RtpClient::Packet> packets;
+    const bool connected = record<PacedSettings>(seed, notesMs + restMs + 2000, packets, [&](AppleMIDISession<SimUDP, PacedSettings> &session) {
+        if (elapsed == 0)
+            notesSince = millis();
+        if (elapsed < notesMs)
+        {
+            for (uint8_t i = 0; i < 4; i++)
+                if (session.sendNoteOn(notesTaken & 0x7F, (notesTaken >> 7) & 0x7F, 1))
+                    notesTaken++;
+        }
+        else if (elapsed >= notesMs + restMs && sysExTaken < sysEx.size())
+        {
+            if (sysExSince == 0)
+                sysExSince = millis();
+            sysExTaken += session.sendSysEx(sysEx.data() + sysExTaken, sysEx.size() - sysExTaken);
+            sysExCalls++;
+        }
+        elapsed++;
+    });
+
+    // the packets of the notes and those of the SysEx
+    size_t sysExFirst = 0;
+    while (sysExFirst < packets.size() && packets[sysExFirst].ms <= sysExSince)
+        sysExFirst++;
+
+    std::vector<uint8_t> seen(notesTaken);
+    uint32_t received = 0;
+    uint64_t notesBytes = 0;
+    uint64_t burstBytes = 0;
+    for (size_t i = 0; i < sysExFirst; i++)
+    {
+        notesBytes += packets[i].size;
+        if (packets[i].ms - notesSince <= 20)
+            burstBytes += packets[i].size;
+        for (const auto &command : commandsOf(packets[i].midi))
+        {
+            const uint32_t serial = (command.size() == 3) ? command[1] | (command[2] << 7) : notesTaken;
+            if (command[0] == 0x90 && serial < seen.size() && seen[serial]++ == 0)
+                received++;
+        }
+    }
+
+    // the SysEx segments (F0..F0, F7..F0, ..., F7..F7), put back together
+    std::vector<uint8_t> joined;
+    bool segmented = true;
+    for (size_t i = sysExFirst; i < packets.size(); i++)
+        for (const auto &command : commandsOf(packets[i].midi))
+        {
+            const bool first = (i == sysExFirst);
+            const bool last = (i + 1 == packets.size());
+            segmented &= command.size() >= 2 && command[0] == (first ? 0xF0 : 0xF7) && command.back() == (last ? 0xF7 : 0xF0);
+            joined.insert(joined.end(), command.begin() + 1, command.end() - 1);
+        }
+
+    const uint32_t rate = PacedSettings::MaxSendBitrate / 8;
+    printf("%-12s connected %-3s        paced  %6u/%6u notes  %llu bytes in %u ms (burst %llu)  SysEx %u/%u in %u calls\n",
+           "pacing", connected ? "yes" : "no", received, notesTaken, (unsigned long long)notesBytes, notesMs, (unsigned long long)burstBytes,
+           (unsigned)joined.size(), (unsigned)sysEx.size(), sysExCalls);
+
+    Scenario scenario;
+    scenario.name = "pacing";
+    bool ok = check(scenario, connected, "pacing: connected");
+    ok &= check(scenario, underCeiling(packets, 0, sysExFirst, notesSince), "pacing: notes under the burst plus the rate");
+    ok &= check(scenario, notesBytes * 1000 >= (uint64_t)rate * notesMs * 9 / 10, "pacing: notes at the rate");
+    ok &= check(scenario, burstBytes >= PacedSettings::PacingBurstSize, "pacing: a burst after rest");
+    ok &= check(scenario, received == notesTaken, "pacing: the notes taken arrive");
+    ok &= check(scenario, underCeiling(packets, sysExFirst, packets.size(), sysExSince), "pacing: SysEx under the burst plus the rate");
+    ok &= check(scenario, sysExCalls > 1 && segmented && joined == sysEx, "pacing: SysEx resumed, and intact");
+    return ok;
+}
+
+template <FlushPolicy Policy>
+struct FlushSettings : APPLEMIDI_NAMESPACE::DefaultSettings
+{
+    static const FlushPolicy OutgoingFlush = Policy;
+    static const unsigned long FlushWindow = 5; // ms
+    static const size_t FlushThreshold = 48;
+};
+
+struct FlushStatistics
+{
+    uint32_t notes = 0;
+    uint32_t received = 0;
+    uint32_t packets = 0;
+    uint32_t maxDelay = 0; // ms from queued up to sent
+};
+
+// NoteOns, notesPerMs(elapsed) of them every millisecond for durationMs, from
+// a session with the given flush policy. Counts the packets, and the time the
+// notes spend queued up (the arrival, less the link latency of 1 ms).
+template <FlushPolicy Policy, class Pattern>
+static FlushStatistics flush(uint32_t seed, uint32_t durationMs, Pattern notesPerMs)
+{
+    typedef FlushSettings<Policy> Settings;
+
+    FlushStatistics statistics;
+    std::vector<uint32_t> queuedAt;
+    uint32_t elapsed = 0;
+
+    std::vector<RtpClient::Packet> packets;
+    record<Settings>(seed, durationMs, packets, [&](AppleMIDISession<SimUDP, Settings> &session) {
+        for (uint32_t i = notesPerMs(elapsed++); i > 0; i--)
+        {
+            const uint32_t serial = queuedAt.size();
+            if (session.sendNoteOn(serial & 0x7F, (serial >> 7) & 0x7F, 1))
+                queuedAt.push_back(millis());
+        }
+    });
+
+    statistics.notes = queuedAt.size();
+    statistics.packets = packets.size();
+    for (const auto &packet : packets)
+        for (const auto &command : commandsOf(packet.midi))
+        {
+            const uint32_t serial = (command.size() == 3) ? command[1] | (command[2] << 7) : queuedAt.size();
+            if (command[0] != 0x90 || serial >= queuedAt.size())
+                continue;
+            statistics.received++;
+            const uint32_t delay = packet.ms - 1 - queuedAt[serial];
+            if (delay > statistics.maxDelay)
+                statistics.maxDelay = delay;
+        }
+    return statistics;
+}
+
+static bool checkFlush(const char *name, const FlushStatistics &statistics, bool packetsOk, uint32_t maxDelay)
+{
+    printf("%-12s %-23s notes %6u/%6u  packets %6u  queued up to %u ms\n",
+           "flush", name, statistics.received, statistics.notes, statistics.packets, statistics.maxDelay);
+
+    Scenario scenario;
+    scenario.name = "flush";
+    char what[80];
+    snprintf(what, sizeof(what), "%s: all notes arrive", name);
+    bool ok = check(scenario, statistics.notes > 0 && statistics.received == statistics.notes, what);
+    snprintf(what, sizeof(what), "%s: the number of packets", name);
+    ok &= check(scenario, packetsOk, what);
+    snprintf(what, sizeof(what), "%s: queued up for at most %u ms", name, maxDelay);
+    ok &= check(scenario, statistics.maxDelay <= maxDelay, what);
+    return ok;
+}
+
+// Each FlushPolicy, with a steady stream of NoteOns (and for FlushAtThreshold
+// a heavy one, then a sparse one): the number of packets it makes, and how
+// long it keeps a message queued up. Returns false when a policy does not
+// hold to what it promises.
+static bool runFlushPolicies(uint32_t seed)
+{
+    const uint32_t durationMs = 1000;
+    const uint32_t window = FlushSettings<FlushAfterWindow>::FlushWindow;
+    const uint32_t threshold = FlushSettings<FlushAtThreshold>::FlushThreshold;
+    bool ok = true;
+
+    // all messages of a loop in one packet, sent at the start of the next loop
+    auto statistics = flush<FlushEveryLoop>(seed, durationMs, [](uint32_t) { return 3; });
+    ok &= checkFlush("FlushEveryLoop", statistics, statistics.packets == durationMs, 1);
+
+    // a packet per message, right away
+    statistics = flush<FlushEveryMessage>(seed, durationMs, [](uint32_t) { return 3; });
+    ok &= checkFlush("FlushEveryMessage", statistics, statistics.packets == statistics.notes, 0);
+
+    // a packet per window
+    statistics = flush<FlushAfterWindow>(seed, durationMs, [](uint32_t) { return 1; });
+    ok &= checkFlush("FlushAfterWindow", statistics, statistics.packets <= durationMs / window + 1 && statistics.packets >= durationMs / (window + 1), window);
+
+    // heavy: a packet per FlushThreshold bytes (a NoteOn and its delta time take 4),
+    // more than one per window, but less than one per loop; the last ones wait
+    // for the window. Sparse: a packet per window
+    statistics = flush<FlushAtThreshold>(seed, durationMs, [](uint32_t) { return 8; });
+    ok &= checkFlush("FlushAtThreshold heavy", statistics, statistics.packets <= statistics.notes * 4 / threshold + 1 && statistics.packets > durationMs / window && statistics.packets < durationMs, window);
+    statistics = flush<FlushAtThreshold>(seed, durationMs, [](uint32_t) { return 1; });
+    ok &= checkFlush("FlushAtThreshold sparse", statistics, statistics.packets <= durationMs / window + 1 && statistics.packets >= durationMs / (window + 1), window);
+
+    return ok;
+}
+
+template <RealTimePolicy Policy>
+struct RealTimeSettings : APPLEMIDI_NAMESPACE::DefaultSettings
+{
+    static const RealTimePolicy RealTimeMessages = Policy;
+    static const FlushPolicy OutgoingFlush = FlushAfterWindow; // the notes stay queued up
+    static const unsigned long FlushWindow = 5; // ms
+};
+
+// A NoteOn every millisecond, and a Clock every third, alternately through the
+// MIDI library interface (beginTransmission) and sendBatch(), so that there
+// are nearly always notes queued up when a Clock is sent. With
+// RealTimeFrontOfPacket the Clocks lead the packet they are in, with
+// RealTimeImmediate they go out right away, in a packet of their own.
+// Returns false when they do not.
+template <RealTimePolicy Policy>
+static bool runRealTime(const char *name, uint32_t seed)
+{
+    typedef RealTimeSettings<Policy> Settings;
+
+    const uint32_t durationMs = 1000;
+    uint32_t elapsed = 0;
+    uint32_t notes = 0;
+    uint32_t clocks = 0;
+    std::vector<uint32_t> clockSentAt;
+
+    std::vector<RtpClient::Packet> packets;
+    const bool connected = record<Settings>(seed, durationMs, packets, [&](AppleMIDISession<SimUDP, Settings> &session) {
+        if (session.sendNoteOn(notes & 0x7F, 0x7F, 1))
+            notes++;
+        if (elapsed++ % 3 == 0)
+        {
+            if (clocks % 2 == 0)
+            {
+                if (session.beginTransmission(MIDI_NAMESPACE::MidiType::Clock))
+                {
+                    session.write(MIDI_NAMESPACE::MidiType::Clock);
+                    session.endTransmission();
+                }
+            }
+            else
+            {
+                const MidiEvent clock = {MIDI_NAMESPACE::MidiType::Clock, 0, 0};
+                session.sendBatch(&clock, 1);
+            }
+            clockSentAt.push_back(millis());
+            clocks++;
+        }
+    });
+
+    uint32_t receivedNotes = 0;
+    uint32_t receivedClocks = 0;
+    uint32_t withNotes = 0;       // packets with Clocks and notes
+    bool inFront = true;          // no Clock behind a note
+    bool ownPacket = true;        // no Clock in a packet with a note
+    uint32_t maxClockDelay = 0;   // ms from sent to sent out
+    for (const auto &packet : packets)
+    {
+        bool noteSeen = false;
+        bool clockSeen = false;
+        for (const auto &command : commandsOf(packet.midi))
+        {
+            if (command[0] == MIDI_NAMESPACE::MidiType::Clock)
+            {
+                inFront &= !noteSeen;
+                clockSeen = true;
+                if (receivedClocks < clockSentAt.size())
+                {
+                    const uint32_t delay = packet.ms - 1 - clockSentAt[receivedClocks];
+                    if (delay > maxClockDelay)
+                        maxClockDelay = delay;
+                }
+                receivedClocks++;
+            }
+            else if (command[0] == 0x90)
+            {
+                noteSeen = true;
+                receivedNotes++;
+            }
+        }
+        if (clockSeen && noteSeen)
+        {
+            ownPacket = false;
+            withNotes++;
+        }
+    }
+
+    printf("%-12s %-23s notes %6u/%6u  clocks %4u/%4u  in packets with notes %4u  sent after up to %u ms\n",
+           "real-time", name, receivedNotes, notes, receivedClocks, clocks, withNotes, maxClockDelay);
+
+    Scenario scenario;
+    scenario.name = "real-time";
+    char what[80];
+    snprintf(what, sizeof(what), "%s: connected, and all messages arrive", name);
+    bool ok = check(scenario, connected && notes > 0 && receivedNotes == notes && clocks > 0 && receivedClocks == clocks, what);
+    if (Policy == RealTimeFrontOfPacket)
+    {
+        // the Clocks wait for the window with the notes, in front of them
+        snprintf(what, sizeof(what), "%s: Clocks at the front of the packet", name);
+        ok &= check(scenario, inFront && withNotes > 0, what);
+    }
+    else
+    {
+        snprintf(what, sizeof(what), "%s: Clocks right away, in a packet of their own", name);
+        ok &= check(scenario, ownPacket && maxClockDelay == 0, what);
+    }
+    return ok;
+}
+
+// A Network MIDI 2.0 client, scripted on a bare SimUDP socket (UMPSession
+// only takes the host role). It sends every UMP Data command again in the
+// next datagram, as forward error correction.
+class UmpClient
+{
+public:
+    SimUDP socket;
+    IPAddress hostIP;
+
+    bool accepted = false;
+    bool resetReplied = false;
+    bool byeReplied = false;
+
+    // a datagram with a single command
+    void sendCommand(uint8_t code, uint16_t data, const uint8_t *payload = nullptr, uint8_t words = 0)
+    {
+        uint8_t header[UMP_SIGNATURE_LEN + UMP_COMMAND_HEADER_LEN] = {'M', 'I', 'D', 'I', code, words};
+        store_be16(header + 6, data);
+        socket.beginPacket(hostIP, DEFAULT_UMP_PORT);
+        socket.write(header, sizeof(header));
+        socket.write(payload, words * UMP_WORD_LEN);
+        socket.endPacket();
+    }
+
+    void invite()
+    {
+        static const uint8_t name[UMP_WORD_LEN] = {'s', 'i', 'm'};
+        sendCommand(UmpInvitation, 1 << 8, name, 1);
+    }
+
+    // A MIDI 2.0 NoteOn, the serial number as velocity and attribute, in the
+    // UMP Data command sequenceNr, behind the previous one
+    void sendNote(uint32_t serial)
+    {
+        uint8_t command[UMP_COMMAND_HEADER_LEN + 2 * UMP_WORD_LEN] = {UmpData, 2};
+        store_be16(command + 2, sequenceNr++);
+        store_be32(command + 4, 0x40903C00);
+        store_be32(command + 8, serial);
+
+        socket.beginPacket(hostIP, DEFAULT_UMP_PORT);
+        socket.write(umpSignature, sizeof(umpSignature));
+        if (hasPrevious)
+            socket.write(previous, sizeof(previous));
+        socket.write(command, sizeof(command));
+        socket.endPacket();
+
+        memcpy(previous, command, sizeof(previous));
+        hasPrevious = true;
+    }
+
+    // both sides count from 0 again
+    void restart()
+    {
+        sequenceNr = 0;
+        hasPrevious = false;
+    }
+
+    void receive()
+    {
+        uint8_t packet[256];
+        while (socket.parsePacket() > 0)
+        {
+            const size_t size = socket.read(packet, sizeof(packet));
+            for (size_t i = UMP_SIGNATURE_LEN; i + UMP_COMMAND_HEADER_LEN <= size; i += UMP_COMMAND_HEADER_LEN + packet[i + 1] * UMP_WORD_LEN)
+            {
+                switch (packet[i])
+                {
+                case UmpInvitationAccepted:
+                    accepted = true;
+                    break;
+                case UmpSessionResetReply:
+                    resetReplied = true;
+                    break;
+                case UmpByeReply:
+                    byeReplied = true;
+                    break;
+                case UmpPing:
+                    sendCommand(UmpPingReply, 0, packet + i + UMP_COMMAND_HEADER_LEN, 1);
+                    break;
+                }
+            }
+        }
+    }
+
+private:
+    uint16_t sequenceNr = 0;
+    uint8_t previous[UMP_COMMAND_HEADER_LEN + 2 * UMP_WORD_LEN];
+    bool hasPrevious = false;
+};
+
+static bool umpConnected = false;
+static uint32_t umpDisconnects = 0;
+
+// Before and after a session reset the client is quiet for this long, so that
+// no datagram of the old sequence arrives after the reset, and no late copy of
+// the reset after the new sequence has started
+static const uint32_t UmpResetQuietMs = 100;
+
+// Invitation, UMP Data with forward error correction (and the duplicates it
+// makes, plus those of the link), a session reset halfway, then bye.
+// Returns false when the invariants of the link do not hold.
+static bool runUmp(const Scenario &scenario, uint32_t seed, uint32_t durationMs)
+{
+    SimNetwork network(seed);
+    network.setLink(scenario.link);
+
+    UMPSession<SimUDP> host("host");
+    UmpClient client;
+
+    client.hostIP = IPAddress(10, 0, 0, 1);
+    network.attach(client.hostIP);
+    host.begin();
+    network.attach(IPAddress(10, 0, 0, 2));
+    client.socket.begin(DEFAULT_UMP_PORT);
+
+    umpConnected = false;
+    umpDisconnects = 0;
+    host.setHandleConnected([](const IPAddress &, const char *) { umpConnected = true; });
+    host.setHandleDisconnected([](const IPAddress &) { umpConnected = false; umpDisconnects++; });
+
+    enum { Inviting, Sending, Quiet, Resetting, Resuming, Leaving } state = Inviting;
+    uint32_t connectedAt = 0;
+    uint32_t stateSince = 0;
+    uint32_t resets = 0;
+    uint32_t sentBeforeReset = 0;
+    uint32_t receivedAfterReset = 0;
+
+    std::vector<uint8_t> seen; // times each serial number was received
+    uint32_t received = 0;
+    uint32_t duplicates = 0;
+
+    for (uint32_t ms = 0; ms < durationMs + DrainMs; ms++)
+    {
+        uint32_t words[UMP_MAX_WORDS];
+        while (host.available() > 0)
+            if (host.read(words) == 2 && words[0] == 0x40903C00 && words[1] < seen.size())
+            {
+                if (seen[words[1]]++ > 0)
+                    duplicates++;
+                received++;
+                if (resets > 0 && words[1] >= sentBeforeReset)
+                    receivedAfterReset++;
+            }
+
+        client.receive();
+
+        // retried every 100 ms until answered
+        const bool retry = (ms - stateSince) % 100 == 0;
+        switch (state)
+        {
+        case Inviting:
+            if (client.accepted)
+            {
+                connectedAt = millis();
+                state = Sending;
+            }
+            else if (retry)
+                client.invite();
+            break;
+        case Sending:
+            if (ms >= durationMs)
+            {
+                state = Leaving;
+                stateSince = ms;
+            }
+            else if (resets == 0 && ms - connectedAt >= durationMs / 2)
+            {
+                state = Quiet;
+                stateSince = ms;
+                sentBeforeReset = seen.size();
+            }
+            else
+            {
+                client.sendNote(seen.size());
+                seen.push_back(0);
+            }
+            break;
+        case Quiet:
+            if (ms - stateSince >= UmpResetQuietMs)
+            {
+                state = Resetting;
+                stateSince = ms;
+            }
+            break;
+        case Resetting:
+            if (client.resetReplied)
+            {
+                client.restart();
+                resets++;
+                state = Resuming;
+                stateSince = ms;
+            }
+            else if (retry)
+                client.sendCommand(UmpSessionReset, 0);
+            break;
+        case Resuming:
+            if (ms - stateSince >= UmpResetQuietMs)
+                state = Sending;
+            break;
+        case Leaving:
+            if (!client.byeReplied && retry)
+                client.sendCommand(UmpBye, UmpByeUserTerminated << 8);
+            break;
+        }
+
+        network.advance(1000);
+    }
+
+    const uint32_t sent = seen.size();
+    printf("%-12s connected at %5u ms  UMP    %6u/%6u  duplicates %u  resets %u  participants left %u\n",
+           scenario.name, connectedAt, received, sent, duplicates, resets, (unsigned)host.getNumberOfParticipants());
+
+    const uint32_t maxConnectMs = ((scenario.link.loss == 0) ? MaxConnectMs : MaxConnectLossyMs) +
+                                  4 * (scenario.link.latency + scenario.link.jitter) / 1000;
+    bool ok = check(scenario, connectedAt > 0 && connectedAt <= maxConnectMs, "UMP: connected in time");
+    ok &= check(scenario, duplicates == 0 && received <= sent, "UMP: no UMP received more often than sent");
+    if (scenario.link.reorder == 0 && scenario.link.jitter == 0)
+    {
+        // the forward error correction makes up for a single lost datagram
+        if (scenario.link.loss == 0)
+            ok &= check(scenario, received == sent, "UMP: no loss");
+        else
+            ok &= check(scenario, (uint64_t)received * 1000 >= (uint64_t)sent * (1000 - scenario.link.loss / 4), "UMP: loss recovered by the FEC");
+    }
+    else // what arrives after a later datagram is skipped, unless the FEC brought it
+        ok &= check(scenario, (uint64_t)received * 1000 >= (uint64_t)sent * (1000 - 2 * (scenario.link.loss + scenario.link.reorder)), "UMP: loss within the link's loss and reorder rate");
+    ok &= check(scenario, resets == 1 && receivedAfterReset > 0, "UMP: data after the session reset");
+    ok &= check(scenario, client.byeReplied && umpDisconnects == 1 && host.getNumberOfParticipants() == 0, "UMP: bye ends the session");
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t seed = (argc > 1) ? (uint32_t)strtoul(argv[1], nullptr, 0) : 1;
+
+    Scenario scenarios[5];
+
+    scenarios[0].name = "ideal";
+
+    scenarios[1].name = "lossy";
+    scenarios[1].link.loss = 50;
+
+    scenarios[2].name = "reordering";
+    scenarios[2].link.jitter = 2000;
+    scenarios[2].link.reorder = 50;
+    scenarios[2].link.duplicate = 10;
+
+    scenarios[3].name = "wan";
+    scenarios[3].link.latency = 40000;
+    scenarios[3].link.jitter = 10000;
+    scenarios[3].link.loss = 10;
+
+    scenarios[4].name = "narrow";
+    scenarios[4].link.bandwidth = 16000;
+
+    auto start = std::chrono::steady_clock::now();
+
+    const uint32_t durationMs = 60000;
+    bool ok = true;
+    for (auto &scenario : scenarios)
+        ok &= run(scenario, seed, durationMs);
+
+    // SysEx larger than a packet, on the links that keep the order
+    ok &= runSysEx(scenarios[0], seed);
+    ok &= runSysEx(scenarios[4], seed);
+
+    // a peer that restarts its sequence numbers, on the local links
+    const uint32_t restartDurationMs = 10000; // the serial numbers of the notes have 14 bits
+    for (uint8_t i = 0; i < 3; i++)
+        ok &= runRestart(scenarios[i], seed, restartDurationMs);
+
+    // a session paced to a low bitrate
+    ok &= runPacing(seed);
+
+    // the flush policies, and what they cost in packets and latency
+    ok &= runFlushPolicies(seed);
+
+    // real-time messages ahead of the queued up ones
+    ok &= runRealTime<RealTimeFrontOfPacket>("RealTimeFrontOfPacket", seed);
+    ok &= runRealTime<RealTimeImmediate>("RealTimeImmediate", seed);
+
+    // the local links, for Network MIDI 2.0
+    const uint32_t umpDurationMs = 20000;
+    for (uint8_t i = 0; i < 3; i++)
+        ok &= runUmp(scenarios[i], seed, umpDurationMs);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    printf("%u virtual seconds in %lld ms\n", (unsigned)((durationMs + DrainMs) / 1000 * 5 + 2 * DrainMs / 1000 * 2 + 6 + 5 * 2 + 1 * 2 + (restartDurationMs + DrainMs) / 1000 * 3 + (umpDurationMs + DrainMs) / 1000 * 3), (long long)elapsed);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,269 @@
+#pragma once
+
+// Shared by the fuzz targets: an in-memory UdpClass, a Tracer that counts the
+// parser calls, and the loop that feeds the datagrams of one fuzz input to a
+// fresh session while checking that
+//  - every datagram is read from its socket: the session never stops reading
+//    (which would stall the MIDI loop, as available() is called from MIDI.read())
+//  - the work, counted in parser calls (by the Tracer) and available() calls,
+//    stays within WorkPerByte per byte of input: linear in the size of the input
+// A violation aborts, so libFuzzer keeps the input as a crash.
+//
+// Input format: datagrams, each preceded by 2 bytes, big endian. The top bit
+// selects the port (0 control, 1 data) when the target uses both, the other
+// 15 bits are the length. The last datagram may be shorter.
+//
+// The session is an AppleMIDISession (FuzzSession_t) or a UMPSession
+// (FuzzUmpSession_t), both on FuzzUDP.
+
+#define SIMULATED_CLOCK
+#define NO_ARDUINO_MAIN
+#include "Arduino.h"
+
+#include "../../src/AppleMIDI.cpp"
+#include "../../src/UMP_Session.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <deque>
+#include <vector>
+
+USING_NAMESPACE_APPLEMIDI
+
+class FuzzUDP
+{
+public:
+    static const uint8_t MaxSockets = 2;
+
+    void begin(uint16_t port)
+    {
+        _port = port;
+        for (auto &socket : _sockets)
+            if (nullptr == socket)
+            {
+                socket = this;
+                return;
+            }
+    }
+
+    void stop()
+    {
+        for (auto &socket : _sockets)
+            if (this == socket)
+                socket = nullptr;
+    }
+
+    int beginPacket(IPAddress, uint16_t) { return 1; }
+    size_t write(uint8_t) { return 1; }
+    size_t write(const uint8_t *, size_t size) { return size; }
+    int endPacket() { return 1; }
+    void flush() {}
+
+    int parsePacket()
+    {
+        _rx.clear();
+        _rxPosition = 0;
+        if (_pending.empty())
+            return 0;
+        _rx.swap(_pending.front());
+        _pending.pop_front();
+        return (int)_rx.size();
+    }
+
+    int available() { return (int)(_rx.size() - _rxPosition); }
+
+    int read() { return (_rxPosition < _rx.size()) ? _rx[_rxPosition++] : -1; }
+
+    int read(uint8_t *buffer, size_t size)
+    {
+        size_t n = 0;
+        while (n < size && _rxPosition < _rx.size())
+            buffer[n++] = _rx[_rxPosition++];
+        return (int)n;
+    }
+
+    IPAddress remoteIP() { return IPAddress(10, 0, 0, 2); }
+    uint16_t remotePort() { return _port; } // the peer uses the same port numbers
+
+    static void deliver(uint16_t port, const uint8_t *data, size_t size)
+    {
+        for (auto socket : _sockets)
+            if (nullptr != socket && socket->_port == port)
+                socket->_pending.push_back(std::vector<uint8_t>(data, data + size));
+    }
+
+    // bytes not read yet by the session, in all sockets
+    static size_t unread()
+    {
+        size_t n = 0;
+        for (auto socket : _sockets)
+            if (nullptr != socket)
+            {
+                n += socket->available();
+                for (auto &datagram : socket->_pending)
+                    n += datagram.size();
+            }
+        return n;
+    }
+
+    static void reset()
+    {
+        for (auto &socket : _sockets)
+            socket = nullptr;
+    }
+
+private:
+    static FuzzUDP *_sockets[MaxSockets];
+
+    uint16_t _port = 0;
+    std::deque<std::vector<uint8_t>> _pending;
+    std::vector<uint8_t> _rx;
+    size_t _rxPosition = 0;
+};
+
+FuzzUDP *FuzzUDP::_sockets[FuzzUDP::MaxSockets];
+
+// The work counter
+struct CountingTrace
+{
+    static size_t parses;
+
+    static inline void trace(TraceEvent event, amPortType, uint16_t)
+    {
+        if (TraceParseBegin == event)
+            parses++;
+    }
+};
+
+size_t CountingTrace::parses = 0;
+
+typedef AppleMIDISession<FuzzUDP, APPLEMIDI_NAMESPACE::DefaultSettings, DefaultPlatform, CountingTrace> FuzzSession_t;
+typedef UMPSession<FuzzUDP, DefaultUmpSettings, DefaultPlatform, CountingTrace> FuzzUmpSession_t;
+
+static const uint16_t controlPort = DEFAULT_CONTROL_PORT;
+static const uint16_t dataPort = DEFAULT_CONTROL_PORT + 1;
+
+// The port a datagram of the input goes to
+static uint16_t inputPort(const FuzzSession_t &, bool control) { return control ? controlPort : dataPort; }
+static uint16_t inputPort(const FuzzUmpSession_t &session, bool) { return session.getPort(); }
+
+// Takes the next message out of the session, as the application does
+static void readMessage(FuzzSession_t &session) { session.read(); }
+static void readMessage(FuzzUmpSession_t &session)
+{
+    uint32_t words[UMP_MAX_WORDS];
+    session.read(words);
+}
+
+static void fail(const char *reason, size_t value, size_t limit)
+{
+    fprintf(stderr, "%s: %zu (limit %zu)\n", reason, value, limit);
+    abort();
+}
+
+// Work done for the current input: parser calls, and available() calls
+static size_t availableCalls = 0;
+
+static size_t work() { return CountingTrace::parses + availableCalls; }
+
+// Allowed work per byte of input (and per datagram). The parsers are called at
+// most once per byte, plus a few times per available() that ends up waiting for data.
+static const size_t WorkPerByte = 4;
+
+// Feeds one datagram to the session, and calls available() and read() the way
+// MIDI.read() does until the session is idle.
+template <class Session>
+static void feed(Session &session, uint16_t port, const uint8_t *data, size_t size)
+{
+    FuzzUDP::deliver(port, data, size);
+
+    // what is left in the buffers from earlier datagrams is parsed as well
+    const size_t limit = work() + WorkPerByte * (size + 2 * APPLEMIDI_NAMESPACE::DefaultSettings::MaxBufferSize + 1);
+
+    while (true)
+    {
+        const auto unread = FuzzUDP::unread();
+
+        size_t midi = 0;
+        availableCalls++;
+        while (session.available() > 0)
+        {
+            readMessage(session);
+            midi++;
+            availableCalls++;
+        }
+        simulatedMicros += 100;
+
+        // no progress: all read, or stalled
+        if (midi == 0 && FuzzUDP::unread() == unread)
+            break;
+
+        if (work() > limit)
+            fail("MIDI loop does not get idle, work", work(), limit);
+    }
+
+    if (FuzzUDP::unread() > 0)
+        fail("datagram not read, bytes", FuzzUDP::unread(), 0);
+}
+
+// Feeds the datagrams of a fuzz input (see the input format above) to a fresh
+// session, and checks the total work.
+template <class Session = FuzzSession_t, class Setup>
+static void run(const uint8_t *data, size_t size, bool bothPorts, Setup setup)
+{
+    FuzzUDP::reset();
+    simulatedMicros = 0;
+
+    Session session("fuzz");
+    session.begin();
+    setup(session);
+
+    CountingTrace::parses = 0;
+    availableCalls = 0;
+    const size_t limit = WorkPerByte * (size + 1);
+
+    while (size >= 2)
+    {
+        const uint16_t port = inputPort(session, bothPorts && !(data[0] & 0x80));
+        size_t length = ((data[0] & 0x7F) << 8) | data[1];
+        data += 2;
+        size -= 2;
+        if (length > size)
+            length = size;
+
+        feed(session, port, data, length);
+
+        data += length;
+        size -= length;
+    }
+
+    if (work() > limit)
+        fail("work", work(), limit);
+}
+
+// Replays the files given on the command line, when not linked with libFuzzer
+#ifndef FUZZING_ENGINE
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++)
+    {
+        FILE *file = fopen(argv[i], "rb");
+        if (nullptr == file)
+        {
+            perror(argv[i]);
+            return 1;
+        }
+        std::vector<uint8_t> input;
+        int c;
+        while ((c = fgetc(file)) != EOF)
+            input.push_back((uint8_t)c);
+        fclose(file);
+
+        LLVMFuzzerTestOneInput(input.data(), input.size());
+        printf("%s: %zu bytes, work %zu\n", argv[i], input.size(), work());
+    }
+    return 0;
+}
+#endif
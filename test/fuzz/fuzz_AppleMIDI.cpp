@@ -0,0 +1,18 @@
+// libFuzzer target for AppleMIDIParser: AppleMIDI messages (IN, OK, NO, BY,
+// CK, RS) on the control port and the data port of a session, in any order.
+//
+// With libFuzzer (clang), see ci/fuzz.sh:
+//     clang++ -std=c++11 -g -O1 -fsanitize=fuzzer,address,undefined -DFUZZING_ENGINE
+//             -I.. -I../../src -I<arduino_midi_library>/src fuzz_AppleMIDI.cpp -o fuzz_AppleMIDI
+//     ./fuzz_AppleMIDI -timeout=1 corpus/
+// Without, it replays the files given on the command line (e.g. a crash):
+//     g++ -std=c++11 -I.. -I../../src -I<arduino_midi_library>/src fuzz_AppleMIDI.cpp -o fuzz_AppleMIDI
+//     ./fuzz_AppleMIDI crash-...
+
+#include "FuzzSession.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    run(data, size, true, [](FuzzSession_t &) {});
+    return 0;
+}
@@ -0,0 +1,30 @@
+// libFuzzer target for the parser of UMPSession (Network MIDI 2.0): datagrams
+// of command packets on the UMP port of a session that the remote has joined,
+// so that its UMP Data commands are decoded.
+//
+// With libFuzzer (clang), see ci/fuzz.sh:
+//     clang++ -std=c++11 -g -O1 -fsanitize=fuzzer,address,undefined -DFUZZING_ENGINE
+//             -I.. -I../../src -I<arduino_midi_library>/src fuzz_UMP.cpp -o fuzz_UMP
+//     ./fuzz_UMP -timeout=1 corpus/
+// Without, it replays the files given on the command line (e.g. a crash):
+//     g++ -std=c++11 -I.. -I../../src -I<arduino_midi_library>/src fuzz_UMP.cpp -o fuzz_UMP
+//     ./fuzz_UMP crash-...
+//
+// All datagrams of the input go to the UMP port (the port bit is ignored).
+
+#include "FuzzSession.h"
+
+// Invitation from the remote: endpoint name "fuzz" (1 word), no Product Instance Id
+static const uint8_t invitation[] = {
+    'M', 'I', 'D', 'I',
+    UmpInvitation, 0x01, 0x01, 0x00,
+    'f', 'u', 'z', 'z',
+};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    run<FuzzUmpSession_t>(data, size, false, [](FuzzUmpSession_t &session) {
+        feed(session, session.getPort(), invitation, sizeof(invitation));
+    });
+    return 0;
+}
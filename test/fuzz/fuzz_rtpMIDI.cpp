@@ -0,0 +1,30 @@
+// libFuzzer target for rtpMIDIParser: RTP-MIDI packets on the data port of a
+// session that the remote (SSRC 0x11223344) has joined, so that the MIDI
+// command section and the journal of its packets are decoded.
+//
+// With libFuzzer (clang), see ci/fuzz.sh:
+//     clang++ -std=c++11 -g -O1 -fsanitize=fuzzer,address,undefined -DFUZZING_ENGINE
+//             -I.. -I../../src -I<arduino_midi_library>/src fuzz_rtpMIDI.cpp -o fuzz_rtpMIDI
+//     ./fuzz_rtpMIDI -timeout=1 corpus/
+// Without, it replays the files given on the command line (e.g. a crash):
+//     g++ -std=c++11 -I.. -I../../src -I<arduino_midi_library>/src fuzz_rtpMIDI.cpp -o fuzz_rtpMIDI
+//     ./fuzz_rtpMIDI crash-...
+//
+// All datagrams of the input go to the data port (the port bit is ignored).
+
+#include "FuzzSession.h"
+
+// IN on the control port and on the data port, from the remote
+static const uint8_t invitation[] = {
+    0xff, 0xff, 'I', 'N', 0x00, 0x00, 0x00, 0x02,
+    0x55, 0x66, 0x77, 0x88, 0x11, 0x22, 0x33, 0x44,
+};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    run(data, size, false, [](FuzzSession_t &session) {
+        feed(session, controlPort, invitation, sizeof(invitation));
+        feed(session, dataPort, invitation, sizeof(invitation));
+    });
+    return 0;
+}